@@ -0,0 +1,751 @@
+// bench.cc: calc benchmarks.
+// SPDX-FileCopyrightText: © 2021-2022 Bradley M. Jones <brdjns@gmx.us>
+// SPDX-License-Identifier: MIT
+
+#include "ast.h"
+#include "batch.h"
+#include "bigint.h"
+#include "bytecode.h"
+#include "evaluate.h"
+#include "format.h"
+#include "function.h"
+#include "jit.h"
+#include "map.h"
+#include "number.h"
+#include "optimise.h"
+#include "parse.h"
+#include "session.h"
+#include "symbol_table.h"
+#include "token.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+    // Formulas to benchmark, over the variables x, y and w, by name.
+    const std::vector<std::pair<std::string, std::string>> formulas{
+        {"sum", "x + y;"},
+        {"mixed", "x * y + sqrt(w) - 3 / (x + 1);"},
+        {"long",
+         "((x + 1) * (y - 2) + w * 3) / (x * x + 1) % 7 + abs(y - w) ^ 2;"},
+        {"math", "sin(x) * cos(y) + exp(-w) + max(x, y);"},
+    };
+
+    // Values the variables cycle through, so that no result can be hoisted.
+    const std::vector<double> inputs{1.5, 2.25, 3.0, 4.75, 5.5, 6.125, 7.0};
+
+    // Times each benchmark is run; the fastest run is reported.
+    constexpr int trials{3};
+
+    using Clock = std::chrono::steady_clock;
+
+    // Nanoseconds per iteration of f over n iterations, at best.
+    template<class F>
+    double time_per_eval(long n, F f)
+    {
+        double best{0};
+        for (int t = 0; t < trials; ++t) {
+            Clock::time_point start{Clock::now()};
+            for (long i = 0; i < n; ++i) {
+                f(i);
+            }
+            std::chrono::duration<double, std::nano> elapsed{Clock::now() -
+                                                             start};
+            if (t == 0 || elapsed.count() < best) {
+                best = elapsed.count();
+            }
+        }
+        return best / n;
+    }
+
+    // Set the benchmark variables from the ith input.
+    template<class T>
+    void bind_inputs(T* slots, const int* slot, long i)
+    {
+        std::size_t n{inputs.size()};
+        slots[slot[0]] = static_cast<T>(inputs[i % n]);
+        slots[slot[1]] = static_cast<T>(inputs[(i + 1) % n]);
+        slots[slot[2]] = static_cast<T>(inputs[(i + 2) % n]);
+    }
+
+    // @class Null_buffer
+    // @brief A stream buffer that discards its output.
+    class Null_buffer : public std::streambuf {
+    protected:
+        int overflow(int ch) override { return ch; }
+        std::streamsize xsputn(const char*, std::streamsize n) override
+        {
+            return n;
+        }
+    };
+
+    // @class Result
+    // @brief The outcome of one benchmark.
+    class Result {
+    public:
+        std::string name; // a benchmark, as group/case
+        double value;     // a measurement
+        std::string unit; // what value measures
+    };
+
+    // @class Suite
+    // @brief Runs the benchmarks selected, and reports their results as
+    // text or JSON.
+    class Suite {
+    public:
+        std::string filter; // run only benchmarks whose names start so
+        bool is_json{};     // true to report results as JSON
+
+        // Determine if a benchmark, or group of benchmarks, is selected.
+        bool wants(const std::string& name) const
+        {
+            return name.compare(0, filter.size(), filter) == 0 ||
+                   filter.compare(0, name.size(), name) == 0;
+        }
+
+        // Record a result, printing it at once unless reporting JSON.
+        void add(const std::string& name, double value,
+                 const std::string& unit)
+        {
+            if (name.compare(0, filter.size(), filter) != 0) {
+                return;
+            }
+            results.push_back(Result{name, value, unit});
+            if (!is_json) {
+                std::printf("%-40s %14.2f %s\n", name.c_str(), value,
+                            unit.c_str());
+                std::fflush(stdout);
+            }
+        }
+
+        // Print the results as JSON; names and units need no escaping.
+        void print_json() const
+        {
+            bool is_native{compile_native(emit(Node{1.0}))};
+            std::printf("{\n  \"context\": {\"batch_isa\": \"%s\", "
+                        "\"native\": %s},\n  \"benchmarks\": [\n",
+                        batch_isa(), is_native ? "true" : "false");
+            for (std::size_t i = 0; i < results.size(); ++i) {
+                const Result& r{results[i]};
+                std::printf("    {\"name\": \"%s\", \"value\": %.6g, "
+                            "\"unit\": \"%s\"}%s\n",
+                            r.name.c_str(), r.value, r.unit.c_str(),
+                            i + 1 < results.size() ? "," : "");
+            }
+            std::printf("  ]\n}\n");
+        }
+
+    private:
+        std::vector<Result> results;
+    };
+
+    volatile double sink{};
+
+    // Scan tokens from a large script.
+    void bench_lexer(Suite& suite)
+    {
+        std::string script;
+        for (int i = 0; script.size() < (64 << 20); ++i) {
+            script += "let v" + std::to_string(i) +
+                      " = 3.25 * (x + 1.5e3) - abs(y_1) / 7;\n";
+        }
+        std::size_t tokens{0};
+        double lex_ns{time_per_eval(1, [&](long) {
+            tokens = 0;
+            Token_stream ts{std::string_view{script}};
+            while (ts.get().kind != quit_tok) {
+                ++tokens;
+            }
+        })};
+        suite.add("lex/get", lex_ns / tokens, "ns/token");
+        suite.add("lex/throughput", script.size() / lex_ns * 1e3, "MB/s");
+    }
+
+    // Parse n copies of text, each followed by ';', with parse.
+    template<class F>
+    double time_per_parse(const std::string& text, F parse)
+    {
+        constexpr int copies{1 << 18};
+        std::string script;
+        for (int i = 0; i < copies; ++i) {
+            script += text;
+            script += ";\n";
+        }
+        return time_per_eval(1, [&](long) {
+                   Token_stream ts{std::string_view{script}};
+                   for (int i = 0; i < copies; ++i) {
+                       parse(ts);
+                       ts.get(); // the ';'
+                   }
+               }) /
+               copies;
+    }
+
+    // Parse at each level of the grammar.
+    void bench_parser(Suite& suite, Symbol_table& names)
+    {
+        suite.add("parse/factor", time_per_parse("(x)", [&](Token_stream& ts) {
+                      factor(ts, names);
+                  }),
+                  "ns/parse");
+        suite.add("parse/power_expression",
+                  time_per_parse("x ^ 2", [&](Token_stream& ts) {
+                      power_expression(ts, names);
+                  }),
+                  "ns/parse");
+        suite.add("parse/term",
+                  time_per_parse("x * y / w", [&](Token_stream& ts) {
+                      term(ts, names);
+                  }),
+                  "ns/parse");
+        suite.add("parse/expression",
+                  time_per_parse("x * y + w - 3", [&](Token_stream& ts) {
+                      expression(ts, names);
+                  }),
+                  "ns/parse");
+        suite.add("parse/statement",
+                  time_per_parse("let v = x * y + w - 3",
+                                 [&](Token_stream& ts) {
+                                     statement(ts, names);
+                                 }),
+                  "ns/parse");
+    }
+
+    // Look names up in symbol tables of increasing size.
+    void bench_symbols(Suite& suite)
+    {
+        for (int size : {10, 100, 1000, 10000, 100000}) {
+            std::vector<std::string> ids;
+            for (int i = 0; i < size; ++i) {
+                ids.push_back("v" + std::to_string(i));
+            }
+            Symbol_table table;
+            double declare_ns{time_per_eval(1, [&](long) {
+                table = Symbol_table{};
+                for (const std::string& id : ids) {
+                    table.declare(id, 0, false);
+                }
+            })};
+            suite.add("symbols/declare/" + std::to_string(size),
+                      declare_ns / size, "ns/variable");
+            suite.add("symbols/find/" + std::to_string(size),
+                      time_per_eval(1 << 22,
+                                    [&](long i) {
+                                        sink = table.find(
+                                            ids[(i * 7919) % size]);
+                                    }),
+                      "ns/lookup");
+        }
+    }
+
+    // Compute factorials.
+    void bench_factorial(Suite& suite)
+    {
+        suite.add("factorial/0-170",
+                  time_per_eval(1 << 20,
+                                [](long i) {
+                                    sink = fn_factorial(
+                                        static_cast<double>(i % 171));
+                                }),
+                  "ns/call");
+        suite.add("factorial/gamma",
+                  time_per_eval(1 << 20,
+                                [](long i) {
+                                    sink = fn_factorial((i % 1700) * 0.1 +
+                                                        0.05);
+                                }),
+                  "ns/call");
+        for (unsigned n : {1000u, 10000u, 100000u}) {
+            suite.add("factorial/exact/" + std::to_string(n),
+                      time_per_eval(1,
+                                    [&](long) {
+                                        sink = static_cast<double>(
+                                            exact_factorial(n).digits());
+                                    }) /
+                          1e6,
+                      "ms");
+        }
+    }
+
+    // Format results, as the interactive calculator and map mode do.
+    void bench_format(Suite& suite)
+    {
+        constexpr long count{1 << 20};
+        Null_buffer null;
+        std::ostream out{&null};
+        out.precision(19);
+        suite.add("format/ostream", time_per_eval(count, [&](long i) {
+                      out << i * 1.000001 / 7 << '\n';
+                  }),
+                  "ns/number");
+        char buf[64];
+        suite.add("format/snprintf", time_per_eval(count, [&](long i) {
+                      sink = std::snprintf(buf, sizeof buf, "%.*g\n", 19,
+                                           i * 1.000001 / 7);
+                  }),
+                  "ns/number");
+
+        // The formats results can be printed in, through std::to_chars.
+        const std::pair<const char*, Number_format> formats[]{
+            {"shortest", Number_format{Notation::shortest}},
+            {"digits", Number_format{Notation::digits, 19}},
+            {"fixed", Number_format{Notation::fixed, 6}},
+            {"hex", Number_format{Notation::hex}},
+        };
+        char text[max_number_size];
+        for (const auto& f : formats) {
+            suite.add(std::string{"format/"} + f.first,
+                      time_per_eval(count,
+                                    [&](long i) {
+                                        sink = format_number(
+                                                   text, text + sizeof text,
+                                                   i * 1.000001 / 7,
+                                                   f.second) -
+                                               text;
+                                    }),
+                      "ns/number");
+        }
+    }
+
+    // Evaluate a formula by walking its tree in the number type T.
+    template<class T>
+    void bench_numeric(Suite& suite, const std::string& name,
+                       const Statement& s, const int* slot, std::size_t size)
+    {
+        constexpr long evals{1 << 22};
+        std::vector<T> slots(size);
+        Evaluator<T> evaluator{*s.expr, s.temps};
+        std::string type{Number_traits<T>::name};
+        suite.add("eval/numeric/" + type + "/" + name,
+                  time_per_eval(evals,
+                                [&](long i) {
+                                    bind_inputs(slots.data(), slot, i);
+                                    sink = Number_traits<T>::to_double(
+                                        *evaluator.run(slots.data()));
+                                }),
+                  "ns/eval");
+    }
+
+    // Call a function of the mixed formula, inlined and not: its parameter
+    // d is unused, so calls of called are not inlined, and its body, once
+    // hot, runs as native code.
+    void bench_calls(Suite& suite, Symbol_table& names)
+    {
+        const int slot[]{names.slot("x"), names.slot("y"), names.slot("w")};
+        double* slots{names.bindings()};
+        constexpr long evals{1 << 22};
+
+        define(compile("fn inlined(a, b, c) = a * b + sqrt(c) - 3 / (a + 1)",
+                       names),
+               names);
+        define(compile("fn called(a, b, c, d) = a * b + sqrt(c) - 3 / (a + 1)",
+                       names),
+               names);
+        const std::pair<std::string, std::string> calls[]{
+            {"inline", "inlined(x, y, w);"},
+            {"vm", "called(x, y, w, 0);"},
+        };
+        for (const auto& c : calls) {
+            Statement s{compile(c.second, names)};
+            optimise(s, names);
+            Program p{emit(*s.expr)};
+            suite.add("eval/call/" + c.first, time_per_eval(evals, [&](long i) {
+                          bind_inputs(slots, slot, i);
+                          sink = run(p, slots);
+                      }),
+                      "ns/eval");
+        }
+    }
+
+    // Reduce over a long range, in double and in double-double; over a
+    // short one, which measures what starting a reduction costs; and, for
+    // comparison, sum the same terms as a generated script does, a
+    // statement per index.
+    void bench_reduce(Suite& suite, Symbol_table& names)
+    {
+        double* slots{names.bindings()};
+        constexpr long indices{10000000};
+        const std::pair<std::string, std::string> ranges[]{
+            {"sum", "sum(i, 1, 1e7, 1 / i^2);"},
+            {"prod", "prod(i, 1, 1e7, 1 + 1e-9 * i);"},
+            {"max", "max(i, 1, 1e7, sin(i) + x);"},
+        };
+        for (const auto& r : ranges) {
+            Statement s{compile(r.second, names)};
+            optimise(s, names);
+            Program p{emit(*s.expr)};
+            suite.add("reduce/" + r.first, time_per_eval(1, [&](long) {
+                          sink = run(p, slots);
+                      }) / indices,
+                      "ns/index");
+        }
+        if (suite.wants("reduce/sum/double-double")) {
+            constexpr long short_indices{1000000};
+            Statement s{compile("sum(i, 1, 1e6, 1 / i^2);", names)};
+            Evaluator<Double_double> e{*s.expr, s.temps};
+            std::vector<Double_double> typed(names.size());
+            suite.add("reduce/sum/double-double", time_per_eval(1, [&](long) {
+                          sink = Number_traits<Double_double>::to_double(
+                              *e.run(typed.data()));
+                      }) / short_indices,
+                      "ns/index");
+        }
+        Statement s{compile("sum(i, 1, 16, x * i);", names)};
+        optimise(s, names);
+        Program p{emit(*s.expr)};
+        suite.add("reduce/short", time_per_eval(1 << 16, [&](long) {
+                      sink = run(p, slots);
+                  }),
+                  "ns/reduction");
+
+        if (suite.wants("reduce/script")) {
+            constexpr int count{200000};
+            std::string script{"let s = 0;\n"};
+            for (int i = 1; i <= count; ++i) {
+                script += "set s = s + 1 / " + std::to_string(i) + "^2;\n";
+            }
+            Null_buffer null;
+            std::ostream out{&null};
+            suite.add("reduce/script", time_per_eval(1, [&](long) {
+                          Session session;
+                          session.execute(std::string_view{script}, out, out);
+                      }) / count,
+                      "ns/index");
+        }
+    }
+
+    // Powers the batch evaluator must compute exactly as the virtual machine
+    // does: repeated multiplication, even a single one for a square, rounds
+    // differently from std::pow.
+    const std::string powers[]{"x^2;", "x^3;", "x^100;", "x^-2;",
+                               "x^0.5;", "x^y;", "(x + w)^-7;"};
+
+    // Check that evaluate_batch gives the same results as execute, bit for
+    // bit, for each power over columns of inputs; report the first row that
+    // differs.
+    bool check_batch(Symbol_table& names)
+    {
+        const int slot[]{names.slot("x"), names.slot("y"), names.slot("w")};
+        double* slots{names.bindings()};
+        constexpr std::size_t rows{4096};
+        std::vector<std::vector<double>> data(3, std::vector<double>(rows));
+        for (std::size_t r = 0; r < rows; ++r) {
+            data[0][r] = 1 + 0.0001 * static_cast<double>(r);
+            data[1][r] = inputs[r % inputs.size()];
+            data[2][r] = 3.7 - 0.001 * static_cast<double>(r);
+        }
+        std::vector<const double*> columns(names.size());
+        for (int c = 0; c < 3; ++c) {
+            columns[slot[c]] = data[c].data();
+        }
+        std::vector<double> out(rows);
+
+        for (const std::string& power : powers) {
+            Program p{emit(*compile(power, names).expr)};
+            evaluate_batch(p, columns.data(), slots, out.data(), rows);
+            for (std::size_t r = 0; r < rows; ++r) {
+                for (int c = 0; c < 3; ++c) {
+                    slots[slot[c]] = data[c][r];
+                }
+                double expected{execute(p, names)};
+                if (std::memcmp(&out[r], &expected, sizeof expected) != 0) {
+                    std::cerr << std::setprecision(17) << "calc_bench: "
+                              << power << " row " << r << ": batch "
+                              << out[r] << ", vm " << expected << '\n';
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    // Evaluate each formula by re-parsing it, by walking its tree, by
+    // running its bytecode and by calling its native code; then over
+    // columns, row by row and in batches.
+    void bench_eval(Suite& suite, Symbol_table& names)
+    {
+        const int slot[]{names.slot("x"), names.slot("y"), names.slot("w")};
+        double* slots{names.bindings()};
+        constexpr long evals{1 << 22};
+        constexpr long parses{1 << 16};
+
+        for (const auto& f : formulas) {
+            const std::string& name{f.first};
+            suite.add("eval/parse/" + name, time_per_eval(parses, [&](long i) {
+                          bind_inputs(slots, slot, i);
+                          sink = evaluate(*compile(f.second, names).expr,
+                                          slots);
+                      }),
+                      "ns/eval");
+
+            Statement s{compile(f.second, names)};
+            suite.add("eval/tree/" + name, time_per_eval(evals, [&](long i) {
+                          bind_inputs(slots, slot, i);
+                          sink = evaluate(*s.expr, slots);
+                      }),
+                      "ns/eval");
+
+            if (suite.wants("eval/numeric")) {
+                bench_numeric<float>(suite, name, s, slot, names.size());
+                bench_numeric<double>(suite, name, s, slot, names.size());
+                bench_numeric<long double>(suite, name, s, slot,
+                                           names.size());
+                bench_numeric<Double_double>(suite, name, s, slot,
+                                             names.size());
+            }
+
+            Program p{emit(*s.expr)};
+            suite.add("eval/vm/" + name, time_per_eval(evals, [&](long i) {
+                          bind_inputs(slots, slot, i);
+                          sink = run(p, slots);
+                      }),
+                      "ns/eval");
+
+            Native_code native{compile_native(p)};
+            if (native) {
+                Native_function fn{native.function()};
+                suite.add("eval/native/" + name,
+                          time_per_eval(evals,
+                                        [&](long i) {
+                                            bind_inputs(slots, slot, i);
+                                            sink = fn(slots, nullptr);
+                                        }),
+                          "ns/eval");
+            }
+        }
+
+        constexpr std::size_t rows{1 << 16};
+        constexpr long passes{32};
+        std::vector<std::vector<double>> data(3, std::vector<double>(rows));
+        for (std::size_t r = 0; r < rows; ++r) {
+            for (int c = 0; c < 3; ++c) {
+                data[c][r] = inputs[(r + c) % inputs.size()];
+            }
+        }
+        std::vector<const double*> columns(names.size());
+        for (int c = 0; c < 3; ++c) {
+            columns[slot[c]] = data[c].data();
+        }
+        std::vector<double> out(rows);
+
+        for (const auto& f : formulas) {
+            const std::string& name{f.first};
+            Program p{emit(*compile(f.second, names).expr)};
+            suite.add("columns/vm/" + name, time_per_eval(passes, [&](long) {
+                          for (std::size_t r = 0; r < rows; ++r) {
+                              for (int c = 0; c < 3; ++c) {
+                                  slots[slot[c]] = data[c][r];
+                              }
+                              out[r] = run(p, slots);
+                          }
+                      }) / rows,
+                      "ns/row");
+            suite.add("columns/batch/" + name,
+                      time_per_eval(passes,
+                                    [&](long) {
+                                        evaluate_batch(p, columns.data(),
+                                                       slots, out.data(),
+                                                       rows);
+                                    }) /
+                          rows,
+                      "ns/row");
+        }
+    }
+
+    // Replay a generated script in a fresh session, evaluating in a number
+    // type, on a number of threads if jobs is nonzero.
+    void replay(Suite& suite, const std::string& name,
+                const std::string& prologue, const std::string& line,
+                int count, Numeric numeric = Numeric::binary64,
+                unsigned jobs = 0)
+    {
+        std::string script{prologue};
+        for (int i = 0; i < count; ++i) {
+            std::string text{line};
+            for (std::size_t at; (at = text.find('#')) != std::string::npos;) {
+                text.replace(at, 1, std::to_string(i));
+            }
+            script += text;
+        }
+        Null_buffer null;
+        std::ostream out{&null};
+        std::size_t statements{0};
+        double ns{time_per_eval(1, [&](long) {
+            Session session;
+            session.numeric(numeric);
+            statements =
+                jobs ? session.execute_parallel(script, out, out, jobs)
+                     : session.execute(std::string_view{script}, out, out);
+        })};
+        suite.add("script/" + name, ns / statements, "ns/statement");
+        suite.add("script/" + name + "/throughput",
+                  script.size() / ns * 1e3, "MB/s");
+    }
+
+    // Replay large generated scripts, save and load the session one leaves,
+    // and map a large CSV stream.
+    void bench_macro(Suite& suite)
+    {
+        const std::string vars{"let x = 1.5; let y = 2.25; let w = 3;\n"};
+        if (suite.wants("script/declarations")) {
+            replay(suite, "declarations", "", "let v# = # * 0.5 + PI;\n",
+                   200000);
+        }
+        if (suite.wants("script/expressions")) {
+            replay(suite, "expressions", vars,
+                   "x * y + sqrt(w) - # / (x + 1) * 2 * PI / 4;\n", 200000);
+        }
+        for (const char* type : {"float", "long-double", "double-double"}) {
+            std::string name{std::string{"expressions/"} + type};
+            if (suite.wants("script/" + name)) {
+                replay(suite, name, vars,
+                       "x * y + sqrt(w) - # / (x + 1) * 2 * PI / 4;\n",
+                       200000, numeric_type(type));
+            }
+        }
+        if (suite.wants("script/assignments")) {
+            replay(suite, "assignments", vars,
+                   "set x = x * 0.999 + #; set y = abs(y - x) ^ 2 % 1000;\n",
+                   100000);
+        }
+        if (suite.wants("script/integers")) {
+            replay(suite, "integers", "",
+                   "# * 987654321 % 1000003 + 3 ^ 39 - (# % 20)!;\n", 200000);
+        }
+        if (suite.wants("script/bindings")) { // each set dirties one binding
+            replay(suite, "bindings", vars,
+                   "let p# = #; bind t# = p# * x + y; set p# = # + w; t#;\n",
+                   50000);
+        }
+        if (suite.wants("snapshot")) { // script/declarations' table
+            constexpr int count{200000};
+            std::string script{vars};
+            for (int i = 0; i < count; ++i) {
+                std::string n{std::to_string(i)};
+                script += "let v" + n + " = " + n + " * 0.5 + PI;\n";
+            }
+            script += "fn f(a, b) = a * x + b / y; bind t = f(v0, w) + 1;\n";
+            Null_buffer null;
+            std::ostream out{&null};
+            Session session;
+            session.execute(std::string_view{script}, out, out);
+            const std::string path{"calc_bench.snap"};
+            double ns{time_per_eval(1, [&](long) { session.save(path); })};
+            suite.add("snapshot/save", ns / count, "ns/variable");
+            ns = time_per_eval(1, [&](long) {
+                Session loaded;
+                loaded.load(path);
+            });
+            suite.add("snapshot/load", ns / count, "ns/variable");
+            std::remove(path.c_str());
+        }
+        const unsigned jobs{std::max(std::thread::hardware_concurrency(), 1U)};
+        if (suite.wants("script/parallel/declarations")) {
+            replay(suite, "parallel/declarations", "",
+                   "let v# = # * 0.5 + PI;\n", 200000, Numeric::binary64, jobs);
+        }
+        if (suite.wants("script/parallel/expressions")) {
+            replay(suite, "parallel/expressions", vars,
+                   "x * y + sqrt(w) - # / (x + 1) * 2 * PI / 4;\n", 200000,
+                   Numeric::binary64, jobs);
+        }
+        if (suite.wants("script/errors")) { // one statement in five fails
+            replay(suite, "errors", vars,
+                   "x * y + #; sqrt(w) - #; x $ #; # % 7 + w; abs(x - #);\n"
+                   "# / (y - 2.25); x ^ 2; let v# = #; w * #; (x + y) / 2;\n",
+                   50000);
+        }
+
+        if (suite.wants("map/csv")) {
+            constexpr int rows{1 << 20};
+            std::string csv{"x,y,w\n"};
+            for (int r = 0; r < rows; ++r) {
+                csv += std::to_string(r) + ".5," + std::to_string(r % 97) +
+                       ",3.25\n";
+            }
+            Null_buffer null;
+            std::ostream out{&null};
+            double ns{time_per_eval(1, [&](long) {
+                Session session;
+                std::istringstream in{csv};
+                map_csv("x * y + sqrt(w) - 3 / (x + 1);", session.symbols(),
+                        in, out, out);
+            })};
+            suite.add("map/csv", ns / rows, "ns/row");
+            suite.add("map/csv/throughput", csv.size() / ns * 1e3, "MB/s");
+        }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    Suite suite;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg{argv[i]};
+        if (arg == "--json") {
+            suite.is_json = true;
+        }
+        else if (arg == "--filter" && i + 1 < argc) {
+            suite.filter = argv[++i];
+        }
+        else {
+            std::cerr << "usage: calc_bench [--json] [--filter name]\n";
+            return EXIT_FAILURE;
+        }
+    }
+
+    Symbol_table names;
+    names.declare("x", 0, false);
+    names.declare("y", 0, false);
+    names.declare("w", 0, false);
+
+    // Microbenchmarks.
+    if (suite.wants("lex")) {
+        bench_lexer(suite);
+    }
+    if (suite.wants("parse")) {
+        bench_parser(suite, names);
+    }
+    if (suite.wants("symbols")) {
+        bench_symbols(suite);
+    }
+    if (suite.wants("factorial")) {
+        bench_factorial(suite);
+    }
+    if (suite.wants("format")) {
+        bench_format(suite);
+    }
+    if (suite.wants("eval") || suite.wants("columns")) {
+        if (!check_batch(names)) {
+            return EXIT_FAILURE;
+        }
+        bench_eval(suite, names);
+    }
+    if (suite.wants("eval/call")) {
+        bench_calls(suite, names);
+    }
+    if (suite.wants("reduce")) {
+        bench_reduce(suite, names);
+    }
+
+    // Macrobenchmarks.
+    if (suite.wants("script") || suite.wants("snapshot") ||
+        suite.wants("map")) {
+        bench_macro(suite);
+    }
+
+    if (suite.is_json) {
+        suite.print_json();
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,196 @@
+// load.cc: A load generator for calc --serve.
+// SPDX-FileCopyrightText: © 2021-2022 Bradley M. Jones <brdjns@gmx.us>
+// SPDX-License-Identifier: MIT
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    // @class Options
+    // @brief How much load to put on a server, and where.
+    class Options {
+    public:
+        std::string socket;  // the server's socket
+        int clients{8};      // connections, each on its own thread
+        int sessions{16};    // sessions per client
+        long requests{100000}; // requests per client
+        long window{64};     // requests a client has unanswered at most
+    };
+
+    // @class Tally
+    // @brief What one client saw.
+    class Tally {
+    public:
+        std::vector<double> latency; // microseconds, per request
+        long errors{};               // replies other than ok
+        std::string failure;         // why the client stopped, if it did
+    };
+
+    // Connect to a Unix socket.
+    int connect_to(const std::string& path)
+    {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof addr.sun_path) {
+            return -1;
+        }
+        std::memcpy(addr.sun_path, path.data(), path.size());
+        int fd{socket(AF_UNIX, SOCK_STREAM, 0)};
+        if (fd >= 0 &&
+            connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) < 0) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    // The nth request of client c: each session, named for this process so
+    // that runs do not share sessions, declares its variables first, then
+    // sets and reads them.
+    std::string request(const Options& o, int c, long n)
+    {
+        std::string session{std::to_string(getpid()) + "c" +
+                            std::to_string(c) + "s" +
+                            std::to_string(n % o.sessions)};
+        if (n < o.sessions) {
+            return session + " let x = " + std::to_string(n) +
+                   "; let y = 0.5;\n";
+        }
+        return session + " set x = x + 1; x * y + sqrt(x) / (y + 1);\n";
+    }
+
+    // Send a client's requests, keeping up to a window unanswered, and time
+    // each reply.
+    void client(const Options& o, int c, Tally& t)
+    {
+        int fd{connect_to(o.socket)};
+        if (fd < 0) {
+            t.failure = "cannot connect to " + o.socket + ": " +
+                        std::strerror(errno);
+            return;
+        }
+        std::vector<Clock::time_point> sent_at(o.requests);
+        t.latency.reserve(o.requests);
+        std::string out;
+        std::string in;
+        char buf[1 << 16];
+        long sent{0};
+        while (static_cast<long>(t.latency.size()) < o.requests) {
+            out.clear();
+            Clock::time_point now{Clock::now()};
+            long answered{static_cast<long>(t.latency.size())};
+            for (; sent < o.requests && sent - answered < o.window; ++sent) {
+                out += request(o, c, sent);
+                sent_at[sent] = now;
+            }
+            for (std::size_t done = 0; done < out.size();) {
+                ssize_t n{write(fd, out.data() + done, out.size() - done)};
+                if (n < 0) {
+                    t.failure = std::string{"write: "} + std::strerror(errno);
+                    close(fd);
+                    return;
+                }
+                done += static_cast<std::size_t>(n);
+            }
+            ssize_t n{read(fd, buf, sizeof buf)};
+            if (n <= 0) {
+                t.failure = "the server hung up";
+                close(fd);
+                return;
+            }
+            in.append(buf, static_cast<std::size_t>(n));
+            now = Clock::now();
+            std::size_t begin{0};
+            for (std::size_t end;
+                 (end = in.find('\n', begin)) != std::string::npos;
+                 begin = end + 1) {
+                if (in.compare(begin, 2, "ok") != 0) {
+                    ++t.errors;
+                }
+                std::chrono::duration<double, std::micro> waited{
+                    now - sent_at[t.latency.size()]};
+                t.latency.push_back(waited.count());
+            }
+            in.erase(0, begin);
+        }
+        close(fd);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    Options o;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg{argv[i]};
+        if (arg == "--socket" && i + 1 < argc) {
+            o.socket = argv[++i];
+        }
+        else if (arg == "--clients" && i + 1 < argc) {
+            o.clients = std::atoi(argv[++i]);
+        }
+        else if (arg == "--sessions" && i + 1 < argc) {
+            o.sessions = std::atoi(argv[++i]);
+        }
+        else if (arg == "--requests" && i + 1 < argc) {
+            o.requests = std::atol(argv[++i]);
+        }
+        else if (arg == "--window" && i + 1 < argc) {
+            o.window = std::atol(argv[++i]);
+        }
+        else {
+            o.socket.clear();
+            break;
+        }
+    }
+    if (o.socket.empty() || o.clients < 1 || o.sessions < 1 ||
+        o.requests < o.sessions || o.window < 1) {
+        std::cerr << "usage: calc_load --socket path [--clients N] "
+                     "[--sessions N] [--requests N] [--window N]\n";
+        return EXIT_FAILURE;
+    }
+
+    std::vector<Tally> tallies(o.clients);
+    std::vector<std::thread> threads;
+    Clock::time_point start{Clock::now()};
+    for (int c = 0; c < o.clients; ++c) {
+        threads.emplace_back(client, std::cref(o), c, std::ref(tallies[c]));
+    }
+    for (std::thread& t : threads) {
+        t.join();
+    }
+    std::chrono::duration<double> elapsed{Clock::now() - start};
+
+    std::vector<double> latency;
+    long errors{0};
+    for (const Tally& t : tallies) {
+        if (!t.failure.empty()) {
+            std::cerr << "calc_load: " << t.failure << '\n';
+            return EXIT_FAILURE;
+        }
+        latency.insert(latency.end(), t.latency.begin(), t.latency.end());
+        errors += t.errors;
+    }
+    std::sort(latency.begin(), latency.end());
+    auto percentile = [&](double p) {
+        return latency[static_cast<std::size_t>(p * (latency.size() - 1))];
+    };
+    std::printf("%zu requests in %g s: %.0f requests/s, latency p50 %.1f us, "
+                "p99 %.1f us, max %.1f us, %ld errors\n",
+                latency.size(), elapsed.count(),
+                latency.size() / elapsed.count(), percentile(0.5),
+                percentile(0.99), latency.back(), errors);
+    return errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,230 @@
+// ast.cc: Expression tree evaluation.
+// SPDX-FileCopyrightText: © 2021-2022 Bradley M. Jones <brdjns@gmx.us>
+// SPDX-License-Identifier: MIT
+
+#include "ast.h"
+#include "error.h"
+#include "function.h"
+#include "optimise.h"
+#include "reduce.h"
+#include "snapshot.h"
+#include "symbol_table.h"
+#include <cmath>
+
+namespace {
+    // Evaluate an expression tree, in the body of calls nested depth deep.
+    double evaluate(const Node& n, const double* slots, double* temps,
+                    const double* args, int depth);
+
+    // Call a function.
+    double call(const Node& n, const double* slots, double* temps,
+                const double* args, int depth)
+    {
+        if (depth >= max_call_depth) {
+            error("calls nested too deeply");
+        }
+        std::vector<double> frame;
+        frame.reserve(n.args.size());
+        for (const Node_ptr& arg : n.args) {
+            frame.push_back(evaluate(*arg, slots, temps, args, depth));
+        }
+        return evaluate(*n.callee->body, slots, nullptr, frame.data(),
+                        depth + 1);
+    }
+
+    // Reduce a function over a range, with the compiled kernel.
+    double reduce(const Node& n, const double* slots, double* temps,
+                  const double* args, int depth)
+    {
+        std::vector<double> frame;
+        frame.reserve(n.args.size());
+        for (const Node_ptr& arg : n.args) {
+            frame.push_back(evaluate(*arg, slots, temps, args, depth));
+        }
+        // The body only reads the variables.
+        Result<double> value{try_reduce(static_cast<Reduction>(n.slot),
+                                        *n.callee, const_cast<double*>(slots),
+                                        frame.data())};
+        if (!value) {
+            error(value.error());
+        }
+        return *value;
+    }
+
+    double evaluate(const Node& n, const double* slots, double* temps,
+                    const double* args, int depth)
+    {
+        auto eval = [&](const Node& a) {
+            return evaluate(a, slots, temps, args, depth);
+        };
+
+        switch (n.op) {
+        case Op::number:
+            return n.value;
+        case Op::load:
+            return slots[n.slot];
+        case Op::neg:
+            return -eval(*n.args[0]);
+        case Op::add:
+        {
+            double left{eval(*n.args[0])};
+            return left + eval(*n.args[1]);
+        }
+        case Op::sub:
+        {
+            double left{eval(*n.args[0])};
+            return left - eval(*n.args[1]);
+        }
+        case Op::mul:
+        {
+            double left{eval(*n.args[0])};
+            return left * eval(*n.args[1]);
+        }
+        case Op::div:
+        {
+            double left{eval(*n.args[0])};
+            double right{eval(*n.args[1])};
+            if (right == 0) {
+                error("division by zero");
+            }
+            return left / right;
+        }
+        case Op::mod: // a%b is defined for floats
+        {
+            double left{eval(*n.args[0])};
+            double right{eval(*n.args[1])};
+            if (right == 0) {
+                error("modulo division by zero");
+            }
+            return std::fmod(left, right);
+        }
+        case Op::pow:
+        {
+            double left{eval(*n.args[0])};
+            return std::pow(left, eval(*n.args[1]));
+        }
+        case Op::fact:
+        {
+            double temp{eval(*n.args[0])};
+            if (factorial_domain(temp) != Errc::none) {
+                error("domain error");
+            }
+            return fn_factorial(temp);
+        }
+        case Op::sqrt:
+        {
+            double temp{eval(*n.args[0])};
+            if (temp < 0) {
+                error("domain error");
+            }
+            return std::sqrt(temp);
+        }
+        case Op::abs:
+            return std::abs(eval(*n.args[0]));
+        case Op::builtin:
+        {
+            const Builtin& f{builtins[n.slot]};
+            double a{eval(*n.args[0])};
+            double b{f.arity == 2 ? eval(*n.args[1]) : 0};
+            Errc err{Errc::none};
+            double value{call_builtin(f, a, b, err)};
+            if (err != Errc::none) {
+                error("domain error");
+            }
+            return value;
+        }
+        case Op::bind:
+            return temps[n.slot] = eval(*n.args[0]);
+        case Op::temp:
+            return temps[n.slot];
+        case Op::call:
+            return call(n, slots, temps, args, depth);
+        case Op::arg:
+            return args[n.slot];
+        case Op::reduce:
+            return reduce(n, slots, temps, args, depth);
+        }
+
+        return 0; // never reached
+    }
+}
+
+// Copy an expression tree.
+Node_ptr clone(const Node& n)
+{
+    auto copy = std::make_unique<Node>(n.value);
+    copy->op = n.op;
+    copy->text = n.text;
+    copy->type = n.type;
+    copy->integer = n.integer;
+    copy->slot = n.slot;
+    copy->callee = n.callee;
+    for (const Node_ptr& arg : n.args) {
+        copy->args.push_back(clone(*arg));
+    }
+    return copy;
+}
+
+// Count the nodes in an expression tree.
+int size(const Node& n)
+{
+    int count{1};
+    for (const Node_ptr& arg : n.args) {
+        count += size(*arg);
+    }
+    return count;
+}
+
+// Evaluate an expression tree.
+double evaluate(const Node& n, const double* slots, double* temps,
+                const double* args)
+{
+    return evaluate(n, slots, temps, args, 0);
+}
+
+// Execute a statement against a symbol table.
+double execute(const Statement& s, Symbol_table& table)
+{
+    if (s.kind == Stmt::function) {
+        if (Error e{define(s, table)}) {
+            error(e);
+        }
+        return 0;
+    }
+    if (s.kind == Stmt::save || s.kind == Stmt::load) {
+        if (Error e{s.kind == Stmt::save ? save_snapshot(table, s.name)
+                                         : load_snapshot(table, s.name)}) {
+            error(e);
+        }
+        return 0;
+    }
+    if (table.has_stale()) {
+        std::vector<int> reads;
+        collect_reads(*s.expr, reads);
+        if (Error e{table.refresh(reads)}) {
+            error(e);
+        }
+    }
+    std::vector<double> temps(s.temps);
+    double value{evaluate(*s.expr, table.bindings(), temps.data())};
+
+    switch (s.kind) {
+    case Stmt::let:
+        return table.declare(s.name, value, false);
+    case Stmt::constant:
+        return table.declare(s.name, value, true);
+    case Stmt::bind:
+        table.declare(s.name, value, false);
+        table.bind(table.find(s.name), binding(s, table));
+        return value;
+    case Stmt::set:
+        table.set(s.name, value);
+        return value;
+    case Stmt::expression:
+    case Stmt::function:
+    case Stmt::save:
+    case Stmt::load:
+        break;
+    }
+    return value;
+}
@@ -0,0 +1,159 @@
+// ast.h: Expression tree interface.
+// SPDX-FileCopyrightText: © 2021-2022 Bradley M. Jones <brdjns@gmx.us>
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class Function;
+class Symbol_table;
+
+// The types of literal values.
+enum class Type : char {
+    real,    // a double
+    integer, // a 64-bit integer, proven to be one when the tree was optimised
+};
+
+// Expression tree operations.
+enum class Op : char {
+    number,  // a literal
+    load,    // a variable, read through its slot
+    neg,     // -a
+    add,     // a+b
+    sub,     // a-b
+    mul,     // a*b
+    div,     // a/b
+    mod,     // a%b
+    pow,     // a^b
+    fact,    // a!
+    sqrt,    // sqrt(a)
+    abs,     // abs(a)
+    bind,    // a, saved in a temporary
+    temp,    // a value saved by Op::bind
+    builtin, // f(a) or f(a, b), of the built-in function numbered slot
+    call,    // f(a, b, ...), of a user-defined function
+    arg,     // a function's parameter, read by position
+    reduce,  // sum(i, a, b, f), or another Reduction, numbered slot
+};
+
+class Node;
+using Node_ptr = std::unique_ptr<Node>;
+
+// @class Node
+// @brief An expression tree node.
+// @details Variables are resolved to symbol table slots when the tree is
+// built, so evaluating a tree never looks a name up.  An integer literal
+// holds its exact value as well as the nearest double, which is the value
+// every evaluator computes with.  A literal that is not an integer keeps its
+// spelling, so that evaluators in other number types can read it exactly.
+// In a function's body, parameters are numbered by position.  A reduction's
+// body is compiled, as a function whose first parameter is the index, when
+// it is parsed; its arguments are the range's bounds, then the parameters
+// and indices of enclosing bodies that it reads.
+class Node {
+public:
+    Op op;                      // an operation
+    double value{};             // a literal value, for Op::number
+    std::string text;           // a literal's spelling, if it was read
+    Type type{Type::real};      // the type of a literal's value
+    std::int64_t integer{};     // a literal's exact value, for Type::integer
+    int slot{-1};               // a slot; a temporary for bind and temp; a
+                                // function for builtin; a parameter for arg;
+                                // a Reduction for reduce
+    std::vector<Node_ptr> args; // operands, or arguments, left to right
+    std::shared_ptr<const Function> callee; // the function, for Op::call,
+                                            // or the body, for Op::reduce
+
+    // @brief Construct a literal.
+    // @param[in] v a value.
+    explicit Node(double v) : op{Op::number}, value{v} {}
+
+    // @brief Construct a variable, temporary or parameter reference.
+    // @param[in] o Op::load, Op::temp or Op::arg.
+    // @param[in] s a symbol table slot, temporary or parameter.
+    Node(Op o, int s) : op{o}, slot{s} {}
+
+    // @brief Construct a call of a user-defined function, without arguments.
+    // @param[in] f a function.
+    explicit Node(std::shared_ptr<const Function> f)
+        : op{Op::call}, callee{std::move(f)}
+    {}
+
+    // @brief Construct a unary operation.
+    // @param[in] o an operation.
+    // @param[in] a an operand.
+    Node(Op o, Node_ptr a) : op{o} { args.push_back(std::move(a)); }
+
+    // @brief Construct a binary operation.
+    // @param[in] o an operation.
+    // @param[in] a the left operand.
+    // @param[in] b the right operand.
+    Node(Op o, Node_ptr a, Node_ptr b) : op{o}
+    {
+        args.push_back(std::move(a));
+        args.push_back(std::move(b));
+    }
+};
+
+// Statement kinds.
+enum class Stmt : char {
+    expression, // expression
+    let,        // let identifier = expression
+    constant,   // const identifier = expression
+    set,        // set identifier = expression
+    bind,       // bind identifier = expression
+    function,   // fn identifier(identifier, ...) = expression
+    save,       // save "file"
+    load,       // load "file"
+};
+
+// @class Statement
+// @brief A compiled statement.
+class Statement {
+public:
+    Stmt kind{Stmt::expression};         // a statement kind
+    std::string name;                    // the identifier declared or
+                                         // assigned, or a snapshot's file
+    std::vector<std::string> parameters; // a function's parameters
+    Node_ptr expr;                       // the expression, or function
+                                         // body; null for save and load
+    int temps{};                         // temporaries the expression uses
+};
+
+// The deepest that calls of functions that are not inlined may nest.
+constexpr int max_call_depth{256};
+
+// @brief Copy an expression tree.
+// @param n an expression tree.
+// @return A copy of n.
+Node_ptr clone(const Node& n);
+
+// @brief Count the nodes in an expression tree.
+// @param n an expression tree.
+// @return The number of nodes in n.
+int size(const Node& n);
+
+// @brief Evaluate an expression tree.
+// @param n an expression tree.
+// @param slots variable values, indexed by slot.
+// @param temps space for the temporaries n uses, if any.
+// @param args the arguments of the call n is the body of, if any.
+// @throws std::runtime_error for division by zero, domain errors and calls
+// nested too deeply.
+// @return The value of the expression.
+double evaluate(const Node& n, const double* slots, double* temps = nullptr,
+                const double* args = nullptr);
+
+// @brief Execute a statement against a symbol table.
+// @details A function definition is defined, and a snapshot saved or
+// loaded, with the value 0.  The bound variables the statement reads are
+// brought up to date first.
+// @param s a compiled statement.
+// @param table the symbol table the statement was compiled against.
+// @throws std::runtime_error if the statement cannot be executed.
+// @return The value of the statement's expression.
+double execute(const Statement& s, Symbol_table& table);
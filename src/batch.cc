@@ -0,0 +1,446 @@
+// batch.cc: Columnar batch evaluation.
+// SPDX-FileCopyrightText: © 2021-2022 Bradley M. Jones <brdjns@gmx.us>
+// SPDX-License-Identifier: MIT
+
+#include "batch.h"
+#include "error.h"
+#include "function.h"
+#include "symbol_table.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Kernels are cloned for each instruction set listed, and the clone to use
+// is chosen when the program is loaded.
+#if defined(__x86_64__) && defined(__ELF__) && defined(__has_attribute)
+#if __has_attribute(target_clones)
+#define CALC_KERNEL __attribute__((target_clones("avx512f", "avx2", "default")))
+#endif
+#endif
+#ifndef CALC_KERNEL
+#define CALC_KERNEL
+#endif
+
+// Name the instruction set that batch kernels run on.
+const char* batch_isa()
+{
+#if defined(__x86_64__) && defined(__GNUC__)
+    if (__builtin_cpu_supports("avx512f")) {
+        return "avx512f";
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return "avx2";
+    }
+#endif
+    return "scalar";
+}
+
+namespace {
+    // A column of a chunk on the evaluation stack.
+    class Operand {
+    public:
+        const double* data; // the column
+    };
+
+    CALC_KERNEL void fill(double* out, double a, std::size_t n)
+    {
+        for (std::size_t i = 0; i < n; ++i) {
+            out[i] = a;
+        }
+    }
+
+    CALC_KERNEL void negate(double* out, const double* a, std::size_t n)
+    {
+        for (std::size_t i = 0; i < n; ++i) {
+            out[i] = -a[i];
+        }
+    }
+
+    CALC_KERNEL void absolute(double* out, const double* a, std::size_t n)
+    {
+        for (std::size_t i = 0; i < n; ++i) {
+            out[i] = std::fabs(a[i]);
+        }
+    }
+
+    CALC_KERNEL void add(double* out, const double* a, const double* b,
+                         std::size_t n)
+    {
+        for (std::size_t i = 0; i < n; ++i) {
+            out[i] = a[i] + b[i];
+        }
+    }
+
+    CALC_KERNEL void subtract(double* out, const double* a, const double* b,
+                              std::size_t n)
+    {
+        for (std::size_t i = 0; i < n; ++i) {
+            out[i] = a[i] - b[i];
+        }
+    }
+
+    CALC_KERNEL void multiply(double* out, const double* a, const double* b,
+                              std::size_t n)
+    {
+        for (std::size_t i = 0; i < n; ++i) {
+            out[i] = a[i] * b[i];
+        }
+    }
+
+    CALC_KERNEL void divide(double* out, const double* a, const double* b,
+                            std::size_t n)
+    {
+        for (std::size_t i = 0; i < n; ++i) {
+            out[i] = a[i] / b[i];
+        }
+    }
+
+    CALC_KERNEL void square_root(double* out, const double* a, std::size_t n)
+    {
+        for (std::size_t i = 0; i < n; ++i) {
+            out[i] = std::sqrt(a[i]);
+        }
+    }
+
+    CALC_KERNEL bool any_zero(const double* a, std::size_t n)
+    {
+        bool found{false};
+        for (std::size_t i = 0; i < n; ++i) {
+            found |= a[i] == 0;
+        }
+        return found;
+    }
+
+    CALC_KERNEL bool any_negative(const double* a, std::size_t n)
+    {
+        bool found{false};
+        for (std::size_t i = 0; i < n; ++i) {
+            found |= a[i] < 0;
+        }
+        return found;
+    }
+
+    void call_chunk(const Function& f, const double* const* columns,
+                    const double* slots, double* out, std::size_t row,
+                    std::size_t n, const Operand* args, int depth);
+
+    // Reduce a body over each row's range in turn, with the row's values of
+    // the variables it reads.
+    void reduce_chunk(Reduction kind, const Function& f,
+                      const double* const* columns, const double* slots,
+                      double* out, std::size_t row, std::size_t n,
+                      const Operand* args)
+    {
+        int top{-1};
+        for (int slot : f.reads) {
+            top = std::max(top, slot);
+        }
+        std::vector<double> vars(static_cast<std::size_t>(top + 1));
+        for (int slot : f.reads) {
+            vars[slot] = slots[slot];
+        }
+        std::vector<double> frame(f.arity() + 1);
+        for (std::size_t j = 0; j < n; ++j) {
+            for (int slot : f.reads) {
+                if (columns && columns[slot]) {
+                    vars[slot] = columns[slot][row + j];
+                }
+            }
+            for (std::size_t a = 0; a < frame.size(); ++a) {
+                frame[a] = args[a].data[j];
+            }
+            Result<double> value{
+                try_reduce(kind, f, vars.data(), frame.data())};
+            if (!value) {
+                error(value.error());
+            }
+            out[j] = *value;
+        }
+    }
+
+    // Evaluate a chunk of n rows starting at row into out, in the body of
+    // calls nested depth deep with arguments args.
+    void evaluate_chunk(const Program& p, const double* const* columns,
+                        const double* slots, double* out, std::size_t row,
+                        std::size_t n, double* buffers, Operand* stack,
+                        Operand* temps, const Operand* args, int depth)
+    {
+        const double* constants{p.constants.data()};
+        int sp{-1};
+
+        for (const Instruction& i : p.code) {
+            double* result{buffers + (sp < 0 ? 0 : sp) * batch_chunk};
+            switch (i.op) {
+            case Opcode::push:
+                ++sp;
+                result = buffers + sp * batch_chunk;
+                fill(result, constants[i.arg], n);
+                stack[sp] = Operand{result};
+                continue;
+            case Opcode::load:
+                ++sp;
+                if (columns && columns[i.arg]) {
+                    stack[sp] = Operand{columns[i.arg] + row};
+                }
+                else {
+                    result = buffers + sp * batch_chunk;
+                    fill(result, slots[i.arg], n);
+                    stack[sp] = Operand{result};
+                }
+                continue;
+            case Opcode::store:
+                continue;
+            case Opcode::tee:
+            {
+                // Temporaries are kept after the stack's buffers.
+                double* saved{buffers + (p.depth + i.arg) * batch_chunk};
+                std::copy(stack[sp].data, stack[sp].data + n, saved);
+                temps[i.arg] = Operand{saved};
+                continue;
+            }
+            case Opcode::temp:
+                stack[++sp] = temps[i.arg];
+                continue;
+            case Opcode::neg:
+                negate(result, stack[sp].data, n);
+                break;
+            case Opcode::abs:
+                absolute(result, stack[sp].data, n);
+                break;
+            case Opcode::add:
+                --sp;
+                result = buffers + sp * batch_chunk;
+                add(result, stack[sp].data, stack[sp + 1].data, n);
+                break;
+            case Opcode::sub:
+                --sp;
+                result = buffers + sp * batch_chunk;
+                subtract(result, stack[sp].data, stack[sp + 1].data, n);
+                break;
+            case Opcode::mul:
+                --sp;
+                result = buffers + sp * batch_chunk;
+                multiply(result, stack[sp].data, stack[sp + 1].data, n);
+                break;
+            case Opcode::div:
+                --sp;
+                result = buffers + sp * batch_chunk;
+                if (any_zero(stack[sp + 1].data, n)) {
+                    error("division by zero");
+                }
+                divide(result, stack[sp].data, stack[sp + 1].data, n);
+                break;
+            case Opcode::mod: // a%b is defined for floats
+            {
+                --sp;
+                result = buffers + sp * batch_chunk;
+                const double* a{stack[sp].data};
+                const double* b{stack[sp + 1].data};
+                if (any_zero(b, n)) {
+                    error("modulo division by zero");
+                }
+                for (std::size_t j = 0; j < n; ++j) {
+                    result[j] = std::fmod(a[j], b[j]);
+                }
+                break;
+            }
+            case Opcode::pow:
+            {
+                // Always std::pow, as the virtual machine uses: repeated
+                // multiplication rounds differently, even for a square.
+                --sp;
+                result = buffers + sp * batch_chunk;
+                const double* a{stack[sp].data};
+                const double* b{stack[sp + 1].data};
+                for (std::size_t j = 0; j < n; ++j) {
+                    result[j] = std::pow(a[j], b[j]);
+                }
+                break;
+            }
+            case Opcode::fact:
+            {
+                const double* a{stack[sp].data};
+                for (std::size_t j = 0; j < n; ++j) {
+                    if (factorial_domain(a[j]) != Errc::none) {
+                        error("domain error");
+                    }
+                    result[j] = fn_factorial(a[j]);
+                }
+                break;
+            }
+            case Opcode::sqrt:
+                if (any_negative(stack[sp].data, n)) {
+                    error("domain error");
+                }
+                square_root(result, stack[sp].data, n);
+                break;
+            case Opcode::builtin:
+            {
+                const Builtin& f{builtins[i.arg]};
+                sp -= f.arity - 1;
+                result = buffers + sp * batch_chunk;
+                const double* a{stack[sp].data};
+                const double* b{f.arity == 2 ? stack[sp + 1].data : a};
+                if (f.vector) {
+                    f.vector(result, a, b, n);
+                    break;
+                }
+                for (std::size_t j = 0; j < n; ++j) {
+                    Errc err{Errc::none};
+                    result[j] = call_builtin(f, a[j], b[j], err);
+                    if (err != Errc::none) {
+                        error("domain error");
+                    }
+                }
+                break;
+            }
+            case Opcode::call:
+            {
+                const Function& f{*p.callees[i.arg]};
+                sp -= static_cast<int>(f.arity()) - 1;
+                result = buffers + sp * batch_chunk;
+                call_chunk(f, columns, slots, result, row, n, stack + sp,
+                           depth + 1);
+                break;
+            }
+            case Opcode::arg:
+                stack[++sp] = args[i.arg];
+                continue;
+            case Opcode::sum:
+            case Opcode::prod:
+            case Opcode::min:
+            case Opcode::max:
+            case Opcode::mean:
+            {
+                const Function& f{*p.callees[i.arg]};
+                sp -= static_cast<int>(f.arity());
+                result = buffers + sp * batch_chunk;
+                reduce_chunk(reduction(i.op), f, columns, slots, result, row,
+                             n, stack + sp);
+                break;
+            }
+            case Opcode::ret:
+                if (stack[sp].data != out) { // a body may return an argument
+                    std::copy(stack[sp].data, stack[sp].data + n, out);
+                }
+                return;
+            }
+            stack[sp] = Operand{result};
+        }
+    }
+
+    // Call a function on a chunk, from calls nested depth - 1 deep.
+    void call_chunk(const Function& f, const double* const* columns,
+                    const double* slots, double* out, std::size_t row,
+                    std::size_t n, const Operand* args, int depth)
+    {
+        if (depth > max_call_depth) {
+            error("calls nested too deeply");
+        }
+        const Program& p{f.code.code()};
+        std::vector<double> buffers((std::max(p.depth, 1) + p.temps) *
+                                    batch_chunk);
+        std::vector<Operand> stack(std::max(p.depth, 1));
+        std::vector<Operand> temps(p.temps);
+        evaluate_chunk(p, columns, slots, out, row, n, buffers.data(),
+                       stack.data(), temps.data(), args, depth);
+    }
+}
+
+// Vector kernels of built-in functions.
+CALC_KERNEL void batch_floor(double* out, const double* a, const double*,
+                             std::size_t n)
+{
+    for (std::size_t i = 0; i < n; ++i) {
+        out[i] = std::floor(a[i]);
+    }
+}
+
+CALC_KERNEL void batch_ceil(double* out, const double* a, const double*,
+                            std::size_t n)
+{
+    for (std::size_t i = 0; i < n; ++i) {
+        out[i] = std::ceil(a[i]);
+    }
+}
+
+CALC_KERNEL void batch_trunc(double* out, const double* a, const double*,
+                             std::size_t n)
+{
+    for (std::size_t i = 0; i < n; ++i) {
+        out[i] = std::trunc(a[i]);
+    }
+}
+
+CALC_KERNEL void batch_min(double* out, const double* a, const double* b,
+                           std::size_t n)
+{
+    for (std::size_t i = 0; i < n; ++i) {
+        out[i] = fn_min(a[i], b[i]);
+    }
+}
+
+CALC_KERNEL void batch_max(double* out, const double* a, const double* b,
+                           std::size_t n)
+{
+    for (std::size_t i = 0; i < n; ++i) {
+        out[i] = fn_max(a[i], b[i]);
+    }
+}
+
+CALC_KERNEL void batch_copysign(double* out, const double* a, const double* b,
+                                std::size_t n)
+{
+    for (std::size_t i = 0; i < n; ++i) {
+        out[i] = std::copysign(a[i], b[i]);
+    }
+}
+
+// Evaluate a program over columns of inputs.
+void evaluate_batch(const Program& p, const double* const* columns,
+                    const double* slots, double* out, std::size_t n)
+{
+    std::vector<double> buffers((std::max(p.depth, 1) + p.temps) *
+                                batch_chunk);
+    std::vector<Operand> stack(std::max(p.depth, 1));
+    std::vector<Operand> temps(p.temps);
+
+    for (std::size_t row = 0; row < n; row += batch_chunk) {
+        evaluate_chunk(p, columns, slots, out + row, row,
+                       std::min(batch_chunk, n - row), buffers.data(),
+                       stack.data(), temps.data(), nullptr, 0);
+    }
+}
+
+// Call a function over columns of arguments.
+void call_batch(const Function& f, const double* const* args,
+                const double* values, const double* slots, double* out,
+                std::size_t n)
+{
+    const Program& p{f.code.code()};
+    std::size_t arity{f.arity()};
+    std::size_t frame{static_cast<std::size_t>(std::max(p.depth, 1) + p.temps)};
+    std::vector<double> buffers((frame + arity) * batch_chunk);
+    std::vector<Operand> stack(std::max(p.depth, 1));
+    std::vector<Operand> temps(p.temps);
+    std::vector<Operand> operands(arity);
+
+    // Arguments without a column are filled in once, after the frame.
+    double* uniform{buffers.data() + frame * batch_chunk};
+    for (std::size_t a = 0; a < arity; ++a) {
+        if (!args[a]) {
+            fill(uniform + a * batch_chunk, values[a], batch_chunk);
+            operands[a] = Operand{uniform + a * batch_chunk};
+        }
+    }
+    for (std::size_t row = 0; row < n; row += batch_chunk) {
+        for (std::size_t a = 0; a < arity; ++a) {
+            if (args[a]) {
+                operands[a] = Operand{args[a] + row};
+            }
+        }
+        evaluate_chunk(p, nullptr, slots, out + row, row,
+                       std::min(batch_chunk, n - row), buffers.data(),
+                       stack.data(), temps.data(), operands.data(), 1);
+    }
+}
@@ -0,0 +1,63 @@
+// batch.h: Columnar batch evaluation interface.
+// SPDX-FileCopyrightText: © 2021-2022 Bradley M. Jones <brdjns@gmx.us>
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "bytecode.h"
+#include <cstddef>
+
+// The number of rows evaluated together, an instruction at a time.
+constexpr std::size_t batch_chunk{256};
+
+// A vector kernel: out[i] = f(a[i], b[i]) for i < n, where b is ignored by a
+// function of one argument.
+using Vector_kernel = void (*)(double* out, const double* a, const double* b,
+                               std::size_t n);
+
+// @brief Vector kernels of built-in functions.
+void batch_floor(double* out, const double* a, const double*, std::size_t n);
+void batch_ceil(double* out, const double* a, const double*, std::size_t n);
+void batch_trunc(double* out, const double* a, const double*, std::size_t n);
+void batch_min(double* out, const double* a, const double* b, std::size_t n);
+void batch_max(double* out, const double* a, const double* b, std::size_t n);
+void batch_copysign(double* out, const double* a, const double* b,
+                    std::size_t n);
+
+// @brief Name the instruction set that batch kernels run on.
+// @return "avx512f", "avx2" or "scalar".
+const char* batch_isa();
+
+// @brief Evaluate a program over columns of inputs.
+// @details Rows are evaluated in chunks of batch_chunk, one instruction at a
+// time over the whole chunk.  Arithmetic but %, ^ and !, and built-in
+// functions that have vector kernels, use vector kernels chosen for the CPU
+// at run time; the rest call their scalar functions a row at a time, so
+// that every row is computed exactly as the virtual machine computes it.
+// Stores are ignored: the value of every row goes to out.
+// @param p a program.
+// @param columns input columns, indexed by slot; a slot without a column
+// takes the same value, from slots, in every row.
+// @param slots variable values, indexed by slot.
+// @param out output column.
+// @param n the number of rows.
+// @throws std::runtime_error if any row divides by zero or has a domain
+// error, or if calls nest too deeply.
+void evaluate_batch(const Program& p, const double* const* columns,
+                    const double* slots, double* out, std::size_t n);
+
+// @brief Call a function over columns of arguments.
+// @details Rows are evaluated in chunks of batch_chunk, as by
+// evaluate_batch; the function's body reads variables from slots.
+// @param f a function.
+// @param args f.arity() argument columns; an argument without a column
+// takes the same value, from values, in every row.
+// @param values argument values, indexed by position.
+// @param slots variable values, indexed by slot.
+// @param out output column.
+// @param n the number of rows.
+// @throws std::runtime_error if any row divides by zero or has a domain
+// error, or if calls nest too deeply.
+void call_batch(const Function& f, const double* const* args,
+                const double* values, const double* slots, double* out,
+                std::size_t n);
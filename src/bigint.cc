@@ -0,0 +1,226 @@
+// bigint.cc: Arbitrary-precision integers.
+// SPDX-FileCopyrightText: © 2021-2022 Bradley M. Jones <brdjns@gmx.us>
+// SPDX-License-Identifier: MIT
+
+#include "bigint.h"
+#include <algorithm>
+#include <charconv>
+
+namespace {
+    using Limbs = std::vector<std::uint32_t>;
+
+    // The base integers are held in.
+    constexpr std::uint32_t base{1000000000};
+
+    // Decimal digits per limb.
+    constexpr int limb_digits{9};
+
+    // The size, in limbs, below which products are computed directly.
+    constexpr std::size_t karatsuba_threshold{32};
+
+    // The most factors multiplied one at a time when computing a factorial.
+    constexpr unsigned leaf_factors{16};
+
+    // Remove the leading zero limbs of a.
+    void trim(Limbs& a)
+    {
+        while (!a.empty() && a.back() == 0) {
+            a.pop_back();
+        }
+    }
+
+    // Add b, shifted left by shift limbs, to a.
+    void add_at(Limbs& a, const Limbs& b, std::size_t shift)
+    {
+        if (a.size() < b.size() + shift) {
+            a.resize(b.size() + shift, 0);
+        }
+        std::uint32_t carry{0};
+        std::size_t i{shift};
+        for (std::uint32_t limb : b) {
+            std::uint32_t sum{a[i] + limb + carry};
+            carry = sum >= base;
+            a[i++] = carry ? sum - base : sum;
+        }
+        for (; carry; ++i) {
+            if (i == a.size()) {
+                a.push_back(0);
+            }
+            carry = ++a[i] == base;
+            if (carry) {
+                a[i] = 0;
+            }
+        }
+    }
+
+    // Subtract b from a, where a is at least b.
+    void subtract(Limbs& a, const Limbs& b)
+    {
+        std::uint32_t borrow{0};
+        std::size_t i{0};
+        for (; i < b.size(); ++i) {
+            std::uint32_t sub{b[i] + borrow};
+            borrow = a[i] < sub;
+            a[i] = borrow ? a[i] + base - sub : a[i] - sub;
+        }
+        for (; borrow; ++i) {
+            borrow = a[i] == 0;
+            a[i] = borrow ? base - 1 : a[i] - 1;
+        }
+        trim(a);
+    }
+
+    // The sum of the n limbs at a and the m limbs at b.
+    Limbs sum(const std::uint32_t* a, std::size_t n, const std::uint32_t* b,
+              std::size_t m)
+    {
+        Limbs s(a, a + n);
+        add_at(s, Limbs(b, b + m), 0);
+        return s;
+    }
+
+    // The product of the n limbs at a and the m limbs at b, computed
+    // directly.
+    Limbs multiply_simple(const std::uint32_t* a, std::size_t n,
+                          const std::uint32_t* b, std::size_t m)
+    {
+        Limbs r(n + m, 0);
+        for (std::size_t i = 0; i < n; ++i) {
+            std::uint64_t carry{0};
+            for (std::size_t j = 0; j < m; ++j) {
+                std::uint64_t t{r[i + j] + std::uint64_t{a[i]} * b[j] + carry};
+                r[i + j] = static_cast<std::uint32_t>(t % base);
+                carry = t / base;
+            }
+            r[i + m] = static_cast<std::uint32_t>(carry);
+        }
+        trim(r);
+        return r;
+    }
+
+    // The product of the n limbs at a and the m limbs at b.
+    Limbs multiply(const std::uint32_t* a, std::size_t n,
+                   const std::uint32_t* b, std::size_t m)
+    {
+        if (n < m) {
+            std::swap(a, b);
+            std::swap(n, m);
+        }
+        if (m < karatsuba_threshold) {
+            return multiply_simple(a, n, b, m);
+        }
+
+        // Multiply a much longer a by b a piece at a time, so that both
+        // halves of every split below are nonempty.
+        Limbs r;
+        if (2 * m <= n) {
+            for (std::size_t i = 0; i < n; i += m) {
+                add_at(r, multiply(a + i, std::min(m, n - i), b, m), i);
+            }
+            trim(r);
+            return r;
+        }
+
+        // (a1 B^k + a0)(b1 B^k + b0)
+        //     = z2 B^2k + ((a0 + a1)(b0 + b1) - z2 - z0) B^k + z0
+        std::size_t k{n / 2};
+        Limbs z0{multiply(a, k, b, k)};
+        Limbs z2{multiply(a + k, n - k, b + k, m - k)};
+        Limbs sa{sum(a, k, a + k, n - k)};
+        Limbs sb{sum(b, k, b + k, m - k)};
+        Limbs z1{multiply(sa.data(), sa.size(), sb.data(), sb.size())};
+        subtract(z1, z0);
+        subtract(z1, z2);
+        r = std::move(z0);
+        add_at(r, z1, k);
+        add_at(r, z2, 2 * k);
+        trim(r);
+        return r;
+    }
+
+    // The product of the integers in (lo, hi].
+    Big_integer product(unsigned lo, unsigned hi)
+    {
+        if (hi - lo <= leaf_factors) {
+            Big_integer p{1};
+            for (unsigned k = lo + 1; k <= hi; ++k) {
+                p *= k;
+            }
+            return p;
+        }
+        unsigned mid{lo + (hi - lo) / 2};
+        return product(lo, mid) * product(mid, hi);
+    }
+}
+
+// Construct an integer.
+Big_integer::Big_integer(std::uint64_t v)
+{
+    for (; v != 0; v /= base) {
+        limbs.push_back(static_cast<std::uint32_t>(v % base));
+    }
+}
+
+// Multiply two integers.
+Big_integer operator*(const Big_integer& a, const Big_integer& b)
+{
+    Big_integer p;
+    p.limbs = multiply(a.limbs.data(), a.limbs.size(), b.limbs.data(),
+                       b.limbs.size());
+    return p;
+}
+
+// Multiply by a small integer.
+Big_integer& Big_integer::operator*=(std::uint32_t k)
+{
+    std::uint64_t carry{0};
+    for (std::uint32_t& limb : limbs) {
+        std::uint64_t t{std::uint64_t{limb} * k + carry};
+        limb = static_cast<std::uint32_t>(t % base);
+        carry = t / base;
+    }
+    for (; carry != 0; carry /= base) {
+        limbs.push_back(static_cast<std::uint32_t>(carry % base));
+    }
+    trim(limbs);
+    return *this;
+}
+
+// Count the integer's decimal digits.
+std::size_t Big_integer::digits() const
+{
+    if (limbs.empty()) {
+        return 1;
+    }
+    std::size_t n{(limbs.size() - 1) * limb_digits};
+    for (std::uint32_t top = limbs.back(); top != 0; top /= 10) {
+        ++n;
+    }
+    return n;
+}
+
+// Format the integer in decimal.
+std::string Big_integer::to_string() const
+{
+    if (limbs.empty()) {
+        return "0";
+    }
+    std::string text(digits(), '0');
+    char* p{text.data() + text.size()};
+    for (std::size_t i = 0; i + 1 < limbs.size(); ++i) {
+        // Each lower limb fills exactly limb_digits digits, leading zeros
+        // included.
+        std::uint32_t limb{limbs[i]};
+        for (int d = 0; d < limb_digits; ++d, limb /= 10) {
+            *--p = static_cast<char>('0' + limb % 10);
+        }
+    }
+    std::to_chars(text.data(), p, limbs.back());
+    return text;
+}
+
+// Compute a factorial exactly.
+Big_integer exact_factorial(unsigned n)
+{
+    return product(0, n);
+}
@@ -0,0 +1,54 @@
+// bigint.h: Arbitrary-precision integer interface.
+// SPDX-FileCopyrightText: © 2021-2022 Bradley M. Jones <brdjns@gmx.us>
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// @class Big_integer
+// @brief A non-negative integer of any size.
+// @details Digits are held in base 10^9, least significant first, so an
+// integer is converted to decimal in linear time.  Large products are
+// computed by Karatsuba multiplication.
+class Big_integer {
+public:
+    // @brief Construct an integer.
+    // @param[in] v a value.
+    Big_integer(std::uint64_t v = 0);
+
+    // @brief Multiply two integers.
+    // @param a an integer.
+    // @param b an integer.
+    // @return The product of a and b.
+    friend Big_integer operator*(const Big_integer& a, const Big_integer& b);
+
+    // @brief Multiply by a small integer.
+    // @param k a multiplier, less than 10^9.
+    // @return This integer.
+    Big_integer& operator*=(std::uint32_t k);
+
+    // @brief Count the integer's decimal digits.
+    // @return The number of digits.
+    std::size_t digits() const;
+
+    // @brief Format the integer in decimal.
+    // @return The integer's digits.
+    std::string to_string() const;
+
+private:
+    std::vector<std::uint32_t> limbs; // base 10^9, least significant first
+};
+
+// The largest integer whose factorial is computed exactly.
+constexpr unsigned max_exact_factorial{100000};
+
+// @brief Compute a factorial exactly.
+// @details The product 1 * 2 * ... * n is split in halves, recursively, so
+// that the integers multiplied together are of similar sizes.
+// @param n an integer, at most max_exact_factorial.
+// @return The factorial of n.
+Big_integer exact_factorial(unsigned n);
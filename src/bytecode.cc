@@ -0,0 +1,367 @@
+// bytecode.cc: Bytecode compiler and virtual machine.
+// SPDX-FileCopyrightText: © 2021-2022 Bradley M. Jones <brdjns@gmx.us>
+// SPDX-License-Identifier: MIT
+
+#include "bytecode.h"
+#include "error.h"
+#include "function.h"
+#include "symbol_table.h"
+#include <algorithm>
+#include <cmath>
+
+// Opcodes for the operations an expression tree node can hold.
+static Opcode opcode(Op op)
+{
+    switch (op) {
+    case Op::number:
+        return Opcode::push;
+    case Op::load:
+        return Opcode::load;
+    case Op::neg:
+        return Opcode::neg;
+    case Op::add:
+        return Opcode::add;
+    case Op::sub:
+        return Opcode::sub;
+    case Op::mul:
+        return Opcode::mul;
+    case Op::div:
+        return Opcode::div;
+    case Op::mod:
+        return Opcode::mod;
+    case Op::pow:
+        return Opcode::pow;
+    case Op::fact:
+        return Opcode::fact;
+    case Op::sqrt:
+        return Opcode::sqrt;
+    case Op::abs:
+        return Opcode::abs;
+    case Op::builtin:
+        return Opcode::builtin;
+    case Op::bind:
+        return Opcode::tee;
+    case Op::temp:
+        return Opcode::temp;
+    case Op::call:
+        return Opcode::call;
+    case Op::arg:
+        return Opcode::arg;
+    case Op::reduce:
+        break; // by the reduction, in slot
+    }
+    return Opcode::ret; // never reached
+}
+
+// Emit the instructions for n in postfix order; return the stack depth
+// needed to compute it.
+static int emit_node(const Node& n, Program& p)
+{
+    int depth{0};
+    int i{0};
+    for (const Node_ptr& arg : n.args) {
+        depth = std::max(depth, i++ + emit_node(*arg, p));
+    }
+
+    std::uint32_t arg{0};
+    if (n.op == Op::number) {
+        arg = static_cast<std::uint32_t>(p.constants.size());
+        p.constants.push_back(n.value);
+    }
+    else if (n.op == Op::load || n.op == Op::arg || n.op == Op::builtin) {
+        arg = static_cast<std::uint32_t>(n.slot);
+    }
+    else if (n.op == Op::call || n.op == Op::reduce) {
+        arg = static_cast<std::uint32_t>(p.callees.size());
+        p.callees.push_back(n.callee);
+    }
+    else if (n.op == Op::bind || n.op == Op::temp) {
+        arg = static_cast<std::uint32_t>(n.slot);
+        p.temps = std::max(p.temps, n.slot + 1);
+    }
+    Opcode op{n.op == Op::reduce
+                  ? static_cast<Opcode>(static_cast<int>(Opcode::sum) + n.slot)
+                  : opcode(n.op)};
+    p.code.push_back(Instruction{op, arg});
+    return std::max(depth, 1);
+}
+
+// Compile an expression tree to bytecode.
+Program emit(const Node& n)
+{
+    Program p;
+    p.depth = emit_node(n, p);
+    p.code.push_back(Instruction{Opcode::ret, 0});
+    return p;
+}
+
+// Compile a statement to bytecode.
+Program emit(const Statement& s, Symbol_table& table)
+{
+    Result<Program> p{try_emit(s, table)};
+    if (!p) {
+        error(p.error());
+    }
+    return std::move(*p);
+}
+
+// Compile a statement to bytecode, without throwing.
+Result<Program> try_emit(const Statement& s, Symbol_table& table)
+{
+    int slot{-1};
+    if (s.kind == Stmt::set) {
+        slot = table.find(s.name);
+        if (slot < 0) {
+            return Error{Errc::undefined, 0, s.name};
+        }
+        if (table.is_constant(slot)) {
+            return Error{Errc::assign_constant};
+        }
+        if (table.is_bound(slot)) {
+            return Error{Errc::assign_bound};
+        }
+    }
+
+    Program p;
+    p.depth = emit_node(*s.expr, p);
+    p.kind = s.kind;
+    p.name = s.name;
+    if (slot >= 0) {
+        p.code.push_back(
+            Instruction{Opcode::store, static_cast<std::uint32_t>(slot)});
+    }
+    p.code.push_back(Instruction{Opcode::ret, 0});
+    return p;
+}
+
+// The size of the evaluation stack, and temporaries, kept in the virtual
+// machine's frame.
+constexpr int stack_size{64};
+
+static double call(const Function& f, double* slots, const double* args,
+                   int depth, Errc& err);
+
+// Execute a program, using stack as its evaluation stack and temps for its
+// temporaries, in the body of calls nested depth deep with arguments args;
+// on failure, set err and return 0.
+static double interpret(const Program& p, double* slots, double* stack,
+                        double* temps, const double* args, int depth,
+                        Errc& err)
+{
+    const Instruction* pc{p.code.data()};
+    const double* constants{p.constants.data()};
+    double* sp{stack - 1}; // top of stack
+
+    for (;; ++pc) {
+        switch (pc->op) {
+        case Opcode::push:
+            *++sp = constants[pc->arg];
+            break;
+        case Opcode::load:
+            *++sp = slots[pc->arg];
+            break;
+        case Opcode::store:
+            slots[pc->arg] = *sp;
+            break;
+        case Opcode::neg:
+            *sp = -*sp;
+            break;
+        case Opcode::add:
+            --sp;
+            *sp += sp[1];
+            break;
+        case Opcode::sub:
+            --sp;
+            *sp -= sp[1];
+            break;
+        case Opcode::mul:
+            --sp;
+            *sp *= sp[1];
+            break;
+        case Opcode::div:
+            --sp;
+            if (sp[1] == 0) {
+                err = Errc::division_by_zero;
+                return 0;
+            }
+            *sp /= sp[1];
+            break;
+        case Opcode::mod: // a%b is defined for floats
+            --sp;
+            if (sp[1] == 0) {
+                err = Errc::modulo_by_zero;
+                return 0;
+            }
+            *sp = std::fmod(*sp, sp[1]);
+            break;
+        case Opcode::pow:
+            --sp;
+            *sp = std::pow(*sp, sp[1]);
+            break;
+        case Opcode::fact:
+            err = factorial_domain(*sp);
+            if (err != Errc::none) {
+                return 0;
+            }
+            *sp = fn_factorial(*sp);
+            break;
+        case Opcode::sqrt:
+            if (*sp < 0) {
+                err = Errc::domain_error;
+                return 0;
+            }
+            *sp = std::sqrt(*sp);
+            break;
+        case Opcode::abs:
+            *sp = std::abs(*sp);
+            break;
+        case Opcode::builtin:
+        {
+            const Builtin& f{builtins[pc->arg]};
+            sp -= f.arity - 1;
+            *sp = call_builtin(f, *sp, sp[f.arity - 1], err);
+            if (err != Errc::none) {
+                return 0;
+            }
+            break;
+        }
+        case Opcode::tee:
+            temps[pc->arg] = *sp;
+            break;
+        case Opcode::temp:
+            *++sp = temps[pc->arg];
+            break;
+        case Opcode::call:
+        {
+            const Function& f{*p.callees[pc->arg]};
+            sp -= static_cast<int>(f.arity()) - 1;
+            *sp = call(f, slots, sp, depth + 1, err);
+            if (err != Errc::none) {
+                return 0;
+            }
+            break;
+        }
+        case Opcode::arg:
+            *++sp = args[pc->arg];
+            break;
+        case Opcode::sum:
+        case Opcode::prod:
+        case Opcode::min:
+        case Opcode::max:
+        case Opcode::mean:
+        {
+            const Function& f{*p.callees[pc->arg]};
+            sp -= static_cast<int>(f.arity());
+            Result<double> value{try_reduce(reduction(pc->op), f, slots, sp)};
+            if (!value) {
+                err = value.error().code;
+                return 0;
+            }
+            *sp = *value;
+            break;
+        }
+        case Opcode::ret:
+            return *sp;
+        }
+    }
+}
+
+// Run a program in a frame of its own; on failure, set err and return 0.
+static double run_frame(const Program& p, double* slots, const double* args,
+                        int depth, Errc& err)
+{
+    if (p.depth + p.temps <= stack_size) {
+        double stack[stack_size];
+        return interpret(p, slots, stack, stack + p.depth, args, depth, err);
+    }
+    std::vector<double> stack(p.depth + p.temps);
+    return interpret(p, slots, stack.data(), stack.data() + p.depth, args,
+                     depth, err);
+}
+
+// Call a function, from calls nested depth - 1 deep; on failure, set err and
+// return 0.  A hot body runs as native code, and on the virtual machine only
+// if that gives NaN, which may be an error.
+static double call(const Function& f, double* slots, const double* args,
+                   int depth, Errc& err)
+{
+    if (depth > max_call_depth) {
+        err = Errc::call_depth;
+        return 0;
+    }
+    if (Native_function fn{f.code.native_function()}) {
+        double value{fn(slots, args)};
+        if (!std::isnan(value)) {
+            return value;
+        }
+    }
+    return run_frame(f.code.code(), slots, args, depth, err);
+}
+
+// Run a program.
+double run(const Program& p, double* slots)
+{
+    Result<double> value{try_run(p, slots)};
+    if (!value) {
+        error(value.error());
+    }
+    return *value;
+}
+
+// Run a program, without throwing.
+Result<double> try_run(const Program& p, double* slots)
+{
+    Errc err{Errc::none};
+    double value{run_frame(p, slots, nullptr, 0, err)};
+    if (err != Errc::none) {
+        return Error{err};
+    }
+    return value;
+}
+
+// Call a function, without throwing.
+Result<double> try_call(const Function& f, double* slots, const double* args)
+{
+    Errc err{Errc::none};
+    double value{call(f, slots, args, 1, err)};
+    if (err != Errc::none) {
+        return Error{err};
+    }
+    return value;
+}
+
+// Run a program against a symbol table.
+double execute(const Program& p, Symbol_table& table)
+{
+    Result<double> value{try_execute(p, table)};
+    if (!value) {
+        error(value.error());
+    }
+    return *value;
+}
+
+// Run a program against a symbol table, without throwing.
+Result<double> try_execute(const Program& p, Symbol_table& table)
+{
+    Result<double> value{try_run(p, table.bindings())};
+    if (!value) {
+        return value;
+    }
+
+    switch (p.kind) {
+    case Stmt::let:
+    case Stmt::constant:
+    case Stmt::bind:
+        if (!table.add(p.name, *value, p.kind == Stmt::constant)) {
+            return Error{Errc::defined, 0, p.name};
+        }
+        break;
+    case Stmt::set:
+    case Stmt::expression:
+    case Stmt::function:
+    case Stmt::save:
+    case Stmt::load:
+        break;
+    }
+    return value;
+}
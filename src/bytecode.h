@@ -0,0 +1,132 @@
+// bytecode.h: Bytecode compiler and virtual machine interface.
+// SPDX-FileCopyrightText: © 2021-2022 Bradley M. Jones <brdjns@gmx.us>
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "ast.h"
+#include "reduce.h"
+#include "result.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class Function;
+class Symbol_table;
+
+// Virtual machine instructions.  Operands are taken from, and results pushed
+// onto, an evaluation stack.
+enum class Opcode : std::uint8_t {
+    push,    // push constants[arg]
+    load,    // push slots[arg]
+    store,   // slots[arg] = top of stack
+    neg,     // -a
+    add,     // a+b
+    sub,     // a-b
+    mul,     // a*b
+    div,     // a/b
+    mod,     // a%b
+    pow,     // a^b
+    fact,    // a!
+    sqrt,    // sqrt(a)
+    abs,     // abs(a)
+    builtin, // builtins[arg](a) or builtins[arg](a, b)
+    tee,     // temps[arg] = top of stack
+    temp,    // push temps[arg]
+    call,    // call callees[arg] with its arguments on the stack
+    arg,     // push the call's argument arg
+    sum,     // reduce callees[arg] over the range, and with the rest of its
+    prod,    // arguments, on the stack, as the Reduction of the same name
+    min,
+    max,
+    mean,
+    ret,     // return top of stack
+};
+
+// @brief Find the reduction an opcode from Opcode::sum to Opcode::mean
+// performs.
+constexpr Reduction reduction(Opcode op)
+{
+    return static_cast<Reduction>(static_cast<int>(op) -
+                                  static_cast<int>(Opcode::sum));
+}
+
+// @class Instruction
+// @brief A virtual machine instruction.
+class Instruction {
+public:
+    Opcode op;         // an operation
+    std::uint32_t arg; // a constant index or slot, if op takes one
+};
+
+// @class Program
+// @brief A compiled statement.
+// @details Instructions are held in one contiguous buffer and always end
+// with Opcode::ret.
+class Program {
+public:
+    std::vector<Instruction> code;  // instructions
+    std::vector<double> constants;  // literal pool
+    std::vector<std::shared_ptr<const Function>> callees; // functions called
+    int depth{};                    // the deepest the stack grows
+    int temps{};                    // temporaries, for common subexpressions
+    Stmt kind{Stmt::expression};    // a statement kind
+    std::string name;               // the identifier declared or assigned
+};
+
+// @brief Compile an expression tree to bytecode.
+// @param n an expression tree.
+// @return A program that computes the value of n.
+Program emit(const Node& n);
+
+// @brief Compile a statement to bytecode.
+// @param s a statement.
+// @param table the symbol table the statement was compiled against.
+// @throws std::runtime_error if s assigns to an undefined variable.
+// @throws std::runtime_error if s assigns to a constant.
+// @return A program that executes s.
+Program emit(const Statement& s, Symbol_table& table);
+
+// @brief Compile a statement to bytecode, without throwing.
+// @param s a statement.
+// @param table the symbol table the statement was compiled against.
+// @return A program that executes s; Errc::undefined if s assigns to an
+// undefined variable, Errc::assign_constant if s assigns to a constant, or
+// Errc::assign_bound if s assigns to a bound variable.
+Result<Program> try_emit(const Statement& s, Symbol_table& table);
+
+// @brief Run a program.
+// @param p a program.
+// @param slots variable values, indexed by slot.
+// @throws std::runtime_error for division by zero and domain errors.
+// @return The value left on top of the stack.
+double run(const Program& p, double* slots);
+
+// @brief Run a program, without throwing.
+// @param p a program.
+// @param slots variable values, indexed by slot.
+// @return The value left on top of the stack, or the error that stopped the
+// program.
+Result<double> try_run(const Program& p, double* slots);
+
+// @brief Call a function, without throwing.
+// @param f a function.
+// @param slots variable values, indexed by slot.
+// @param args f.arity() arguments.
+// @return The value of the call, or the error that stopped it.
+Result<double> try_call(const Function& f, double* slots, const double* args);
+
+// @brief Run a program against a symbol table.
+// @details Declarations are added to the table once their value is known.
+// @param p a program.
+// @param table the symbol table the program was compiled against.
+// @throws std::runtime_error if the program cannot be executed.
+// @return The value of the statement.
+double execute(const Program& p, Symbol_table& table);
+
+// @brief Run a program against a symbol table, without throwing.
+// @param p a program.
+// @param table the symbol table the program was compiled against.
+// @return The value of the statement, or the error that stopped it.
+Result<double> try_execute(const Program& p, Symbol_table& table);
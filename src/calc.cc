@@ -4,36 +4,254 @@
 
 #include "calc.h"
 #include "error.h"
-#include "parse.h"
-#include "symbol_table.h"
+#include "format.h"
+#include "map.h"
+#include "mapped_file.h"
+#include "number.h"
+#include "profile.h"
+#include "serve.h"
+#include "stats.h"
 #include "token.h"
-#include <cmath>
+#include <charconv>
+#include <chrono>
 #include <cstdlib>
+#include <fstream>
 #include <iostream>
-#include <limits>
+#include <iterator>
+#include <optional>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
 
-static Symbol_table names;
+// @brief Print a usage message.
+static void usage()
+{
+    std::cerr
+        << "usage: calc [--stats] [--profile file] [--format spec] "
+           "[--numeric type] [--exact]\n"
+           "            [--snapshot file] [-f script]\n"
+           "       calc [--format spec] [--exact] [--snapshot file] --jobs N "
+           "[-f script]\n"
+           "       calc [--profile file] [--format spec] [--snapshot file] "
+           "[--jobs N]\n"
+           "            --map statement\n"
+           "       calc [--format spec] [--numeric type] [--exact] "
+           "[--snapshot file] [--jobs N]\n"
+           "            --serve [--socket path]\n"
+           "where spec is shortest, hex, digits=N or fixed=N,\n"
+           "type is float, double, long-double or double-double,\n"
+           "and N is a number of threads, or 0 for one per processor\n";
+}
+
+// @brief Read a number of threads: a decimal integer, not negative, and
+// nothing else.
+// @return The number, or nothing if text is not one.
+static std::optional<unsigned> thread_count(std::string_view text)
+{
+    unsigned n{};
+    auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), n);
+    if (ec != std::errc{} || end != text.data() + text.size()) {
+        return std::nullopt;
+    }
+    return n;
+}
+
+// @brief Write a profile as folded stacks, and print its report.
+static void report_profile(Profile& profile, std::ostream& folded)
+{
+    profile.write_folded(folded);
+    std::cout.flush();
+    profile.report(std::cerr);
+}
+
+// @brief Print how fast a script ran.
+static void report_throughput(const Session& session, std::size_t count,
+                              std::size_t bytes,
+                              std::chrono::duration<double> elapsed)
+{
+    std::cerr << count << " statements in " << elapsed.count() << " s: "
+              << count / elapsed.count() << " statements/s, "
+              << bytes / elapsed.count() / 1e6 << " MB/s, "
+              << session.nodes_removed()
+              << " nodes optimised away\n";
+}
 
 int main(int argc, char* argv[])
 try {
-    // Load predefined constants: these are constants in the sense that they
-    // cannot be assigned to. These constants are based on the non-standard
-    // 'M_*' macro constants available under <cmath> and <math.h> in many C and
-    // C++ implementations.
-    names.declare("E", Constant::e, true);
-    names.declare("LOG2E", Constant::log2e, true);
-    names.declare("LOG10E", Constant::log10e, true);
-    names.declare("LN2", Constant::ln2, true);
-    names.declare("LN10", Constant::ln10, true);
-    names.declare("PI", Constant::pi, true);
-    names.declare("PI_2", Constant::pi_2, true);
-    names.declare("PI_4", Constant::pi_4, true);
-    names.declare("SQRT2", Constant::sqrt2, true);
+    Session session;
+
+    std::string map;
+    std::string script;
+    std::string profile_file;
+    std::string snapshot;
+    std::string socket;
+    Number_format format;
+    Numeric numeric{Numeric::binary64};
+    bool is_stats{false};
+    bool exact{false};
+    bool is_serving{false};
+    long jobs{-1};
+    for (int i = 1; i < argc; ++i) {
+        std::string arg{argv[i]};
+        if (arg == "--stats") {
+            is_stats = true;
+        }
+        else if (arg == "--profile" && i + 1 < argc) {
+            profile_file = argv[++i];
+        }
+        else if (arg == "--exact") {
+            exact = true;
+        }
+        else if (arg == "--format" && i + 1 < argc) {
+            format = number_format(argv[++i]);
+        }
+        else if (arg == "--numeric" && i + 1 < argc) {
+            numeric = numeric_type(argv[++i]);
+        }
+        else if (arg == "--map" && i + 1 < argc) {
+            map = argv[++i];
+        }
+        else if (arg == "--snapshot" && i + 1 < argc) {
+            snapshot = argv[++i];
+        }
+        else if (arg == "--serve") {
+            is_serving = true;
+        }
+        else if (arg == "--socket" && i + 1 < argc) {
+            socket = argv[++i];
+        }
+        else if (arg == "--jobs" && i + 1 < argc) {
+            std::optional<unsigned> n{thread_count(argv[++i])};
+            if (!n) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            jobs = *n;
+        }
+        else if (arg == "-f" && i + 1 < argc) {
+            script = argv[++i];
+        }
+        else {
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+    // Profiles and CSV maps are computed in double.
+    bool is_double{numeric == Numeric::binary64};
+    bool is_parallel{jobs >= 0 && !is_serving};
+    if ((is_stats && !map.empty()) ||
+        (is_serving && (is_stats || !map.empty() || !profile_file.empty() ||
+                        !script.empty())) ||
+        (!socket.empty() && !is_serving) ||
+        (!is_double && (!map.empty() || !profile_file.empty())) ||
+        (is_parallel && map.empty() &&
+         (is_stats || !is_double || !profile_file.empty()))) {
+        usage();
+        return EXIT_FAILURE;
+    }
+    if (is_serving) {
+        Serve_options options;
+        options.socket = socket;
+        options.threads = jobs > 0 ? static_cast<unsigned>(jobs) : 0;
+        options.snapshot = snapshot;
+        options.format = format;
+        options.numeric = numeric;
+        options.exact = exact;
+        serve(options);
+        return EXIT_SUCCESS;
+    }
+    session.format(format);
+    session.numeric(numeric);
+    session.exact_factorials(exact);
+    if (!snapshot.empty()) {
+        session.load(snapshot);
+    }
+
+    // Counters for --stats, reported on the standard error at exit.
+    Stats stats;
+    if (is_stats) {
+        session.collect(&stats);
+    }
+
+    // The profile for --profile, written as folded stacks at exit.
+    Profile profile;
+    std::ofstream folded;
+    if (!profile_file.empty()) {
+        folded.open(profile_file);
+        if (!folded) {
+            error("cannot open ", profile_file);
+        }
+        session.collect(&profile);
+    }
+
+    if (!map.empty()) {
+        std::ios_base::sync_with_stdio(false);
+        unsigned threads{jobs > 0 ? static_cast<unsigned>(jobs) : 0};
+        std::size_t failures{map_csv(map, session.symbols(), std::cin,
+                                     std::cout, std::cerr, threads,
+                                     folded.is_open() ? &profile : nullptr,
+                                     format)};
+        if (folded.is_open()) {
+            report_profile(profile, folded);
+        }
+        return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (is_parallel) {
+        std::ios_base::sync_with_stdio(false);
+        unsigned threads{jobs > 0 ? static_cast<unsigned>(jobs)
+                                  : std::thread::hardware_concurrency()};
+        std::string input;
+        std::optional<Mapped_file> file;
+        if (!script.empty()) {
+            file.emplace(script);
+        }
+        else {
+            input.assign(std::istreambuf_iterator<char>{std::cin}, {});
+        }
+        std::string_view text{file ? file->text() : std::string_view{input}};
+        auto start = std::chrono::steady_clock::now();
+        std::size_t count{
+            session.execute_parallel(text, std::cout, std::cerr, threads)};
+        std::chrono::duration<double> elapsed{
+            std::chrono::steady_clock::now() - start};
+        std::cout.flush();
+        if (file) {
+            report_throughput(session, count, text.size(), elapsed);
+        }
+        return EXIT_SUCCESS;
+    }
+
+    if (!script.empty()) {
+        std::ios_base::sync_with_stdio(false);
+        Mapped_file file{script};
+        Token_stream ts{file.text()};
+        auto start = std::chrono::steady_clock::now();
+        std::size_t count{run_script(session, ts)};
+        std::chrono::duration<double> elapsed{
+            std::chrono::steady_clock::now() - start};
+        std::cout.flush();
+        report_throughput(session, count, file.text().size(), elapsed);
+        if (is_stats) {
+            stats.report(std::cerr);
+        }
+        if (folded.is_open()) {
+            report_profile(profile, folded);
+        }
+        return EXIT_SUCCESS;
+    }
 
     Token_stream ts;
-    compute(ts);
+    compute(session, ts);
+    std::cout.flush();
+    if (is_stats) {
+        stats.report(std::cerr);
+    }
+    if (folded.is_open()) {
+        report_profile(profile, folded);
+    }
     return EXIT_SUCCESS;
 }
 catch (std::exception& e) {
@@ -46,29 +264,13 @@ catch (...) {
 }
 
 // Compute an expression.
-void compute(Token_stream& ts)
+void compute(Session& session, Token_stream& ts)
 {
-    // Get the greatest available precision from a double: ordinarily a two-word
-    // double holds 10 significant digits.  For calc, we squeeze out 17
-    // significant digits to get the most out of our doubles.
-    std::cout.precision(std::numeric_limits<double>::max_digits10 + 2);
-
-    const std::string prompt{"> "};
+    session.execute(ts, std::cout, std::cerr, "> ");
+}
 
-    for (;;) try {
-            std::cout << prompt;
-            Token t{ts.get()};
-            for (; t.kind == Symbol::print_tok;) { // discard all 'print' tokens
-                t = ts.get();
-            }
-            if (t.kind == Symbol::quit_tok) {
-                return;
-            }
-            ts.putback(t);
-            std::cout << statement(ts) << '\n';
-        }
-        catch (std::runtime_error& e) {
-            std::cerr << "error: " << e.what() << '\n';
-            cleanup(ts);
-        }
+// Execute every statement in a stream of tokens, without prompting.
+std::size_t run_script(Session& session, Token_stream& ts)
+{
+    return session.execute(ts, std::cout, std::cerr);
 }
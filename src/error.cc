@@ -34,6 +34,122 @@ void error(const std::string& msg, int val)
     error(os.str());
 }
 
+// @brief Throw a runtime exception for a structured error.
+// @param e an error.
+// @throws std::runtime_error when called.
+void error(const Error& e)
+{
+    error(e.message());
+}
+
+// Format the error message.
+std::string Error::message() const
+{
+    std::ostringstream os;
+    os << *this;
+    return os.str();
+}
+
+// Print an error message, without building a string.
+std::ostream& operator<<(std::ostream& os, const Error& e)
+{
+    switch (e.code) {
+    case Errc::none:
+        return os << "no error";
+    case Errc::unrecognized_token:
+        return os << "unrecognized token";
+    case Errc::expected:
+        return os << "expected : " << static_cast<int>(e.expected);
+    case Errc::factor_expected:
+        return os << "factor expected";
+    case Errc::declaration_name:
+        return os << "identifier missing in declaration";
+    case Errc::declaration_equals:
+        return os << "'=' missing in declaration of " << e.name;
+    case Errc::assignment_name:
+        return os << "identifier missing in assignment";
+    case Errc::assignment_equals:
+        return os << "'=' missing in assignment of " << e.name;
+    case Errc::semicolon_expected:
+        return os << "';' expected";
+    case Errc::undefined:
+        return os << e.name << " is undefined";
+    case Errc::defined:
+        return os << e.name << " is defined";
+    case Errc::assign_constant:
+        return os << "cannot assign to a constant";
+    case Errc::assign_bound:
+        return os << "cannot assign to a bound variable";
+    case Errc::division_by_zero:
+        return os << "division by zero";
+    case Errc::modulo_by_zero:
+        return os << "modulo division by zero";
+    case Errc::domain_error:
+        return os << "domain error";
+    case Errc::arguments:
+        return os << "wrong number of arguments to " << e.name;
+    case Errc::call_depth:
+        return os << "calls nested too deeply";
+    case Errc::file_name:
+        return os << "quoted file name missing";
+    case Errc::save_failed:
+        return os << "cannot save a snapshot to " << e.name;
+    case Errc::load_failed:
+        return os << e.name << " is not a readable snapshot";
+    }
+    return os; // never reached
+}
+
+// Name an error code, as Errc spells it.
+std::string_view errc_name(Errc code)
+{
+    switch (code) {
+    case Errc::none:
+        return "none";
+    case Errc::unrecognized_token:
+        return "unrecognized_token";
+    case Errc::expected:
+        return "expected";
+    case Errc::factor_expected:
+        return "factor_expected";
+    case Errc::declaration_name:
+        return "declaration_name";
+    case Errc::declaration_equals:
+        return "declaration_equals";
+    case Errc::assignment_name:
+        return "assignment_name";
+    case Errc::assignment_equals:
+        return "assignment_equals";
+    case Errc::semicolon_expected:
+        return "semicolon_expected";
+    case Errc::undefined:
+        return "undefined";
+    case Errc::defined:
+        return "defined";
+    case Errc::assign_constant:
+        return "assign_constant";
+    case Errc::assign_bound:
+        return "assign_bound";
+    case Errc::division_by_zero:
+        return "division_by_zero";
+    case Errc::modulo_by_zero:
+        return "modulo_by_zero";
+    case Errc::domain_error:
+        return "domain_error";
+    case Errc::arguments:
+        return "arguments";
+    case Errc::call_depth:
+        return "call_depth";
+    case Errc::file_name:
+        return "file_name";
+    case Errc::save_failed:
+        return "save_failed";
+    case Errc::load_failed:
+        return "load_failed";
+    }
+    return {}; // never reached
+}
+
 // @brief Clean up remaining tokens during an exception.
 // @param ts a stream of tokens.
 void cleanup(Token_stream& ts)
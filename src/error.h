@@ -4,6 +4,7 @@
 
 #pragma once
 
+#include "result.h"
 #include "token.h"
 #include <string>
 
@@ -24,6 +25,11 @@ void error(const std::string& msg, const std::string& msg2);
 // @throws std::runtime_error when called.
 void error(const std::string& msg, int val);
 
+// @brief Throw a runtime exception for a structured error.
+// @param e an error.
+// @throws std::runtime_error when called.
+void error(const Error& e);
+
 // @brief Clean up remaining tokens during an exception.
 // @param ts a stream of tokens.
 void cleanup(Token_stream& ts);
@@ -0,0 +1,308 @@
+// evaluate.h: Expression tree evaluation in any number type.
+// SPDX-FileCopyrightText: © 2021-2022 Bradley M. Jones <brdjns@gmx.us>
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "ast.h"
+#include "function.h"
+#include "number.h"
+#include "reduce.h"
+#include "result.h"
+#include "symbol_table.h"
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// @class Evaluator
+// @brief Evaluates an expression tree in a number type T.
+// @details The evaluator is instantiated, and so specialised, for each
+// number type at compile time.  Literals are converted to T once, when the
+// evaluator is made, from their spelling where they have one, so that 0.1 is
+// the T nearest 0.1 rather than the nearest double.  Built-in functions other
+// than sqrt and abs are computed in double.  The body of each function called
+// is prepared once, as written, however often it is called, and so is the
+// body of each reduction, which is computed in T an index at a time.  An
+// Evaluator must not be run on several threads at once.
+template<class T>
+class Evaluator {
+    static_assert(is_number_v<T>, "T must be a number type");
+
+public:
+    // @brief Prepare to evaluate an expression tree.
+    // @param[in] n an expression tree; it must outlive the evaluator.
+    // @param[in] temps the number of temporaries n uses.
+    explicit Evaluator(const Node& n, int temps = 0)
+        : Evaluator{n, temps, nullptr}
+    {}
+
+    Evaluator(const Evaluator&) = delete;
+    Evaluator& operator=(const Evaluator&) = delete;
+
+    // @brief Evaluate the expression tree.
+    // @param[in] slots variable values, indexed by slot.
+    // @return The value of the expression, or the error that stopped it.
+    Result<T> run(const T* slots)
+    {
+        Errc err{Errc::none};
+        T value{evaluate(slots, nullptr, 0, err)};
+        if (err != Errc::none) {
+            return Error{err};
+        }
+        return value;
+    }
+
+private:
+    using Traits = Number_traits<T>;
+
+    // Evaluators for the bodies of the functions called, by function.
+    using Callees =
+        std::unordered_map<const Function*, std::unique_ptr<Evaluator>>;
+
+    const Node& root;        // the tree
+    std::vector<T> literals; // literals, in the order they are evaluated
+    std::vector<T> saved;    // temporaries
+    Callees own;             // the functions a statement calls
+    Callees* callees;        // the functions called, shared with callers
+
+    // Prepare to evaluate a tree, sharing the evaluators of the functions
+    // called with the caller's, if any.
+    Evaluator(const Node& n, int temps, Callees* shared)
+        : root{n}, saved(temps), callees{shared ? shared : &own}
+    {
+        convert(n);
+    }
+
+    // Evaluate the tree, in the body of calls nested depth deep with
+    // arguments args.
+    T evaluate(const T* slots, const T* args, int depth, Errc& err)
+    {
+        const T* literal{literals.data()};
+        return evaluate(root, slots, args, depth, literal, err);
+    }
+
+    // Convert the literals of n, in evaluation order.
+    void convert(const Node& n)
+    {
+        if (n.op == Op::number) {
+            literals.push_back(n.text.empty() ? Traits::from_double(n.value)
+                                              : Traits::parse(n.text));
+        }
+        else if ((n.op == Op::call || n.op == Op::reduce) &&
+                 callees->count(n.callee.get()) == 0) {
+            // Reserve the entry first: the body cannot call its own function.
+            std::unique_ptr<Evaluator>& e{(*callees)[n.callee.get()]};
+            e.reset(new Evaluator{*n.callee->body, 0, callees});
+        }
+        for (const Node_ptr& arg : n.args) {
+            convert(*arg);
+        }
+    }
+
+    // Record the first error.
+    static void fail(Errc& err, Errc code)
+    {
+        if (err == Errc::none) {
+            err = code;
+        }
+    }
+
+    // Evaluate n; an error is recorded in err, and the value is then
+    // meaningless.
+    T evaluate(const Node& n, const T* slots, const T* args, int depth,
+               const T*& literal, Errc& err)
+    {
+        auto eval = [&](const Node& a) {
+            return evaluate(a, slots, args, depth, literal, err);
+        };
+
+        switch (n.op) {
+        case Op::number:
+            return *literal++;
+        case Op::load:
+            return slots[n.slot];
+        case Op::neg:
+            return -eval(*n.args[0]);
+        case Op::add:
+        {
+            T left{eval(*n.args[0])};
+            return left + eval(*n.args[1]);
+        }
+        case Op::sub:
+        {
+            T left{eval(*n.args[0])};
+            return left - eval(*n.args[1]);
+        }
+        case Op::mul:
+        {
+            T left{eval(*n.args[0])};
+            return left * eval(*n.args[1]);
+        }
+        case Op::div:
+        {
+            T left{eval(*n.args[0])};
+            T right{eval(*n.args[1])};
+            if (right == T{}) {
+                fail(err, Errc::division_by_zero);
+                return T{};
+            }
+            return left / right;
+        }
+        case Op::mod: // a%b is defined for floats
+        {
+            T left{eval(*n.args[0])};
+            T right{eval(*n.args[1])};
+            if (right == T{}) {
+                fail(err, Errc::modulo_by_zero);
+                return T{};
+            }
+            return Traits::fmod(left, right);
+        }
+        case Op::pow:
+        {
+            T left{eval(*n.args[0])};
+            return Traits::pow(left, eval(*n.args[1]));
+        }
+        case Op::fact:
+        {
+            T temp{eval(*n.args[0])};
+            if (temp < T{} && Traits::trunc(temp) == temp) {
+                fail(err, Errc::domain_error);
+                return T{};
+            }
+            return Traits::factorial(temp);
+        }
+        case Op::sqrt:
+        {
+            T temp{eval(*n.args[0])};
+            if (temp < T{}) {
+                fail(err, Errc::domain_error);
+                return T{};
+            }
+            return Traits::sqrt(temp);
+        }
+        case Op::abs:
+            return Traits::abs(eval(*n.args[0]));
+        case Op::builtin:
+        {
+            const Builtin& f{builtins[n.slot]};
+            T a{eval(*n.args[0])};
+            T b{f.arity == 2 ? eval(*n.args[1]) : T{}};
+            Errc code{Errc::none};
+            T value{Traits::builtin(f, a, b, code)};
+            if (code != Errc::none) {
+                fail(err, code);
+                return T{};
+            }
+            return value;
+        }
+        case Op::bind:
+            return saved[n.slot] = eval(*n.args[0]);
+        case Op::temp:
+            return saved[n.slot];
+        case Op::call:
+        {
+            std::vector<T> frame;
+            frame.reserve(n.args.size());
+            for (const Node_ptr& arg : n.args) {
+                frame.push_back(eval(*arg));
+            }
+            if (depth >= max_call_depth) {
+                fail(err, Errc::call_depth);
+                return T{};
+            }
+            Evaluator& body{*callees->at(n.callee.get())};
+            return body.evaluate(slots, frame.data(), depth + 1, err);
+        }
+        case Op::arg:
+            return args[n.slot];
+        case Op::reduce:
+        {
+            std::vector<T> frame;
+            frame.reserve(n.args.size());
+            for (const Node_ptr& arg : n.args) {
+                frame.push_back(eval(*arg));
+            }
+            if (err != Errc::none) {
+                return T{};
+            }
+            if (depth >= max_call_depth) {
+                fail(err, Errc::call_depth);
+                return T{};
+            }
+            return reduce(static_cast<Reduction>(n.slot),
+                          *callees->at(n.callee.get()), slots, frame, depth,
+                          err);
+        }
+        }
+        return T{}; // never reached
+    }
+
+    // Reduce a body over a range, an index at a time, with the index and
+    // the rest of its arguments in frame, from the bounds on.  Sums are
+    // compensated as the compiled kernel's are.
+    static T reduce(Reduction kind, Evaluator& body, const T* slots,
+                    std::vector<T>& frame, int depth, Errc& err)
+    {
+        Result<std::int64_t> size{range_size(kind,
+                                             Traits::to_double(frame[0]),
+                                             Traits::to_double(frame[1]))};
+        if (!size) {
+            fail(err, size.error().code);
+            return T{};
+        }
+        auto first = static_cast<std::int64_t>(Traits::to_double(frame[0]));
+        T* args{frame.data() + 1}; // the index, then the rest
+        T sum{};
+        T lost{}; // what the additions have rounded away
+        T value{Traits::from_double(kind == Reduction::prod ? 1 : 0)};
+        for (std::int64_t i = 0; i < *size; ++i) {
+            args[0] = Traits::from_double(static_cast<double>(first + i));
+            T x{body.evaluate(slots, args, depth + 1, err)};
+            if (err != Errc::none) {
+                return T{};
+            }
+            switch (kind) {
+            case Reduction::sum:
+            case Reduction::mean:
+            {
+                T t{sum + x};
+                if (!(Traits::abs(sum) < Traits::abs(x))) {
+                    lost = lost + ((sum - t) + x);
+                }
+                else {
+                    lost = lost + ((x - t) + sum);
+                }
+                sum = t;
+                break;
+            }
+            case Reduction::prod:
+                value = value * x;
+                break;
+            case Reduction::min: // as fn_min
+                if (i == 0 || x < value || !(value == value)) {
+                    value = x;
+                }
+                break;
+            case Reduction::max: // as fn_max
+                if (i == 0 || value < x || !(value == value)) {
+                    value = x;
+                }
+                break;
+            }
+        }
+        switch (kind) {
+        case Reduction::sum:
+            return sum + lost;
+        case Reduction::mean:
+            return (sum + lost) /
+                   Traits::from_double(static_cast<double>(*size));
+        case Reduction::prod:
+        case Reduction::min:
+        case Reduction::max:
+            break;
+        }
+        return value;
+    }
+};
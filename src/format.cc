@@ -0,0 +1,145 @@
+// format.cc: Number formatting and buffered output.
+// SPDX-FileCopyrightText: © 2021-2022 Bradley M. Jones <brdjns@gmx.us>
+// SPDX-License-Identifier: MIT
+
+#include "format.h"
+#include "error.h"
+#include <charconv>
+#include <cmath>
+#include <string>
+#include <type_traits>
+
+namespace {
+    // The size of a bulk stream buffer.
+    constexpr std::size_t bulk_size{1 << 16};
+
+    // The magnitude from which the shortest notation is scientific.  In
+    // fixed point, a number is written exactly, not with its shortest
+    // digits, so a float from 1e9 on would be written with more digits than
+    // it has.
+    template<class T>
+    constexpr T max_fixed{std::is_same_v<T, float> ? T{1e9} : T{1e21}};
+
+    // Format a floating-point number.
+    template<class T>
+    char* format_float(char* first, char* last, T v, const Number_format& f)
+    {
+        if (!std::isfinite(v)) {
+            return std::to_chars(first, last, v).ptr;
+        }
+        switch (f.notation) {
+        case Notation::shortest:
+        {
+            T a{std::fabs(v)};
+            bool is_fixed{a == 0 || (a >= 1e-7 && a < max_fixed<T>)};
+            return std::to_chars(first, last, v,
+                                 is_fixed ? std::chars_format::fixed
+                                          : std::chars_format::scientific)
+                .ptr;
+        }
+        case Notation::digits:
+            return std::to_chars(first, last, v, std::chars_format::general,
+                                 f.precision)
+                .ptr;
+        case Notation::fixed:
+            return std::to_chars(first, last, v, std::chars_format::fixed,
+                                 f.precision)
+                .ptr;
+        case Notation::hex: // std::to_chars leaves out the 0x that %a writes
+            if (std::signbit(v)) {
+                *first++ = '-';
+            }
+            *first++ = '0';
+            *first++ = 'x';
+            return std::to_chars(first, last, std::fabs(v),
+                                 std::chars_format::hex)
+                .ptr;
+        }
+        return first; // never reached
+    }
+}
+
+// Parse a number format.
+Number_format number_format(std::string_view spec)
+{
+    if (spec == "shortest") {
+        return Number_format{Notation::shortest};
+    }
+    if (spec == "hex") {
+        return Number_format{Notation::hex};
+    }
+    std::size_t eq{spec.find('=')};
+    std::string_view name{spec.substr(0, eq)};
+    if (eq != std::string_view::npos && (name == "digits" || name == "fixed")) {
+        const char* first{spec.data() + eq + 1};
+        const char* last{spec.data() + spec.size()};
+        int n{};
+        auto [end, ec] = std::from_chars(first, last, n);
+        bool is_digits{name == "digits"};
+        if (ec == std::errc{} && end == last && n >= (is_digits ? 1 : 0) &&
+            n <= max_precision) {
+            return Number_format{is_digits ? Notation::digits : Notation::fixed,
+                                 n};
+        }
+    }
+    error("invalid number format: ", std::string{spec});
+    return Number_format{}; // never reached
+}
+
+// Format a number.
+char* format_number(char* first, char* last, double v, const Number_format& f)
+{
+    return format_float(first, last, v, f);
+}
+
+// Format a float, as a double is formatted.
+char* format_number(char* first, char* last, float v, const Number_format& f)
+{
+    return format_float(first, last, v, f);
+}
+
+// Format a long double, as a double is formatted.
+char* format_number(char* first, char* last, long double v,
+                    const Number_format& f)
+{
+    return format_float(first, last, v, f);
+}
+
+// Construct a bulk stream buffer.
+Bulk_buffer::Bulk_buffer(std::streambuf* out) : out{out}, buffer(bulk_size)
+{
+    setp(buffer.data(), buffer.data() + buffer.size());
+}
+
+Bulk_buffer::~Bulk_buffer()
+{
+    drain();
+}
+
+// Write the characters collected to the stream buffer written to.
+bool Bulk_buffer::drain()
+{
+    std::streamsize n{pptr() - pbase()};
+    bool is_written{out->sputn(pbase(), n) == n};
+    setp(buffer.data(), buffer.data() + buffer.size());
+    return is_written;
+}
+
+// Write the characters collected, and then ch.
+int Bulk_buffer::overflow(int ch)
+{
+    if (!drain()) {
+        return traits_type::eof();
+    }
+    if (ch != traits_type::eof()) {
+        *pptr() = static_cast<char>(ch);
+        pbump(1);
+    }
+    return traits_type::not_eof(ch);
+}
+
+// Write the characters collected, and flush the stream buffer written to.
+int Bulk_buffer::sync()
+{
+    return drain() ? out->pubsync() : -1;
+}
@@ -0,0 +1,85 @@
+// format.h: Number formatting and buffered output interface.
+// SPDX-FileCopyrightText: © 2021-2022 Bradley M. Jones <brdjns@gmx.us>
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <cstddef>
+#include <iostream>
+#include <string_view>
+#include <vector>
+
+// Notations for printing numbers.
+enum class Notation : char {
+    shortest, // the fewest digits that read back as the same number
+    digits,   // a number of significant digits, as printf's %g
+    fixed,    // a number of digits after the decimal point, as printf's %f
+    hex,      // hexadecimal floating point, as printf's %a
+};
+
+// The most digits a number format may ask for.
+constexpr int max_precision{100};
+
+// The most characters a number is formatted in.
+constexpr std::size_t max_number_size{512};
+
+// @class Number_format
+// @brief How results are printed.
+class Number_format {
+public:
+    Notation notation{Notation::shortest}; // a notation
+    int precision{};                       // digits, for digits and fixed
+};
+
+// @brief Parse a number format.
+// @param spec "shortest", "hex", "digits=N" or "fixed=N".
+// @throws std::runtime_error if spec is not a number format.
+// @return The number format.
+Number_format number_format(std::string_view spec);
+
+// @brief Format a number.
+// @details Numbers are formatted without regard to the locale.  In the
+// shortest notation, numbers from 1e-7 up to 1e21 are written in fixed
+// point, and others in scientific notation, as JavaScript does.
+// @param first the start of the buffer to format into.
+// @param last the end of the buffer; it must hold at least max_number_size
+// characters.
+// @param v a number.
+// @param f a number format.
+// @return The end of the formatted number.
+char* format_number(char* first, char* last, double v, const Number_format& f);
+
+// @brief Format a float or a long double, as a double is formatted.
+// @details In the shortest notation, a number is written with the fewest
+// digits that read back as the same number of its own type, and a float is
+// written in fixed point only below 1e9, where it has no more digits than
+// are significant.
+char* format_number(char* first, char* last, float v, const Number_format& f);
+char* format_number(char* first, char* last, long double v,
+                    const Number_format& f);
+
+// @class Bulk_buffer
+// @brief A stream buffer that collects the characters written through it,
+// and writes them to another in bulk.
+class Bulk_buffer : public std::streambuf {
+public:
+    // @brief Construct a bulk stream buffer.
+    // @param out the stream buffer to write to.
+    explicit Bulk_buffer(std::streambuf* out);
+
+    Bulk_buffer(const Bulk_buffer&) = delete;
+    Bulk_buffer& operator=(const Bulk_buffer&) = delete;
+    ~Bulk_buffer() override;
+
+protected:
+    int overflow(int ch) override;
+    int sync() override;
+
+private:
+    // @brief Write the characters collected to out.
+    // @return False if out failed.
+    bool drain();
+
+    std::streambuf* out;      // the stream buffer to write to
+    std::vector<char> buffer; // characters not yet written
+};
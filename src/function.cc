@@ -3,12 +3,44 @@
 // SPDX-License-Identifier: MIT
 
 #include "function.h"
+#include <cmath>
+#include <limits>
+
+namespace {
+    // Compute the factorials of 0 to max_factorial, multiplying in the same
+    // order as the recursive definition does.
+    constexpr auto factorials()
+    {
+        struct {
+            double of[max_factorial + 1];
+        } table{};
+        table.of[0] = 1;
+        for (int i = 1; i <= max_factorial; ++i) {
+            table.of[i] = i * table.of[i - 1];
+        }
+        return table;
+    }
+
+    constexpr auto factorial = factorials();
+}
 
 // Compute the factorial of num.
-double fn_factorial(int num)
+double fn_factorial(double num)
 {
-    if (num == 0) {
-        return 1;
+    if (num >= 0 && num <= max_factorial) {
+        auto n = static_cast<int>(num);
+        if (n == num) {
+            return factorial.of[n];
+        }
     }
-    return num * fn_factorial(num - 1);
+    else if (num > 0 && num == std::trunc(num)) {
+        return std::numeric_limits<double>::infinity();
+    }
+    return std::tgamma(num + 1);
+}
+
+// Check that the factorial of a value is defined.
+Errc factorial_domain(double num)
+{
+    return num < 0 && num == std::trunc(num) ? Errc::domain_error : Errc::none;
 }
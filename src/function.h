@@ -4,8 +4,182 @@
 
 #pragma once
 
+#include "ast.h"
+#include "batch.h"
+#include "result.h"
+#include <cmath>
+#include <cstddef>
+#include <string_view>
+#include <type_traits>
+
+// The largest integer whose factorial is finite as a double.
+constexpr int max_factorial{170};
+
 // @brief Compute the factorial of num.
-// @pre num is an integer.
+// @details The factorials of the integers up to max_factorial are read from
+// a table computed at compile time, and those of larger integers overflow to
+// infinity.  The factorial of any other number is tgamma(num + 1).
+// @pre num is not a negative integer.
 // @return The factorial of num.
 // @param num value to compute factorial of
-double fn_factorial(int num);
+double fn_factorial(double num);
+
+// @brief Check that the factorial of a value is defined.
+// @param num a value.
+// @return Errc::domain_error if num is a negative integer, where the gamma
+// function has its poles, and Errc::none otherwise.
+Errc factorial_domain(double num);
+
+// The numbers a built-in function is defined for.
+enum class Domain : bool {
+    partial, // not every number
+    total,   // every number
+};
+
+// @class Scalar_kernel
+// @brief The scalar kernel of a built-in function, in a floating-point type.
+template<class T>
+class Scalar_kernel {
+public:
+    T (*unary)(T);     // for arity 1
+    T (*binary)(T, T); // for arity 2
+};
+
+// @class Builtin
+// @brief A built-in function.
+// @details A built-in function takes one or two arguments, and is computed by
+// a scalar kernel, in double, float or long double, as <cmath> computes it in
+// each, and over columns by a vector kernel if it has one.
+// Functions that have an operation of their own, such as sqrt, are compiled
+// to it; the rest are compiled to Op::builtin, numbered by their position in
+// builtins.  A partial function fails with a domain error when its value is
+// not a number though its arguments are.
+class Builtin {
+public:
+    std::string_view name;            // a reserved word
+    int arity;                        // 1 or 2
+    Op op;                            // the operation, or Op::builtin
+    double (*unary)(double);          // the scalar kernel, for arity 1
+    double (*binary)(double, double); // the scalar kernel, for arity 2
+    Vector_kernel vector;             // the vector kernel, if any
+    Domain domain;                    // the numbers it is defined for
+    Scalar_kernel<float> in_float;    // the scalar kernel, in float
+
+    // The scalar kernel, in long double.
+    Scalar_kernel<long double> in_long_double;
+};
+
+// @brief The lesser of a and b, or whichever is a number, as fmin.
+template<class T>
+constexpr T fn_min(T a, T b)
+{
+    return b < a || a != a ? b : a;
+}
+
+// @brief The greater of a and b, or whichever is a number, as fmax.
+template<class T>
+constexpr T fn_max(T a, T b)
+{
+    return a < b || a != a ? b : a;
+}
+
+// @brief Describe a built-in function of one argument.
+// @param f a generic lambda, instantiated in each floating-point type.
+template<class F>
+constexpr Builtin unary(std::string_view name, F f, Domain d,
+                        Vector_kernel v = nullptr, Op op = Op::builtin)
+{
+    return Builtin{name, 1, op, f, nullptr, v, d, {f, nullptr}, {f, nullptr}};
+}
+
+// @brief Describe a built-in function of two arguments.
+// @param f a generic lambda, instantiated in each floating-point type.
+template<class F>
+constexpr Builtin binary(std::string_view name, F f, Domain d,
+                         Vector_kernel v = nullptr)
+{
+    return Builtin{name, 2, Op::builtin, nullptr, f, v, d, {nullptr, f},
+                   {nullptr, f}};
+}
+
+// The built-in functions, by number.
+inline constexpr Builtin builtins[]{
+    unary("sqrt", [](auto a) { return std::sqrt(a); }, Domain::partial,
+          nullptr, Op::sqrt),
+    unary("abs", [](auto a) { return std::abs(a); }, Domain::total, nullptr,
+          Op::abs),
+    unary("sin", [](auto a) { return std::sin(a); }, Domain::partial),
+    unary("cos", [](auto a) { return std::cos(a); }, Domain::partial),
+    unary("tan", [](auto a) { return std::tan(a); }, Domain::partial),
+    unary("asin", [](auto a) { return std::asin(a); }, Domain::partial),
+    unary("acos", [](auto a) { return std::acos(a); }, Domain::partial),
+    unary("atan", [](auto a) { return std::atan(a); }, Domain::total),
+    unary("sinh", [](auto a) { return std::sinh(a); }, Domain::total),
+    unary("cosh", [](auto a) { return std::cosh(a); }, Domain::total),
+    unary("tanh", [](auto a) { return std::tanh(a); }, Domain::total),
+    unary("asinh", [](auto a) { return std::asinh(a); }, Domain::total),
+    unary("acosh", [](auto a) { return std::acosh(a); }, Domain::partial),
+    unary("atanh", [](auto a) { return std::atanh(a); }, Domain::partial),
+    unary("exp", [](auto a) { return std::exp(a); }, Domain::total),
+    unary("exp2", [](auto a) { return std::exp2(a); }, Domain::total),
+    unary("expm1", [](auto a) { return std::expm1(a); }, Domain::total),
+    unary("log", [](auto a) { return std::log(a); }, Domain::partial),
+    unary("log2", [](auto a) { return std::log2(a); }, Domain::partial),
+    unary("log10", [](auto a) { return std::log10(a); }, Domain::partial),
+    unary("log1p", [](auto a) { return std::log1p(a); }, Domain::partial),
+    unary("cbrt", [](auto a) { return std::cbrt(a); }, Domain::total),
+    unary("erf", [](auto a) { return std::erf(a); }, Domain::total),
+    unary("erfc", [](auto a) { return std::erfc(a); }, Domain::total),
+    unary("tgamma", [](auto a) { return std::tgamma(a); }, Domain::partial),
+    unary("lgamma", [](auto a) { return std::lgamma(a); }, Domain::total),
+    unary("floor", [](auto a) { return std::floor(a); }, Domain::total,
+          batch_floor),
+    unary("ceil", [](auto a) { return std::ceil(a); }, Domain::total,
+          batch_ceil),
+    unary("trunc", [](auto a) { return std::trunc(a); }, Domain::total,
+          batch_trunc),
+    unary("round", [](auto a) { return std::round(a); }, Domain::total),
+    binary("atan2", [](auto a, auto b) { return std::atan2(a, b); },
+           Domain::total),
+    binary("pow", [](auto a, auto b) { return std::pow(a, b); },
+           Domain::partial),
+    binary("hypot", [](auto a, auto b) { return std::hypot(a, b); },
+           Domain::total),
+    binary("min", [](auto a, auto b) { return fn_min(a, b); },
+           Domain::total, batch_min),
+    binary("max", [](auto a, auto b) { return fn_max(a, b); },
+           Domain::total, batch_max),
+    binary("copysign", [](auto a, auto b) { return std::copysign(a, b); },
+           Domain::total, batch_copysign),
+};
+
+// The number of built-in functions.
+constexpr std::size_t builtin_count{sizeof builtins / sizeof builtins[0]};
+
+// @brief Call a built-in function.
+// @param f a built-in function.
+// @param a its first argument.
+// @param b its second argument, if it takes two.
+// @param err set to Errc::domain_error if a or b is outside f's domain.
+// @return The value of f, computed in T, or NaN on a domain error.
+template<class T>
+T call_builtin(const Builtin& f, T a, T b, Errc& err)
+{
+    static_assert(std::is_floating_point_v<T>);
+    T v;
+    if constexpr (std::is_same_v<T, float>) {
+        v = f.arity == 1 ? f.in_float.unary(a) : f.in_float.binary(a, b);
+    }
+    else if constexpr (std::is_same_v<T, long double>) {
+        v = f.arity == 1 ? f.in_long_double.unary(a)
+                         : f.in_long_double.binary(a, b);
+    }
+    else {
+        v = f.arity == 1 ? f.unary(a) : f.binary(a, b);
+    }
+    if (f.domain == Domain::partial && std::isnan(v) && !std::isnan(a) &&
+        (f.arity == 1 || !std::isnan(b))) {
+        err = Errc::domain_error;
+    }
+    return v;
+}
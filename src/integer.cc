@@ -0,0 +1,85 @@
+// integer.cc: Checked integer arithmetic.
+// SPDX-FileCopyrightText: © 2021-2022 Bradley M. Jones <brdjns@gmx.us>
+// SPDX-License-Identifier: MIT
+
+#include "integer.h"
+#include <cmath>
+#include <limits>
+
+namespace {
+    using Integer = std::optional<std::int64_t>;
+
+    // The largest integer whose factorial fits in 64 bits.
+    constexpr int max_integer_factorial{20};
+
+    // Compute the factorials of 0 to max_integer_factorial.
+    constexpr auto factorials()
+    {
+        struct {
+            std::int64_t of[max_integer_factorial + 1];
+        } table{};
+        table.of[0] = 1;
+        for (int i = 1; i <= max_integer_factorial; ++i) {
+            table.of[i] = i * table.of[i - 1];
+        }
+        return table;
+    }
+
+    constexpr auto factorial = factorials();
+
+    // Raise a to the power b, for b at least 0, by repeated squaring.
+    Integer power(std::int64_t a, std::int64_t b)
+    {
+        std::int64_t r{1};
+        while (b != 0) {
+            if ((b & 1) != 0 && __builtin_mul_overflow(r, a, &r)) {
+                return std::nullopt;
+            }
+            b >>= 1;
+            if (b != 0 && __builtin_mul_overflow(a, a, &a)) {
+                return std::nullopt;
+            }
+        }
+        return r;
+    }
+}
+
+// Determine if a number is an integer that a double holds exactly.
+bool is_exact_integer(double v)
+{
+    return std::fabs(v) < max_exact_integer && v == std::trunc(v) &&
+           !(v == 0 && std::signbit(v));
+}
+
+// Apply an operation to integers, detecting overflow.
+std::optional<std::int64_t> integer_op(Op op, std::int64_t a, std::int64_t b)
+{
+    constexpr std::int64_t min{std::numeric_limits<std::int64_t>::min()};
+    std::int64_t r;
+    switch (op) {
+    case Op::neg:
+        return a == min ? Integer{} : -a;
+    case Op::abs:
+        return a == min ? Integer{} : a < 0 ? -a : a;
+    case Op::add:
+        return __builtin_add_overflow(a, b, &r) ? Integer{} : r;
+    case Op::sub:
+        return __builtin_sub_overflow(a, b, &r) ? Integer{} : r;
+    case Op::mul:
+        return __builtin_mul_overflow(a, b, &r) ? Integer{} : r;
+    case Op::mod: // truncates, as std::fmod does; min % -1 overflows in C++
+        if (b == 0) {
+            return std::nullopt;
+        }
+        return b == -1 ? 0 : a % b;
+    case Op::pow:
+        return b < 0 ? Integer{} : power(a, b);
+    case Op::fact:
+        if (a < 0 || a > max_integer_factorial) {
+            return std::nullopt;
+        }
+        return factorial.of[a];
+    default:
+        return std::nullopt;
+    }
+}
@@ -0,0 +1,31 @@
+// integer.h: Checked integer arithmetic interface.
+// SPDX-FileCopyrightText: © 2021-2022 Bradley M. Jones <brdjns@gmx.us>
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "ast.h"
+#include <cstdint>
+#include <optional>
+
+// The magnitude from which integers are not all held exactly by a double.
+constexpr double max_exact_integer{9007199254740992.0}; // 2^53
+
+// @brief Determine if a number is an integer that a double holds exactly.
+// @details Literals of 2^53 or more may have been rounded when they were
+// read, and -0 has a sign that an integer cannot carry, so neither is an
+// integer here.
+// @param v a number.
+// @return True if v is an integer, of magnitude less than 2^53, and not -0.
+bool is_exact_integer(double v);
+
+// @brief Apply an operation to integers, detecting overflow.
+// @details a^b is computed by repeated squaring, and a! from a table.
+// @param op Op::neg, Op::abs or Op::fact, of a; or Op::add, Op::sub,
+// Op::mul, Op::mod or Op::pow, of a and b.
+// @param a the operand, or the left operand.
+// @param b the right operand, if op takes two.
+// @return The result, or nothing if it overflows a 64-bit integer or is not
+// an integer: a/b, a%0, a^b for negative b, and a! for negative a.
+std::optional<std::int64_t> integer_op(Op op, std::int64_t a,
+                                       std::int64_t b = 0);
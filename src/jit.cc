@@ -0,0 +1,484 @@
+// jit.cc: Native code compiler for x86-64.
+// SPDX-FileCopyrightText: © 2021-2022 Bradley M. Jones <brdjns@gmx.us>
+// SPDX-License-Identifier: MIT
+
+#include "jit.h"
+#include "error.h"
+#include "function.h"
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__))
+#define CALC_JIT 1
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+Native_code::Native_code(Native_code&& other) noexcept
+    : mem{other.mem}, size{other.size}
+{
+    other.mem = nullptr;
+    other.size = 0;
+}
+
+Native_code& Native_code::operator=(Native_code&& other) noexcept
+{
+    std::swap(mem, other.mem);
+    std::swap(size, other.size);
+    return *this;
+}
+
+Native_code::~Native_code()
+{
+#ifdef CALC_JIT
+    if (mem) {
+        munmap(mem, size);
+    }
+#endif
+}
+
+// Replace an expression with a copy of another.
+Expression& Expression::operator=(const Expression& other)
+{
+    if (this != &other) {
+        program = other.program;
+        threshold = other.threshold;
+        count.store(0, std::memory_order_relaxed);
+        entry.store(nullptr, std::memory_order_relaxed);
+        native = Native_code{};
+    }
+    return *this;
+}
+
+// Evaluate the expression.
+double Expression::evaluate(double* slots) const
+{
+    Result<double> value{try_evaluate(slots)};
+    if (!value) {
+        error(value.error());
+    }
+    return *value;
+}
+
+// Evaluate the expression, without throwing.
+Result<double> Expression::try_evaluate(double* slots) const
+{
+    if (Native_function fn{native_function()}) {
+        double value{fn(slots, nullptr)};
+        if (!std::isnan(value)) {
+            return value;
+        }
+        // Native code returns NaN both for NaN results and for errors: let
+        // the interpreter decide which.
+    }
+    return try_run(program, slots);
+}
+
+// Count an evaluation, compiling the expression once it is hot.
+Native_function Expression::native_function() const
+{
+    Native_function fn{entry.load(std::memory_order_acquire)};
+    if (fn || count.load(std::memory_order_relaxed) >= threshold) {
+        return fn;
+    }
+    // Only the evaluation that reaches the threshold compiles.
+    if (count.fetch_add(1, std::memory_order_relaxed) + 1 == threshold) {
+        native = compile_native(program);
+        fn = native.function();
+        entry.store(fn, std::memory_order_release);
+    }
+    return fn;
+}
+
+#ifndef CALC_JIT
+
+// Compile a program to x86-64 machine code.
+Native_code compile_native(const Program&)
+{
+    return Native_code{};
+}
+
+#else
+
+namespace {
+    // Registers.
+    constexpr int rax{0};
+    constexpr int rsp{4};
+    constexpr int rbx{3};
+    constexpr int rsi{6};
+    constexpr int rdi{7};
+    constexpr int r12{12};
+
+    // Instruction prefixes and opcodes; SSE2 opcodes follow a 0x0f escape.
+    constexpr int pd{0x66}; // packed double
+    constexpr int sd{0xf2}; // scalar double
+    constexpr int movsd_load{0x10};
+    constexpr int movsd_store{0x11};
+    constexpr int movapd{0x28};
+    constexpr int sqrtsd{0x51};
+    constexpr int andpd{0x54};
+    constexpr int xorpd{0x57};
+    constexpr int addsd{0x58};
+    constexpr int mulsd{0x59};
+    constexpr int subsd{0x5c};
+    constexpr int divsd{0x5e};
+    constexpr int ucomisd{0x2e};
+
+    // Condition codes for jcc.
+    constexpr int cc_b{0x2};  // below, or unordered
+    constexpr int cc_e{0x4};  // equal, or unordered
+    constexpr int cc_p{0xa};  // unordered
+
+    // Stack entry k lives in register xmm<k>; xmm15 is scratch.
+    constexpr int registers{15};
+    constexpr int zero{15};
+    // Spill area for stack entries; temporaries follow it in the frame.
+    constexpr int spill_size{128};
+    constexpr int max_temps{4096};
+
+    // @class Assembler
+    // @brief Encodes the few x86-64 instructions the compiler uses.
+    class Assembler {
+    public:
+        std::vector<unsigned char> code;
+        std::int32_t frame_size{spill_size}; // kept 16-byte aligned for calls
+
+        void byte(int b) { code.push_back(static_cast<unsigned char>(b)); }
+
+        void dword(std::uint32_t d)
+        {
+            for (int i = 0; i < 4; ++i) {
+                byte(static_cast<int>(d >> (8 * i)) & 0xff);
+            }
+        }
+
+        void qword(std::uint64_t q)
+        {
+            dword(static_cast<std::uint32_t>(q));
+            dword(static_cast<std::uint32_t>(q >> 32));
+        }
+
+        // A REX prefix, if the operands need one.
+        void rex(int w, int reg, int rm)
+        {
+            int r{0x40 | w << 3 | (reg >> 3) << 2 | rm >> 3};
+            if (r != 0x40) {
+                byte(r);
+            }
+        }
+
+        // An SSE instruction on two registers.
+        void sse(int prefix, int op, int reg, int rm)
+        {
+            byte(prefix);
+            rex(0, reg, rm);
+            byte(0x0f);
+            byte(op);
+            byte(0xc0 | (reg & 7) << 3 | (rm & 7));
+        }
+
+        // An SSE instruction on a register and [base + disp].
+        void sse_mem(int prefix, int op, int reg, int base, std::int32_t disp)
+        {
+            byte(prefix);
+            rex(0, reg, base);
+            byte(0x0f);
+            byte(op);
+            byte(0x80 | (reg & 7) << 3 | (base & 7));
+            if ((base & 7) == rsp) {
+                byte(0x24); // SIB: no index
+            }
+            dword(static_cast<std::uint32_t>(disp));
+        }
+
+        // An SSE instruction on a register and [rip + disp]; returns the
+        // offset of disp, to be patched.
+        std::size_t sse_rip(int prefix, int op, int reg)
+        {
+            byte(prefix);
+            rex(0, reg, 0);
+            byte(0x0f);
+            byte(op);
+            byte(0x05 | (reg & 7) << 3);
+            std::size_t at{code.size()};
+            dword(0);
+            return at;
+        }
+
+        // A conditional jump; returns the offset of its target, to be
+        // patched.
+        std::size_t jcc(int cc)
+        {
+            byte(0x0f);
+            byte(0x80 | cc);
+            std::size_t at{code.size()};
+            dword(0);
+            return at;
+        }
+
+        // Point the 32-bit displacement at offset at to target.
+        void patch(std::size_t at, std::size_t target)
+        {
+            auto rel = static_cast<std::uint32_t>(
+                static_cast<std::int64_t>(target) -
+                static_cast<std::int64_t>(at + 4));
+            for (int i = 0; i < 4; ++i) {
+                code[at + i] = static_cast<unsigned char>(rel >> (8 * i));
+            }
+        }
+
+        // Call a function through rax.
+        void call(const void* fn)
+        {
+            rex(1, 0, rax);
+            byte(0xb8 | rax); // mov rax, imm64
+            qword(reinterpret_cast<std::uintptr_t>(fn));
+            byte(0xff);
+            byte(0xd0 | rax); // call rax
+        }
+
+        // Save rbx and r12, which hold the slots and the arguments, and
+        // make the frame; the two pushes and the frame keep rsp 16-byte
+        // aligned.
+        void prologue()
+        {
+            byte(0x50 | rbx); // push rbx
+            rex(0, 0, r12);
+            byte(0x50 | (r12 & 7)); // push r12
+            rex(1, rdi, rbx);
+            byte(0x89);
+            byte(0xc0 | rdi << 3 | rbx); // mov rbx, rdi
+            rex(1, rsi, r12);
+            byte(0x89);
+            byte(0xc0 | rsi << 3 | (r12 & 7)); // mov r12, rsi
+            rex(1, 0, rsp);
+            byte(0x81);
+            byte(0xe8 | rsp); // sub rsp, frame_size + 8
+            dword(static_cast<std::uint32_t>(frame_size + 8));
+        }
+
+        void epilogue()
+        {
+            rex(1, 0, rsp);
+            byte(0x81);
+            byte(0xc0 | rsp); // add rsp, frame_size + 8
+            dword(static_cast<std::uint32_t>(frame_size + 8));
+            rex(0, 0, r12);
+            byte(0x58 | (r12 & 7)); // pop r12
+            byte(0x58 | rbx);       // pop rbx
+            byte(0xc3);             // ret
+        }
+    };
+
+    // Factorial for native code, which cannot throw: NaN on a domain error.
+    double native_factorial(double x) noexcept
+    {
+        if (factorial_domain(x) != Errc::none) {
+            return std::numeric_limits<double>::quiet_NaN();
+        }
+        return fn_factorial(x);
+    }
+
+    double native_fmod(double x, double y) noexcept { return std::fmod(x, y); }
+
+    double native_pow(double x, double y) noexcept { return std::pow(x, y); }
+
+    // A rip-relative reference to be patched once the literal pool is laid
+    // out.
+    class Fixup {
+    public:
+        std::size_t at;    // offset of the displacement
+        std::size_t entry; // literal pool entry
+    };
+
+    // The literal pool's fixed entries, which precede the program's constants.
+    constexpr std::size_t sign_mask{0}; // 16 bytes
+    constexpr std::size_t abs_mask{2};  // 16 bytes
+    constexpr std::size_t nan_entry{4};
+    constexpr std::size_t fixed_entries{5};
+
+    // Call fn on the args stack entries ending at top, preserving the entries
+    // below them; leave the result in the first of them.
+    void emit_call(Assembler& a, const void* fn, int top, int args)
+    {
+        int first{top - args + 1};
+        for (int k = 0; k < first; ++k) {
+            a.sse_mem(sd, movsd_store, k, rsp, 8 * k);
+        }
+        for (int k = 0; k < args; ++k) {
+            if (first + k != k) {
+                a.sse(pd, movapd, k, first + k);
+            }
+        }
+        a.call(fn);
+        if (first != 0) {
+            a.sse(pd, movapd, first, 0);
+        }
+        for (int k = 0; k < first; ++k) {
+            a.sse_mem(sd, movsd_load, k, rsp, 8 * k);
+        }
+    }
+}
+
+// Compile a program to x86-64 machine code.
+Native_code compile_native(const Program& p)
+{
+    if (p.depth > registers || p.temps > max_temps) {
+        return Native_code{};
+    }
+
+    Assembler a;
+    std::vector<Fixup> fixups;
+    std::vector<std::size_t> bail; // jumps to the error exit
+    int sp{-1};                    // top of stack
+
+    // Jump to the error exit unless xmm<k> satisfies a comparison with zero.
+    auto check = [&](int k, int cc) {
+        a.sse(pd, xorpd, zero, zero);
+        a.sse(pd, ucomisd, k, zero);
+        bail.push_back(a.jcc(cc));
+    };
+
+    a.frame_size = spill_size + 16 * ((p.temps + 1) / 2);
+    a.prologue();
+    for (const Instruction& i : p.code) {
+        switch (i.op) {
+        case Opcode::push:
+            ++sp;
+            fixups.push_back(
+                Fixup{a.sse_rip(sd, movsd_load, sp), fixed_entries + i.arg});
+            break;
+        case Opcode::load:
+            a.sse_mem(sd, movsd_load, ++sp, rbx,
+                      static_cast<std::int32_t>(8 * i.arg));
+            break;
+        case Opcode::arg:
+            a.sse_mem(sd, movsd_load, ++sp, r12,
+                      static_cast<std::int32_t>(8 * i.arg));
+            break;
+        case Opcode::store:
+        case Opcode::call:
+        case Opcode::sum:
+        case Opcode::prod:
+        case Opcode::min:
+        case Opcode::max:
+        case Opcode::mean:
+            return Native_code{};
+        case Opcode::neg:
+            fixups.push_back(Fixup{a.sse_rip(pd, xorpd, sp), sign_mask});
+            break;
+        case Opcode::abs:
+            fixups.push_back(Fixup{a.sse_rip(pd, andpd, sp), abs_mask});
+            break;
+        case Opcode::add:
+            --sp;
+            a.sse(sd, addsd, sp, sp + 1);
+            break;
+        case Opcode::sub:
+            --sp;
+            a.sse(sd, subsd, sp, sp + 1);
+            break;
+        case Opcode::mul:
+            --sp;
+            a.sse(sd, mulsd, sp, sp + 1);
+            break;
+        case Opcode::div:
+            --sp;
+            check(sp + 1, cc_e);
+            a.sse(sd, divsd, sp, sp + 1);
+            break;
+        case Opcode::mod:
+            --sp;
+            check(sp + 1, cc_e);
+            emit_call(a, reinterpret_cast<const void*>(native_fmod), sp + 1, 2);
+            break;
+        case Opcode::pow:
+            --sp;
+            emit_call(a, reinterpret_cast<const void*>(native_pow), sp + 1, 2);
+            break;
+        case Opcode::fact:
+            emit_call(a, reinterpret_cast<const void*>(native_factorial), sp,
+                      1);
+            a.sse(pd, ucomisd, sp, sp);
+            bail.push_back(a.jcc(cc_p));
+            break;
+        case Opcode::sqrt:
+            check(sp, cc_b);
+            a.sse(sd, sqrtsd, sp, sp);
+            break;
+        case Opcode::builtin:
+        {
+            const Builtin& f{builtins[i.arg]};
+            sp -= f.arity - 1;
+            const void* fn{f.arity == 1
+                               ? reinterpret_cast<const void*>(f.unary)
+                               : reinterpret_cast<const void*>(f.binary)};
+            emit_call(a, fn, sp + f.arity - 1, f.arity);
+            if (f.domain == Domain::partial) { // NaN may be a domain error
+                a.sse(pd, ucomisd, sp, sp);
+                bail.push_back(a.jcc(cc_p));
+            }
+            break;
+        }
+        case Opcode::tee:
+            a.sse_mem(sd, movsd_store, sp, rsp,
+                      static_cast<std::int32_t>(spill_size + 8 * i.arg));
+            break;
+        case Opcode::temp:
+            a.sse_mem(sd, movsd_load, ++sp, rsp,
+                      static_cast<std::int32_t>(spill_size + 8 * i.arg));
+            break;
+        case Opcode::ret:
+            a.epilogue();
+            break;
+        }
+    }
+
+    // The error exit.
+    std::size_t exit{a.code.size()};
+    for (std::size_t at : bail) {
+        a.patch(at, exit);
+    }
+    fixups.push_back(Fixup{a.sse_rip(sd, movsd_load, 0), nan_entry});
+    a.epilogue();
+
+    // The literal pool, 16-byte aligned for the masks.
+    while (a.code.size() % 16 != 0) {
+        a.byte(0xcc);
+    }
+    std::size_t pool{a.code.size()};
+    a.qword(0x8000000000000000);
+    a.qword(0);
+    a.qword(0x7fffffffffffffff);
+    a.qword(0);
+    a.qword(0x7ff8000000000000); // quiet NaN
+    for (double c : p.constants) {
+        std::uint64_t bits;
+        std::memcpy(&bits, &c, sizeof bits);
+        a.qword(bits);
+    }
+    for (const Fixup& f : fixups) {
+        a.patch(f.at, pool + 8 * f.entry);
+    }
+
+    // Copy the code to its own pages, then make them executable.
+    auto page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    std::size_t size{(a.code.size() + page - 1) / page * page};
+    void* mem{mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)};
+    if (mem == MAP_FAILED) {
+        return Native_code{};
+    }
+    std::memcpy(mem, a.code.data(), a.code.size());
+    if (mprotect(mem, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(mem, size);
+        return Native_code{};
+    }
+    return Native_code{mem, size};
+}
+
+#endif
@@ -0,0 +1,123 @@
+// jit.h: Native code compiler interface.
+// SPDX-FileCopyrightText: © 2021-2022 Bradley M. Jones <brdjns@gmx.us>
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "bytecode.h"
+#include "result.h"
+#include <atomic>
+#include <cstddef>
+
+// A compiled expression: takes variable values, indexed by slot, and the
+// arguments of the call, if it is a function's body.
+using Native_function = double (*)(const double* slots, const double* args);
+
+// @class Native_code
+// @brief Machine code for an expression, held in executable memory.
+// @details Native code does not throw: where the interpreter would report an
+// error, native code returns NaN instead.
+class Native_code {
+public:
+    // @brief Construct an empty native code object.
+    Native_code() {}
+
+    // @brief Take ownership of executable memory.
+    // @param[in] mem executable memory, as returned by mmap.
+    // @param[in] size the size of mem in bytes.
+    Native_code(void* mem, std::size_t size) : mem{mem}, size{size} {}
+
+    Native_code(Native_code&& other) noexcept;
+    Native_code& operator=(Native_code&& other) noexcept;
+    Native_code(const Native_code&) = delete;
+    Native_code& operator=(const Native_code&) = delete;
+    ~Native_code();
+
+    // @brief Retrieve the compiled function.
+    // @return The compiled function, or nullptr if there is none.
+    Native_function function() const
+    {
+        return reinterpret_cast<Native_function>(mem);
+    }
+
+    // @brief Determine if there is a compiled function.
+    explicit operator bool() const { return mem != nullptr; }
+
+private:
+    void* mem{};        // executable memory
+    std::size_t size{}; // size of mem in bytes
+};
+
+// @brief Compile a program to x86-64 machine code.
+// @details Fails for programs that store to a variable, that call a function
+// that was not inlined, that reduce over a range, that need a deeper stack
+// than there are registers, and on targets other than x86-64 Unix.
+// @param p a program.
+// @return Native code for p, or an empty object if p cannot be compiled.
+Native_code compile_native(const Program& p);
+
+// The number of evaluations after which an expression is compiled to native
+// code.
+constexpr unsigned long jit_threshold{1000};
+
+// @class Expression
+// @brief An expression that is promoted to native code once it is hot.
+// @details An expression runs on the virtual machine until it has been
+// evaluated a threshold number of times, then on native code if it can be
+// compiled.  Errors are always reported by the virtual machine.  An
+// expression may be evaluated on several threads at once: the evaluation
+// that reaches the threshold compiles it, and the others go on running the
+// virtual machine until the native code is ready.  A copy starts cold.
+class Expression {
+public:
+    // @brief Construct an empty expression.
+    Expression() {}
+
+    // @brief Construct an expression from a program.
+    // @param[in] p a program.
+    // @param[in] threshold evaluations before native code is compiled; at
+    // least 1.
+    explicit Expression(Program p, unsigned long threshold = jit_threshold)
+        : program{std::move(p)}, threshold{threshold}
+    {}
+
+    Expression(const Expression& other)
+        : program{other.program}, threshold{other.threshold}
+    {}
+
+    Expression& operator=(const Expression& other);
+
+    // @brief Evaluate the expression.
+    // @param[in] slots variable values, indexed by slot.
+    // @throws std::runtime_error for division by zero and domain errors.
+    // @return The value of the expression.
+    double evaluate(double* slots) const;
+
+    // @brief Evaluate the expression, without throwing.
+    // @param[in] slots variable values, indexed by slot.
+    // @return The value of the expression, or the error that stopped it.
+    Result<double> try_evaluate(double* slots) const;
+
+    // @brief Count an evaluation, compiling the expression once it is hot.
+    // @details A NaN from the native code may be an error: the caller must
+    // then evaluate the program on the virtual machine.
+    // @return The native code, or nullptr if the expression is not hot or
+    // cannot be compiled.
+    Native_function native_function() const;
+
+    // @brief Determine if the expression has been compiled to native code.
+    bool is_native() const
+    {
+        return entry.load(std::memory_order_acquire) != nullptr;
+    }
+
+    // @brief Retrieve the expression's program.
+    const Program& code() const { return program; }
+
+private:
+    Program program;                      // bytecode
+    unsigned long threshold{jit_threshold}; // evaluations before compiling
+    mutable std::atomic<unsigned long> count{}; // evaluations so far
+    mutable std::atomic<Native_function> entry{}; // native, once compiled
+    mutable Native_code native;           // machine code, once compiled
+};
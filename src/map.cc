@@ -0,0 +1,392 @@
+// map.cc: Streaming CSV evaluation.
+// SPDX-FileCopyrightText: © 2021-2022 Bradley M. Jones <brdjns@gmx.us>
+// SPDX-License-Identifier: MIT
+
+#include "map.h"
+#include "batch.h"
+#include "bytecode.h"
+#include "error.h"
+#include "format.h"
+#include "jit.h"
+#include "optimise.h"
+#include "parse.h"
+#include "profile.h"
+#include "symbol_table.h"
+#include <algorithm>
+#include <cctype>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace {
+    // The amount of input read at a time.
+    constexpr std::size_t chunk_bytes{1 << 20};
+
+    // @class Chunk
+    // @brief Whole lines of input, and the output they produce.
+    class Chunk {
+    public:
+        std::size_t seq{};      // position in the input, in chunks
+        std::size_t line{};     // line number of the first line
+        std::string text;       // input lines
+        std::string out;        // results
+        std::string err;        // error messages
+        std::size_t failures{}; // rows that could not be evaluated
+    };
+
+    // @class Job
+    // @brief What every worker evaluates, shared read-only.
+    class Job {
+    public:
+        const Expression& program;    // the statement
+        std::vector<int> column;      // the slot of each column
+        const double* slots;          // values of other variables
+        Profiled_statement* profiled; // the statement's profile, if any
+        Number_format format;         // how results are printed
+    };
+
+    // @class Scratch
+    // @brief Space a worker reuses from chunk to chunk.
+    class Scratch {
+    public:
+        std::vector<std::vector<double>> columns; // one per CSV column
+        std::vector<std::size_t> lines;           // line number of each row
+        std::vector<std::string> errors;          // parse errors, by row
+        std::vector<const double*> bound;         // columns, by slot
+        std::vector<double> slots;                // values for one row
+        std::vector<double> results;              // one per row
+
+        // This worker's profile of the statement, if it is profiled.
+        std::unique_ptr<Profiled_statement> profiled;
+    };
+
+    // Append a result line.
+    void append(std::string& out, double value, const Number_format& f)
+    {
+        char buf[max_number_size + 1];
+        char* end{format_number(buf, buf + max_number_size, value, f)};
+        *end++ = '\n';
+        out.append(buf, end);
+    }
+
+    // Append an error line.
+    void append_error(Chunk& c, std::size_t line, const std::string& msg)
+    {
+        c.out += '\n';
+        c.err += "error: line " + std::to_string(line) + ": " + msg + '\n';
+        ++c.failures;
+    }
+
+    // Parse the fields of the line [p, end) into the next row of s.
+    void parse_row(const char* p, const char* end, Scratch& s)
+    {
+        std::string err;
+        std::size_t width{s.columns.size()};
+        for (std::size_t c = 0; c < width; ++c) {
+            if (!err.empty()) {
+                s.columns[c].push_back(0);
+                continue;
+            }
+            char* next{};
+            double value{std::strtod(p, &next)};
+            if (next == p || next > end) {
+                err = "invalid number in column " + std::to_string(c + 1);
+                s.columns[c].push_back(0);
+                continue;
+            }
+            s.columns[c].push_back(value);
+            p = next;
+            while (p < end && (*p == ' ' || *p == '\t')) {
+                ++p;
+            }
+            if (c + 1 < width ? p == end || *p != ',' : p != end) {
+                err = "expected " + std::to_string(width) + " fields";
+            }
+            ++p; // the comma
+        }
+        s.errors.push_back(err);
+    }
+
+    // Parse, evaluate and format a chunk.
+    void process(Chunk& c, const Job& job, Scratch& s)
+    {
+        for (std::vector<double>& column : s.columns) {
+            column.clear();
+        }
+        s.lines.clear();
+        s.errors.clear();
+
+        const char* p{c.text.data()};
+        const char* end{p + c.text.size()};
+        for (std::size_t line = c.line; p < end; ++line) {
+            const char* eol{static_cast<const char*>(
+                std::memchr(p, '\n', static_cast<std::size_t>(end - p)))};
+            const char* next{eol ? eol + 1 : end};
+            if (!eol) {
+                eol = end;
+            }
+            if (eol > p && eol[-1] == '\r') {
+                --eol;
+            }
+            if (eol > p) {
+                s.lines.push_back(line);
+                parse_row(p, eol, s);
+            }
+            p = next;
+        }
+
+        std::size_t rows{s.lines.size()};
+        s.results.resize(rows);
+        bool is_clean{std::all_of(
+            s.errors.begin(), s.errors.end(),
+            [](const std::string& e) { return e.empty(); })};
+        if (is_clean && !s.profiled) {
+            for (std::size_t i = 0; i < job.column.size(); ++i) {
+                s.bound[job.column[i]] = s.columns[i].data();
+            }
+            try {
+                evaluate_batch(job.program.code(), s.bound.data(), job.slots,
+                               s.results.data(), rows);
+                for (double value : s.results) {
+                    append(c.out, value, job.format);
+                }
+                return;
+            }
+            catch (std::runtime_error&) {
+                // Some row failed: find out which, one row at a time.
+            }
+        }
+
+        for (std::size_t r = 0; r < rows; ++r) {
+            if (!s.errors[r].empty()) {
+                append_error(c, s.lines[r], s.errors[r]);
+                continue;
+            }
+            for (std::size_t i = 0; i < job.column.size(); ++i) {
+                s.slots[job.column[i]] = s.columns[i][r];
+            }
+            Result<double> value{s.profiled
+                                     ? s.profiled->run(s.slots.data())
+                                     : job.program.try_evaluate(
+                                           s.slots.data())};
+            if (value) {
+                append(c.out, *value, job.format);
+            }
+            else {
+                append_error(c, s.lines[r], value.error().message());
+            }
+        }
+    }
+
+    // @class Pipeline
+    // @brief Chunks moving from the reader, through the workers, to the
+    // writer.
+    class Pipeline {
+    public:
+        std::mutex mutex;
+        std::condition_variable ready; // work queued, or input ended
+        std::condition_variable done;  // a chunk finished
+        std::condition_variable space; // a chunk written
+        std::deque<std::unique_ptr<Chunk>> work;
+        std::map<std::size_t, std::unique_ptr<Chunk>> finished;
+        std::size_t in_flight{}; // chunks read but not yet written
+        std::size_t total{};     // chunks read, once input has ended
+        bool is_closed{};        // true once input has ended
+    };
+
+    // Process chunks until the input ends.
+    void worker(Pipeline& pl, const Job& job, std::size_t width)
+    {
+        Scratch s;
+        s.columns.resize(job.column.size());
+        s.bound.assign(width, nullptr);
+        s.slots.assign(job.slots, job.slots + width);
+        if (job.profiled) {
+            std::lock_guard<std::mutex> lock{pl.mutex};
+            s.profiled.reset(new Profiled_statement{*job.profiled});
+        }
+
+        for (;;) {
+            std::unique_lock<std::mutex> lock{pl.mutex};
+            pl.ready.wait(lock,
+                          [&] { return !pl.work.empty() || pl.is_closed; });
+            if (pl.work.empty()) {
+                if (s.profiled) {
+                    job.profiled->merge(*s.profiled);
+                }
+                return;
+            }
+            std::unique_ptr<Chunk> c{std::move(pl.work.front())};
+            pl.work.pop_front();
+            lock.unlock();
+
+            process(*c, job, s);
+
+            lock.lock();
+            std::size_t seq{c->seq};
+            pl.finished[seq] = std::move(c);
+            pl.done.notify_all();
+        }
+    }
+
+    // Write chunks in input order; return the number of failed rows.
+    std::size_t writer(Pipeline& pl, std::ostream& out, std::ostream& err)
+    {
+        std::size_t failures{0};
+        for (std::size_t next = 0;; ++next) {
+            std::unique_lock<std::mutex> lock{pl.mutex};
+            pl.done.wait(lock, [&] {
+                return pl.finished.count(next) != 0 ||
+                       (pl.is_closed && next == pl.total);
+            });
+            auto i = pl.finished.find(next);
+            if (i == pl.finished.end()) {
+                return failures;
+            }
+            std::unique_ptr<Chunk> c{std::move(i->second)};
+            pl.finished.erase(i);
+            lock.unlock();
+
+            out.write(c->out.data(),
+                      static_cast<std::streamsize>(c->out.size()));
+            err.write(c->err.data(),
+                      static_cast<std::streamsize>(c->err.size()));
+            failures += c->failures;
+
+            lock.lock();
+            --pl.in_flight;
+            pl.space.notify_one();
+        }
+    }
+
+    // Determine if str is an identifier.
+    bool is_identifier(const std::string& str)
+    {
+        if (str.empty() || !std::isalpha(static_cast<unsigned char>(str[0]))) {
+            return false;
+        }
+        return std::all_of(str.begin(), str.end(), [](char ch) {
+            return std::isalnum(static_cast<unsigned char>(ch)) || ch == '_';
+        });
+    }
+
+    // Split a header row into column names.
+    std::vector<std::string> split_header(const std::string& header)
+    {
+        std::vector<std::string> names;
+        std::size_t begin{0};
+        for (;;) {
+            std::size_t end{header.find(',', begin)};
+            std::string name{header.substr(begin, end - begin)};
+            name.erase(0, name.find_first_not_of(" \t\r"));
+            name.erase(name.find_last_not_of(" \t\r") + 1);
+            if (!is_identifier(name)) {
+                error("invalid column name: ", name);
+            }
+            names.push_back(name);
+            if (end == std::string::npos) {
+                return names;
+            }
+            begin = end + 1;
+        }
+    }
+}
+
+// Evaluate a statement once for every row of a CSV stream.
+std::size_t map_csv(const std::string& src, Symbol_table& table,
+                    std::istream& in, std::ostream& out, std::ostream& err,
+                    unsigned threads, Profile* profile,
+                    const Number_format& format)
+{
+    std::string header;
+    if (!std::getline(in, header)) {
+        error("CSV header missing");
+    }
+    std::vector<int> column;
+    for (const std::string& name : split_header(header)) {
+        table.declare(name, 0, false);
+        column.push_back(table.slot(name));
+    }
+    Statement s{compile(src, table)};
+    if (s.kind == Stmt::function) {
+        error("a function definition has no value to map");
+    }
+    fold_integers(s, table); // first, so that a profile computes the same
+    Profiled_statement* profiled{
+        profile ? &profile->statement(s, emit(s, table), table) : nullptr};
+    optimise(s, table);
+    Expression program{emit(s, table)};
+    std::size_t width{table.size()};
+    Job job{program, column, table.bindings(), profiled, format};
+
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    const std::size_t max_in_flight{2 * threads + 2};
+
+    Pipeline pl;
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < threads; ++i) {
+        workers.emplace_back(worker, std::ref(pl), std::cref(job), width);
+    }
+    std::size_t failures{0};
+    std::thread write{[&] { failures = writer(pl, out, err); }};
+
+    // Read whole lines, a chunk at a time, and queue them.
+    std::string carry;
+    std::size_t seq{0};
+    std::size_t line{2};
+    for (bool is_eof = false; !is_eof;) {
+        std::unique_ptr<Chunk> c{new Chunk};
+        c->text = std::move(carry);
+        carry.clear();
+        std::size_t old{c->text.size()};
+        c->text.resize(old + chunk_bytes);
+        in.read(&c->text[old], chunk_bytes);
+        c->text.resize(old + static_cast<std::size_t>(in.gcount()));
+        is_eof = !in;
+
+        if (!is_eof) {
+            std::size_t last{c->text.rfind('\n')};
+            if (last == std::string::npos) {
+                carry = std::move(c->text); // a line longer than a chunk
+                continue;
+            }
+            carry = c->text.substr(last + 1);
+            c->text.resize(last + 1);
+        }
+        if (c->text.empty()) {
+            continue;
+        }
+        c->seq = seq++;
+        c->line = line;
+        line += static_cast<std::size_t>(
+            std::count(c->text.begin(), c->text.end(), '\n'));
+
+        std::unique_lock<std::mutex> lock{pl.mutex};
+        pl.space.wait(lock, [&] { return pl.in_flight < max_in_flight; });
+        ++pl.in_flight;
+        pl.work.push_back(std::move(c));
+        pl.ready.notify_one();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock{pl.mutex};
+        pl.is_closed = true;
+        pl.total = seq;
+        pl.ready.notify_all();
+        pl.done.notify_all();
+    }
+    for (std::thread& t : workers) {
+        t.join();
+    }
+    write.join();
+    return failures;
+}
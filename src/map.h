@@ -0,0 +1,35 @@
+// map.h: Streaming CSV evaluation interface.
+// SPDX-FileCopyrightText: © 2021-2022 Bradley M. Jones <brdjns@gmx.us>
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "format.h"
+#include <cstddef>
+#include <iostream>
+#include <string>
+
+class Profile;
+class Symbol_table;
+
+// @brief Evaluate a statement once for every row of a CSV stream.
+// @details The header row names the columns, and each column is declared as
+// a variable of the same name.  Input is read in chunks that are parsed,
+// evaluated and formatted on a pool of worker threads; results are written
+// one per line, in row order.  A row that cannot be evaluated produces an
+// empty line, and an error on err.  Blank lines are skipped.
+// @param src a statement.
+// @param table the symbol table to declare the columns in.
+// @param in a CSV stream of numbers.
+// @param out the stream to write results to.
+// @param err the stream to write errors to.
+// @param threads the number of worker threads, or 0 for one per core.
+// @param profile the profile to add to, if the statement is to be profiled;
+// rows are then evaluated one at a time.
+// @param format how results are printed.
+// @throws std::runtime_error if the header or the statement is invalid.
+// @return The number of rows that could not be evaluated.
+std::size_t map_csv(const std::string& src, Symbol_table& table,
+                    std::istream& in, std::ostream& out, std::ostream& err,
+                    unsigned threads = 0, Profile* profile = nullptr,
+                    const Number_format& format = {});
@@ -0,0 +1,70 @@
+// mapped_file.cc: Memory-mapped files.
+// SPDX-FileCopyrightText: © 2021-2022 Bradley M. Jones <brdjns@gmx.us>
+// SPDX-License-Identifier: MIT
+
+#include "mapped_file.h"
+#include "error.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CALC_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <fstream>
+#include <iterator>
+#endif
+
+#ifdef CALC_MMAP
+
+// Map a file into memory.
+Mapped_file::Mapped_file(const std::string& path)
+{
+    int fd{open(path.c_str(), O_RDONLY)};
+    if (fd < 0) {
+        error("cannot open ", path);
+    }
+    struct stat st {};
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        error("cannot read ", path);
+    }
+    size = static_cast<std::size_t>(st.st_size);
+    if (size != 0) {
+        void* mem{mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0)};
+        if (mem == MAP_FAILED) {
+            close(fd);
+            error("cannot map ", path);
+        }
+        madvise(mem, size, MADV_SEQUENTIAL);
+        data = static_cast<const char*>(mem);
+    }
+    close(fd);
+}
+
+Mapped_file::~Mapped_file()
+{
+    if (size != 0) {
+        munmap(const_cast<char*>(data), size);
+    }
+}
+
+#else
+
+// Read a file into memory.
+Mapped_file::Mapped_file(const std::string& path)
+{
+    std::ifstream is{path, std::ios::binary};
+    if (!is) {
+        error("cannot open ", path);
+    }
+    copy.assign(std::istreambuf_iterator<char>{is},
+                std::istreambuf_iterator<char>{});
+    data = copy.data();
+    size = copy.size();
+}
+
+Mapped_file::~Mapped_file() {}
+
+#endif
@@ -0,0 +1,34 @@
+// mapped_file.h: Memory-mapped file interface.
+// SPDX-FileCopyrightText: © 2021-2022 Bradley M. Jones <brdjns@gmx.us>
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// @class Mapped_file
+// @brief A file mapped read-only into memory.
+// @details Where memory mapping is unavailable, the file is read into memory
+// instead.
+class Mapped_file {
+public:
+    // @brief Map a file into memory.
+    // @param[in] path the file's name.
+    // @throws std::runtime_error if the file cannot be opened or mapped.
+    explicit Mapped_file(const std::string& path);
+
+    Mapped_file(const Mapped_file&) = delete;
+    Mapped_file& operator=(const Mapped_file&) = delete;
+    ~Mapped_file();
+
+    // @brief Retrieve the contents of the file.
+    // @return A view of the file's contents, valid while the file is mapped.
+    std::string_view text() const { return {data, size}; }
+
+private:
+    const char* data{}; // the file's contents
+    std::size_t size{}; // the size of the file in bytes
+    std::string copy;   // the contents, where files cannot be mapped
+};
@@ -0,0 +1,454 @@
+// number.cc: Numeric backends.
+// SPDX-FileCopyrightText: © 2021-2022 Bradley M. Jones <brdjns@gmx.us>
+// SPDX-License-Identifier: MIT
+
+#include "number.h"
+#include "error.h"
+#include "function.h"
+#include <algorithm>
+#include <charconv>
+#include <cstdlib>
+#include <limits>
+#include <string>
+
+namespace {
+    using Dd = Double_double;
+
+    // The sum of a and b, and the error in computing it.
+    Dd two_sum(double a, double b)
+    {
+        double s{a + b};
+        double bb{s - a};
+        return Dd{s, (a - (s - bb)) + (b - bb)};
+    }
+
+    // The sum of a and b, where |a| >= |b|, and the error in computing it.
+    Dd quick_two_sum(double a, double b)
+    {
+        double s{a + b};
+        return Dd{s, b - (s - a)};
+    }
+
+    // The product of a and b, and the error in computing it.
+    Dd two_prod(double a, double b)
+    {
+        double p{a * b};
+        return Dd{p, std::fma(a, b, -p)};
+    }
+
+    // The sum of a and b, ignoring whether either is approximate.
+    Dd add(Dd a, Dd b)
+    {
+        Dd s{two_sum(a.hi, b.hi)};
+        if (!std::isfinite(s.hi)) {
+            return Dd{s.hi};
+        }
+        Dd t{two_sum(a.lo, b.lo)};
+        s = quick_two_sum(s.hi, s.lo + t.hi);
+        return quick_two_sum(s.hi, s.lo + t.lo);
+    }
+
+    // The product of a and b, ignoring whether either is approximate.
+    Dd multiply(Dd a, Dd b)
+    {
+        Dd p{two_prod(a.hi, b.hi)};
+        if (!std::isfinite(p.hi)) {
+            return Dd{p.hi};
+        }
+        return quick_two_sum(p.hi, p.lo + (a.hi * b.lo + a.lo * b.hi));
+    }
+
+    // The quotient of a and b, ignoring whether either is approximate.
+    Dd divide(Dd a, Dd b)
+    {
+        double q1{a.hi / b.hi};
+        if (!std::isfinite(q1)) {
+            return Dd{q1};
+        }
+        Dd r{a - Dd{q1} * b};
+        double q2{r.hi / b.hi};
+        r = r - Dd{q2} * b;
+        double q3{r.hi / b.hi};
+        return quick_two_sum(q1, q2) + Dd{q3};
+    }
+
+    // Mark r approximate if a or b is.
+    Dd approximate_if(Dd r, Dd a, Dd b = Dd{})
+    {
+        r.is_approximate = a.is_approximate || b.is_approximate;
+        return r;
+    }
+
+    // Scale a by 2^e.
+    Dd scale(Dd a, int e)
+    {
+        return Dd{std::ldexp(a.hi, e), std::ldexp(a.lo, e)};
+    }
+
+    // Raise a to the integer power e by repeated squaring.
+    Dd powi(Dd a, long e)
+    {
+        bool is_negative{e < 0};
+        unsigned long bits{is_negative ? 0 - static_cast<unsigned long>(e)
+                                       : static_cast<unsigned long>(e)};
+        Dd r{1};
+        while (bits != 0) {
+            if (bits & 1) {
+                r = r * a;
+            }
+            bits >>= 1;
+            if (bits != 0) {
+                a = a * a;
+            }
+        }
+        return is_negative ? Dd{1} / r : r;
+    }
+
+    // ln 2, to double-double precision.
+    constexpr Dd ln2{6.931471805599452862e-01, 2.319046813846299558e-17};
+
+    // Compute e^a: a is reduced to r, with e^a = 2^k (e^(r/16))^16, and
+    // e^(r/16) is summed as a Taylor series.
+    Dd exp(Dd a)
+    {
+        if (a.hi > 709.8) {
+            return Dd{std::numeric_limits<double>::infinity()};
+        }
+        if (a.hi < -745.2) {
+            return Dd{0};
+        }
+        double k{std::nearbyint(a.hi / ln2.hi)};
+        Dd r{scale(a - ln2 * Dd{k}, -4)};
+        Dd sum{1};
+        Dd term{1};
+        for (int i = 1; i < 32; ++i) {
+            term = term * r / Dd{static_cast<double>(i)};
+            sum = sum + term;
+            if (std::fabs(term.hi) < 1e-36) {
+                break;
+            }
+        }
+        for (int i = 0; i < 4; ++i) {
+            sum = sum * sum;
+        }
+        return scale(sum, static_cast<int>(k));
+    }
+
+    // Compute ln a, for a > 0, by a Newton step from the double nearest it.
+    Dd log(Dd a)
+    {
+        Dd x{std::log(a.hi)};
+        return x + a * exp(-x) - Dd{1};
+    }
+
+    // The most significant digits a double-double is formatted with.
+    constexpr int max_digits{32};
+
+    // The largest decimal exponent scaled exactly enough to format.
+    constexpr int max_exponent{290};
+
+    // Write the first n decimal digits of a, which is finite, positive and
+    // within range, rounded, to digits, for n from 1 to max_digits; return
+    // the decimal exponent of the first.  The digit after the last, written
+    // to round, is left in digits[n].
+    int decimal_digits(Dd a, char (&digits)[max_digits + 1], int n)
+    {
+        int e{static_cast<int>(std::floor(std::log10(a.hi)))};
+        Dd r{e >= 0 ? a / powi(Dd{10}, e) : a * powi(Dd{10}, -e)};
+        if (!(r < Dd{10})) {
+            r = r / Dd{10};
+            ++e;
+        }
+        else if (r < Dd{1}) {
+            r = r * Dd{10};
+            --e;
+        }
+        for (int i = 0; i <= n; ++i) {
+            int d{std::clamp(static_cast<int>(r.hi), 0, 9)};
+            digits[i] = static_cast<char>('0' + d);
+            r = (r - Dd{static_cast<double>(d)}) * Dd{10};
+        }
+        bool is_up{digits[n] >= '5'};
+        for (int i = n - 1; is_up && i >= 0; --i) {
+            is_up = digits[i] == '9';
+            digits[i] = is_up ? '0' : static_cast<char>(digits[i] + 1);
+        }
+        if (is_up) { // 9.99... rounded up to 10
+            digits[0] = '1';
+            ++e;
+        }
+        return e;
+    }
+
+    // Write the digits [digits, digits + n), less trailing zeros, with the
+    // decimal exponent e, in fixed point or scientific notation.
+    char* lay_out(char* first, const char* digits, int n, int e, bool is_fixed)
+    {
+        while (n > 1 && digits[n - 1] == '0') {
+            --n;
+        }
+        if (!is_fixed) {
+            *first++ = digits[0];
+            if (n > 1) {
+                *first++ = '.';
+                first = std::copy(digits + 1, digits + n, first);
+            }
+            *first++ = 'e';
+            *first++ = e < 0 ? '-' : '+';
+            if (e > -10 && e < 10) {
+                *first++ = '0';
+            }
+            return std::to_chars(first, first + 4, e < 0 ? -e : e).ptr;
+        }
+        if (e < 0) {
+            *first++ = '0';
+            *first++ = '.';
+            first = std::fill_n(first, -e - 1, '0');
+            return std::copy(digits, digits + n, first);
+        }
+        for (int i = 0; i <= e; ++i) {
+            *first++ = i < n ? digits[i] : '0';
+        }
+        if (n > e + 1) {
+            *first++ = '.';
+            first = std::copy(digits + e + 1, digits + n, first);
+        }
+        return first;
+    }
+}
+
+// Parse the name of a number type.
+Numeric numeric_type(std::string_view name)
+{
+    if (name == Number_traits<float>::name) {
+        return Numeric::binary32;
+    }
+    if (name == Number_traits<double>::name) {
+        return Numeric::binary64;
+    }
+    if (name == Number_traits<long double>::name) {
+        return Numeric::extended;
+    }
+    if (name == Number_traits<Double_double>::name) {
+        return Numeric::double_double;
+    }
+    error("invalid number type: ", std::string{name});
+    return Numeric::binary64; // never reached
+}
+
+Double_double operator-(Double_double a)
+{
+    return Double_double{-a.hi, -a.lo, a.is_approximate};
+}
+
+Double_double operator+(Double_double a, Double_double b)
+{
+    return approximate_if(add(a, b), a, b);
+}
+
+Double_double operator-(Double_double a, Double_double b)
+{
+    return a + -b;
+}
+
+Double_double operator*(Double_double a, Double_double b)
+{
+    return approximate_if(multiply(a, b), a, b);
+}
+
+Double_double operator/(Double_double a, Double_double b)
+{
+    return approximate_if(divide(a, b), a, b);
+}
+
+// Parse a number literal as a float.
+float Number_traits<float>::parse(std::string_view text)
+{
+    float value{};
+    const char* last{text.data() + text.size()};
+    if (std::from_chars(text.data(), last, value).ec == std::errc{}) {
+        return value;
+    }
+    return std::strtof(std::string{text}.c_str(), nullptr); // out of range
+}
+
+// Compute the factorial of a float.
+float Number_traits<float>::factorial(float a)
+{
+    return static_cast<float>(fn_factorial(a));
+}
+
+// Parse a number literal as a double.
+double Number_traits<double>::parse(std::string_view text)
+{
+    double value{};
+    const char* last{text.data() + text.size()};
+    if (std::from_chars(text.data(), last, value).ec == std::errc{}) {
+        return value;
+    }
+    return std::strtod(std::string{text}.c_str(), nullptr); // out of range
+}
+
+// Compute the factorial of a double.
+double Number_traits<double>::factorial(double a)
+{
+    return fn_factorial(a);
+}
+
+// Parse a number literal as a long double.
+long double Number_traits<long double>::parse(std::string_view text)
+{
+    return std::strtold(std::string{text}.c_str(), nullptr);
+}
+
+// Compute the factorial of a long double.
+long double Number_traits<long double>::factorial(long double a)
+{
+    return std::tgamma(a + 1);
+}
+
+// Parse a number literal as a double-double: its digits are accumulated
+// exactly, and then scaled by a power of ten.
+Double_double Number_traits<Double_double>::parse(std::string_view text)
+{
+    Dd m{0};
+    int digits{0};
+    int e{0};
+    std::size_t i{0};
+    for (bool is_fraction{false}; i < text.size(); ++i) {
+        char ch{text[i]};
+        if (ch == '.') {
+            is_fraction = true;
+            continue;
+        }
+        if (ch < '0' || ch > '9') {
+            break;
+        }
+        if (digits < max_digits) {
+            m = m * Dd{10} + Dd{static_cast<double>(ch - '0')};
+            digits += m.hi != 0;
+            e -= is_fraction;
+        }
+        else {
+            e += !is_fraction; // a digit beyond those kept
+        }
+    }
+    if (i < text.size()) { // the exponent
+        const char* p{text.data() + i + 1};
+        p += *p == '+';
+        int exponent{};
+        std::from_chars(p, text.data() + text.size(), exponent);
+        e += exponent;
+    }
+    if (m.hi == 0) {
+        return m;
+    }
+    if (e + digits > max_exponent || e < -max_exponent) {
+        return Dd{Number_traits<double>::parse(text)};
+    }
+    return e >= 0 ? m * powi(Dd{10}, e) : m / powi(Dd{10}, -e);
+}
+
+// Truncate a double-double towards zero.
+Double_double Number_traits<Double_double>::trunc(Double_double a)
+{
+    double hi{std::trunc(a.hi)};
+    if (hi != a.hi) {
+        return approximate_if(Dd{hi}, a); // lo cannot carry a.hi that far
+    }
+    double lo{a.hi > 0 ? std::floor(a.lo) : std::ceil(a.lo)};
+    return approximate_if(quick_two_sum(hi, lo), a);
+}
+
+// Compute the remainder of a/b, with the sign of a.
+Double_double Number_traits<Double_double>::fmod(Double_double a,
+                                                 Double_double b)
+{
+    Dd q{trunc(a / b)};
+    if (!(std::fabs(q.hi) < 0x1p100)) {
+        return Dd{std::fmod(a.hi, b.hi), 0, true};
+    }
+    Dd r{a - q * b};
+    Dd m{a.hi < 0 ? -abs(b) : abs(b)}; // |b|, with the sign of a
+    if (r.hi != 0 && (r.hi < 0) != (a.hi < 0)) {
+        r = r + m; // a/b was rounded away from zero
+    }
+    else if (!(abs(r) < abs(m))) {
+        r = r - m; // a/b was rounded towards zero
+    }
+    return r;
+}
+
+// Raise a to the power b: exactly enough, by repeated squaring, for integer
+// b, and as e^(b ln a) otherwise.
+Double_double Number_traits<Double_double>::pow(Double_double a,
+                                                Double_double b)
+{
+    if (trunc(b) == b && std::fabs(b.hi) <= 0x1p30) {
+        return powi(a, static_cast<long>(b.hi + b.lo));
+    }
+    if (!(a.hi > 0) || !std::isfinite(a.hi) || !std::isfinite(b.hi)) {
+        return Dd{std::pow(a.hi, b.hi), 0, true};
+    }
+    return exp(b * log(a));
+}
+
+// Compute the square root of a by a Newton step from the double nearest it.
+Double_double Number_traits<Double_double>::sqrt(Double_double a)
+{
+    if (!(a.hi > 0) || !std::isfinite(a.hi)) {
+        return approximate_if(Dd{std::sqrt(a.hi)}, a);
+    }
+    double x{std::sqrt(a.hi)};
+    Dd r{a - two_prod(x, x)};
+    return approximate_if(quick_two_sum(x, r.hi / (2 * x)), a);
+}
+
+// Compute the factorial of a: of an integer by multiplication, and of any
+// other number as tgamma(a + 1).
+Double_double Number_traits<Double_double>::factorial(Double_double a)
+{
+    if (trunc(a) != a || a.hi < 0) {
+        return Dd{fn_factorial(a.hi + a.lo), 0, true};
+    }
+    if (a.hi > max_factorial) {
+        return Dd{std::numeric_limits<double>::infinity()};
+    }
+    Dd r{1};
+    for (int i = 2; i <= static_cast<int>(a.hi); ++i) {
+        r = r * Dd{static_cast<double>(i)};
+    }
+    return r;
+}
+
+// Format a double-double.
+char* Number_traits<Double_double>::format(char* first, char* last,
+                                           Double_double v,
+                                           const Number_format& f)
+{
+    double a{std::fabs(v.hi)};
+    bool is_wide{f.notation == Notation::shortest ||
+                 f.notation == Notation::digits};
+    if (v.is_approximate && f.notation == Notation::digits) {
+        Number_format g{f}; // no more digits than the double it came from
+        g.precision = std::min(g.precision,
+                               std::numeric_limits<double>::max_digits10);
+        return format_number(first, last, to_double(v), g);
+    }
+    if (!is_wide || v.is_approximate || !std::isfinite(a) || a == 0 ||
+        std::fabs(std::log10(a)) > max_exponent) {
+        return format_number(first, last, to_double(v), f);
+    }
+    if (v.hi < 0) {
+        *first++ = '-';
+        v = -v;
+    }
+    int n{f.notation == Notation::shortest
+              ? max_digits
+              : std::clamp(f.precision, 1, max_digits)};
+    char digits[max_digits + 1]{};
+    int e{decimal_digits(v, digits, n)};
+    bool is_fixed{f.notation == Notation::shortest ? e >= -7 && e < 21
+                                                   : e >= -4 && e < n};
+    return lay_out(first, digits, n, e, is_fixed);
+}
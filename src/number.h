@@ -0,0 +1,201 @@
+// number.h: Numeric backend interface.
+// SPDX-FileCopyrightText: © 2021-2022 Bradley M. Jones <brdjns@gmx.us>
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "format.h"
+#include "function.h"
+#include "result.h"
+#include <cmath>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+// The number types statements can be evaluated in.
+enum class Numeric : char {
+    binary32,      // float
+    binary64,      // double, the default
+    extended,      // long double
+    double_double, // Double_double
+};
+
+// @brief Parse the name of a number type.
+// @param name "float", "double", "long-double" or "double-double".
+// @throws std::runtime_error if name is not a number type.
+// @return The number type.
+Numeric numeric_type(std::string_view name);
+
+// @class Double_double
+// @brief A number held as the unevaluated sum of two doubles.
+// @details hi is the double nearest the number, and lo what remains, so a
+// double-double carries 106 bits of significand, about 32 decimal digits,
+// with the range of a double.  Arithmetic is exact to within a few units in
+// the last place of lo.  A number computed through a double, such as a
+// built-in function's value, is approximate, and so is any number computed
+// from it: only its leading part is known.
+class Double_double {
+public:
+    double hi;             // the leading part
+    double lo;             // the trailing part, no more than half an ulp of hi
+    bool is_approximate{}; // true if only as precise as a double
+
+    // @brief Construct a double-double from a double.
+    // @param[in] h a value.
+    // @param[in] l a trailing part, no more than half an ulp of h.
+    // @param[in] approximate true if the value is only as precise as a double.
+    constexpr Double_double(double h = 0, double l = 0,
+                            bool approximate = false)
+        : hi{h}, lo{l}, is_approximate{approximate}
+    {}
+};
+
+// @brief Double-double arithmetic.
+Double_double operator-(Double_double a);
+Double_double operator+(Double_double a, Double_double b);
+Double_double operator-(Double_double a, Double_double b);
+Double_double operator*(Double_double a, Double_double b);
+Double_double operator/(Double_double a, Double_double b);
+
+// @brief Double-double comparisons.
+inline bool operator==(Double_double a, Double_double b)
+{
+    return a.hi == b.hi && a.lo == b.lo;
+}
+
+inline bool operator!=(Double_double a, Double_double b) { return !(a == b); }
+
+inline bool operator<(Double_double a, Double_double b)
+{
+    return a.hi < b.hi || (a.hi == b.hi && a.lo < b.lo);
+}
+
+// @class Number_traits
+// @brief The operations the evaluator needs of a number type.
+// @details A type T is a number type if Number_traits<T> is specialised for
+// it, with these static members, and T has the arithmetic operators + - * /
+// and unary -, and the comparisons == and <:
+//     name                      the type's name, as --numeric takes it
+//     from_double(double)       the T nearest a double
+//     builtin(f, a, b, err)     the built-in function f of a and b, as
+//                               call_builtin defines it
+//     to_double(T)              the double nearest a T
+//     parse(text)               the T nearest a number literal's spelling
+//     trunc, fmod, pow, sqrt, abs
+//                               as <cmath> defines them for double
+//     factorial(T)              as fn_factorial defines it, for T not a
+//                               negative integer
+//     format(first, last, v, f) v, formatted as format_number would
+// Every backend is specialised at compile time: nothing is dispatched
+// through a virtual function.
+template<class T>
+class Number_traits;
+
+// @class is_number
+// @brief Determines if T is a number type.
+template<class T, class = void>
+class is_number : public std::false_type {};
+
+template<class T>
+class is_number<
+    T, std::void_t<decltype(Number_traits<T>::name),
+                   decltype(Number_traits<T>::from_double(0.0)),
+                   decltype(Number_traits<T>::builtin(builtins[0], T{}, T{},
+                                                      std::declval<Errc&>())),
+                   decltype(Number_traits<T>::to_double(T{})),
+                   decltype(Number_traits<T>::parse(std::string_view{})),
+                   decltype(Number_traits<T>::trunc(T{})),
+                   decltype(Number_traits<T>::fmod(T{}, T{})),
+                   decltype(Number_traits<T>::pow(T{}, T{})),
+                   decltype(Number_traits<T>::sqrt(T{})),
+                   decltype(Number_traits<T>::abs(T{})),
+                   decltype(Number_traits<T>::factorial(T{})),
+                   decltype(Number_traits<T>::format(
+                       nullptr, nullptr, T{}, Number_format{})),
+                   decltype(T{} + T{} - T{} * T{} / -T{}),
+                   decltype(T{} == T{} && T{} < T{})>> : public std::true_type {
+};
+
+template<class T>
+constexpr bool is_number_v{is_number<T>::value};
+
+// @class Built_in_traits
+// @brief The number traits of a built-in floating-point type.
+template<class T>
+class Built_in_traits {
+public:
+    static T from_double(double v) { return static_cast<T>(v); }
+    static double to_double(T v) { return static_cast<double>(v); }
+    static T trunc(T a) { return std::trunc(a); }
+    static T fmod(T a, T b) { return std::fmod(a, b); }
+    static T pow(T a, T b) { return std::pow(a, b); }
+    static T sqrt(T a) { return std::sqrt(a); }
+    static T abs(T a) { return std::abs(a); }
+
+    // @details As <cmath> computes it in T.
+    static T builtin(const Builtin& f, T a, T b, Errc& err)
+    {
+        return call_builtin(f, a, b, err);
+    }
+
+    static char* format(char* first, char* last, T v, const Number_format& f)
+    {
+        return format_number(first, last, v, f);
+    }
+};
+
+template<>
+class Number_traits<float> : public Built_in_traits<float> {
+public:
+    static constexpr std::string_view name{"float"};
+    static float parse(std::string_view text);
+    static float factorial(float a);
+};
+
+template<>
+class Number_traits<double> : public Built_in_traits<double> {
+public:
+    static constexpr std::string_view name{"double"};
+    static double parse(std::string_view text);
+    static double factorial(double a);
+};
+
+template<>
+class Number_traits<long double> : public Built_in_traits<long double> {
+public:
+    static constexpr std::string_view name{"long-double"};
+    static long double parse(std::string_view text);
+    static long double factorial(long double a);
+};
+
+template<>
+class Number_traits<Double_double> {
+public:
+    static constexpr std::string_view name{"double-double"};
+    static Double_double from_double(double v) { return Double_double{v}; }
+
+    // @details Computed in double, and so approximate.
+    static Double_double builtin(const Builtin& f, Double_double a,
+                                 Double_double b, Errc& err)
+    {
+        return Double_double{call_builtin(f, a.hi + a.lo, b.hi + b.lo, err),
+                             0, true};
+    }
+    static double to_double(Double_double v) { return v.hi + v.lo; }
+    static Double_double parse(std::string_view text);
+    static Double_double trunc(Double_double a);
+    static Double_double fmod(Double_double a, Double_double b);
+    static Double_double pow(Double_double a, Double_double b);
+    static Double_double sqrt(Double_double a);
+
+    static Double_double abs(Double_double a) { return a.hi < 0 ? -a : a; }
+
+    static Double_double factorial(Double_double a);
+
+    // @details The shortest notation writes 32 significant digits, less
+    // trailing zeros, and digits=N up to 32; fixed and hex notation,
+    // approximate numbers, and numbers beyond 1e290 or below 1e-290, format
+    // the nearest double.
+    static char* format(char* first, char* last, Double_double v,
+                        const Number_format& f);
+};
@@ -0,0 +1,466 @@
+// optimise.cc: Expression tree optimiser.
+// SPDX-FileCopyrightText: © 2021-2022 Bradley M. Jones <brdjns@gmx.us>
+// SPDX-License-Identifier: MIT
+
+#include "optimise.h"
+#include "bytecode.h"
+#include "function.h"
+#include "integer.h"
+#include "symbol_table.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <optional>
+#include <tuple>
+#include <unordered_map>
+
+namespace {
+    // The most nodes an optimised function body inlined at a call has.
+    constexpr int max_inline{32};
+
+    // Determine if n is the literal v; -0 and +0 are distinct.
+    bool is_literal(const Node& n, double v)
+    {
+        return n.op == Op::number && n.value == v &&
+               std::signbit(n.value) == std::signbit(v);
+    }
+
+    // Determine if an operation on literal operands is defined, so that
+    // folding it cannot fail.
+    bool is_defined(const Node& n)
+    {
+        switch (n.op) {
+        case Op::div:
+        case Op::mod:
+            return n.args[1]->value != 0;
+        case Op::fact:
+            return factorial_domain(n.args[0]->value) == Errc::none;
+        case Op::sqrt:
+            return !(n.args[0]->value < 0);
+        case Op::builtin:
+        {
+            const Builtin& f{builtins[n.slot]};
+            Errc err{Errc::none};
+            call_builtin(f, n.args[0]->value, n.args.back()->value, err);
+            return err == Errc::none;
+        }
+        default:
+            return true;
+        }
+    }
+
+    // Type a literal as an integer if it is one exactly.
+    void infer(Node& n)
+    {
+        if (is_exact_integer(n.value)) {
+            n.type = Type::integer;
+            n.integer = static_cast<std::int64_t>(n.value);
+        }
+    }
+
+    // Make a literal.
+    Node_ptr literal(double v)
+    {
+        auto n = std::make_unique<Node>(v);
+        infer(*n);
+        return n;
+    }
+
+    // Make an integer literal.
+    Node_ptr integer_literal(std::int64_t i)
+    {
+        auto n = std::make_unique<Node>(static_cast<double>(i));
+        n->type = Type::integer;
+        n->integer = i;
+        return n;
+    }
+
+    // Determine if floating-point arithmetic gives -0 where integer
+    // arithmetic gives op(a, b) = 0.
+    bool is_negative_zero(Op op, std::int64_t a, std::int64_t b)
+    {
+        switch (op) {
+        case Op::neg:
+            return true;
+        case Op::mul:
+            return a < 0 || b < 0;
+        case Op::mod:
+            return a < 0;
+        default:
+            return false;
+        }
+    }
+
+    // Determine if n is an integer literal.
+    bool is_integer(const Node_ptr& n)
+    {
+        return n->op == Op::number && n->type == Type::integer;
+    }
+
+    // Fold operations on integer operands exactly, bottom up, and nothing
+    // else; a constant that is an integer counts as a literal.
+    void fold_integers(Node_ptr& n, Symbol_table& table)
+    {
+        for (Node_ptr& arg : n->args) {
+            fold_integers(arg, table);
+        }
+
+        if (n->op == Op::number) {
+            if (n->type == Type::real) {
+                infer(*n);
+            }
+            return;
+        }
+        if (n->op == Op::load && table.is_constant(n->slot)) {
+            Node_ptr c{literal(table.bindings()[n->slot])};
+            if (is_integer(c)) {
+                n = std::move(c);
+            }
+            return;
+        }
+        if (n->args.empty() ||
+            !std::all_of(n->args.begin(), n->args.end(), is_integer)) {
+            return;
+        }
+        std::int64_t a{n->args[0]->integer};
+        std::int64_t b{n->args.size() > 1 ? n->args[1]->integer : 0};
+        if (std::optional<std::int64_t> r{integer_op(n->op, a, b)}) {
+            n = *r == 0 && is_negative_zero(n->op, a, b) ? literal(-0.0)
+                                                         : integer_literal(*r);
+        }
+    }
+
+    // Fold an operation on literal operands, in floating point, as it would
+    // be computed.
+    Node_ptr fold(const Node& n)
+    {
+        return literal(evaluate(n, nullptr));
+    }
+
+    // Copy a function body for a call, substituting its arguments for its
+    // parameters.  An argument that is not a literal or a variable is
+    // evaluated once, into a temporary, where its parameter is first used;
+    // the body's own temporaries are numbered from base.
+    Node_ptr substitute(const Node& n, std::vector<Node_ptr>& args,
+                        std::vector<int>& bound, int base, int& temps)
+    {
+        if (n.op == Op::arg) {
+            if (bound[n.slot] >= 0) {
+                return std::make_unique<Node>(Op::temp, bound[n.slot]);
+            }
+            Node_ptr& a{args[n.slot]};
+            switch (a->op) {
+            case Op::number:
+            case Op::load:
+            case Op::arg:
+                return clone(*a);
+            default:
+                break;
+            }
+            bound[n.slot] = temps++;
+            auto b = std::make_unique<Node>(Op::bind, std::move(a));
+            b->slot = bound[n.slot];
+            return b;
+        }
+        auto copy = std::make_unique<Node>(n.value);
+        copy->op = n.op;
+        copy->text = n.text;
+        copy->type = n.type;
+        copy->integer = n.integer;
+        copy->slot = n.slot;
+        copy->callee = n.callee;
+        if (n.op == Op::bind || n.op == Op::temp) {
+            copy->slot += base;
+        }
+        for (const Node_ptr& arg : n.args) {
+            copy->args.push_back(substitute(*arg, args, bound, base, temps));
+        }
+        return copy;
+    }
+
+    // Replace calls of inline functions with their bodies, bottom up;
+    // temps counts the temporaries the substituted bodies use.
+    void inline_calls(Node_ptr& n, int& temps)
+    {
+        for (Node_ptr& arg : n->args) {
+            inline_calls(arg, temps);
+        }
+        if (n->op != Op::call || !n->callee->is_inline) {
+            return;
+        }
+        std::shared_ptr<const Function> f{n->callee};
+        int base{temps};
+        temps += f->temps;
+        std::vector<int> bound(f->arity(), -1);
+        n = substitute(*f->optimised, n->args, bound, base, temps);
+    }
+
+    // Count the uses of each parameter in a function body.
+    void count_uses(const Node& n, std::vector<int>& uses)
+    {
+        if (n.op == Op::arg) {
+            ++uses[n.slot];
+        }
+        for (const Node_ptr& arg : n.args) {
+            count_uses(*arg, uses);
+        }
+    }
+
+    // Fold constants and remove identities, bottom up.
+    void simplify(Node_ptr& n, Symbol_table& table)
+    {
+        for (Node_ptr& arg : n->args) {
+            simplify(arg, table);
+        }
+
+        if (n->op == Op::number) {
+            if (n->type == Type::real) {
+                infer(*n);
+            }
+            return;
+        }
+        if (n->op == Op::load && table.is_constant(n->slot)) {
+            n = literal(table.bindings()[n->slot]);
+            return;
+        }
+        bool is_constant{std::all_of(
+            n->args.begin(), n->args.end(),
+            [](const Node_ptr& arg) { return arg->op == Op::number; })};
+        // A function's body, or a reduction's, may read variables, and a
+        // bound value is read again through its temporary.
+        bool is_pure{n->op != Op::call && n->op != Op::reduce &&
+                     n->op != Op::bind};
+        if (!n->args.empty() && is_constant && is_pure) {
+            // Leave an error to be reported when the statement runs.
+            if (is_defined(*n)) {
+                n = fold(*n);
+                return;
+            }
+        }
+
+        switch (n->op) {
+        case Op::neg: // --a
+            if (n->args[0]->op == Op::neg) {
+                n = std::move(n->args[0]->args[0]);
+            }
+            break;
+        case Op::mul: // a*1, 1*a
+            if (is_literal(*n->args[1], 1)) {
+                n = std::move(n->args[0]);
+            }
+            else if (is_literal(*n->args[0], 1)) {
+                n = std::move(n->args[1]);
+            }
+            break;
+        case Op::div: // a/1
+            if (is_literal(*n->args[1], 1)) {
+                n = std::move(n->args[0]);
+            }
+            break;
+        case Op::sub: // a-0
+            if (is_literal(*n->args[1], 0)) {
+                n = std::move(n->args[0]);
+            }
+            break;
+        case Op::pow: // a^1
+            // Only a^1 is exact: std::pow does not round a^2 as a*a does.
+            if (is_literal(*n->args[1], 1)) {
+                n = std::move(n->args[0]);
+            }
+            break;
+        case Op::abs: // abs(abs(a)), abs(-a)
+        {
+            Op op{n->args[0]->op};
+            if (op == Op::abs) {
+                n = std::move(n->args[0]);
+            }
+            else if (op == Op::neg) {
+                n->args[0] = std::move(n->args[0]->args[0]);
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    // @class Sharing
+    // @brief Finds subexpressions that occur more than once, and replaces
+    // each occurrence after the first with a temporary.
+    class Sharing {
+    public:
+        // Number the distinct subtrees of n; return the number of n.
+        int intern(const Node& n)
+        {
+            if (n.args.size() > 2) { // a call; it is not compared
+                for (const Node_ptr& arg : n.args) {
+                    int i{intern(*arg)};
+                    ++uses[i];
+                }
+                id[&n] = number();
+                return id[&n];
+            }
+            int a{n.args.size() > 0 ? intern(*n.args[0]) : -1};
+            int b{n.args.size() > 1 ? intern(*n.args[1]) : -1};
+            std::uint64_t bits;
+            // Calls of one function are alike, and so are reductions of
+            // one body.
+            if (n.op == Op::call || n.op == Op::reduce) {
+                bits = reinterpret_cast<std::uintptr_t>(n.callee.get());
+            }
+            else {
+                std::memcpy(&bits, &n.value, sizeof bits);
+            }
+            auto key = std::make_tuple(n.op, bits, n.slot, a, b);
+            auto i = ids.find(key);
+            if (i == ids.end()) {
+                i = ids.emplace(key, number()).first;
+                for (int arg : {a, b}) {
+                    if (arg >= 0) {
+                        ++uses[arg];
+                    }
+                }
+            }
+            id[&n] = i->second;
+            return i->second;
+        }
+
+        // Rewrite n, in evaluation order, to compute each shared
+        // subexpression once.
+        void share(Node_ptr& n)
+        {
+            int i{id.at(n.get())};
+            bool is_shared{uses[i] > 1 && !n->args.empty()};
+            if (is_shared && temp[i] >= 0) {
+                n = std::make_unique<Node>(Op::temp, temp[i]);
+                return;
+            }
+            for (Node_ptr& arg : n->args) {
+                share(arg);
+            }
+            if (is_shared) {
+                temp[i] = temps++;
+                n = std::make_unique<Node>(Op::bind, std::move(n));
+                n->slot = temp[i];
+            }
+        }
+
+        int temps{}; // temporaries allocated
+
+    private:
+        // Allocate the next number.
+        int number()
+        {
+            uses.push_back(0);
+            temp.push_back(-1);
+            return static_cast<int>(uses.size()) - 1;
+        }
+
+        std::map<std::tuple<Op, std::uint64_t, int, int, int>, int> ids;
+        std::unordered_map<const Node*, int> id; // the number of each node
+        std::vector<int> uses; // references to each number, from others
+        std::vector<int> temp; // the temporary each number is saved in
+    };
+}
+
+// Fold a statement's integer subexpressions exactly.
+void fold_integers(Statement& s, Symbol_table& table)
+{
+    fold_integers(s.expr, table);
+}
+
+// Optimise a statement's expression tree.
+int optimise(Statement& s, Symbol_table& table)
+{
+    int removed{size(*s.expr)};
+    fold_integers(s.expr, table);
+    removed -= size(*s.expr);
+    int temps{};
+    inline_calls(s.expr, temps);
+    int inlined{size(*s.expr)}; // the nodes inlining added are not counted
+    simplify(s.expr, table);
+
+    Sharing sharing;
+    sharing.temps = temps;
+    sharing.intern(*s.expr);
+    sharing.share(s.expr);
+    s.temps = sharing.temps;
+    return removed + inlined - size(*s.expr);
+}
+
+// Optimise and compile a function's body.
+static void compile(Function& f, Symbol_table& table)
+{
+    Statement body;
+    body.expr = clone(*f.body);
+    optimise(body, table);
+    f.temps = body.temps;
+    f.code = Expression{emit(*body.expr)};
+    f.optimised = std::move(body.expr);
+
+    collect_reads(*f.body, f.reads);
+}
+
+// Define a function.
+Error define(const Statement& s, Symbol_table& table)
+{
+    auto f = std::make_shared<Function>();
+    f->name = s.name;
+    f->parameters = s.parameters;
+    f->body = clone(*s.expr);
+    compile(*f, table);
+
+    std::vector<int> uses(f->arity());
+    count_uses(*f->optimised, uses);
+    f->is_inline = size(*f->optimised) <= max_inline &&
+                   std::find(uses.begin(), uses.end(), 0) == uses.end();
+
+    if (!table.define(std::move(f))) {
+        return Error{Errc::defined, 0, s.name};
+    }
+    return Error{};
+}
+
+// Compile the body of a reduction.
+std::shared_ptr<const Function> reduction_body(
+    Reduction kind, std::vector<std::string> parameters, Node_ptr body,
+    Symbol_table& table)
+{
+    auto f = std::make_shared<Function>();
+    f->name = std::string{reduction_names[static_cast<int>(kind)]};
+    f->parameters = std::move(parameters);
+    f->body = std::move(body);
+    compile(*f, table);
+    return f;
+}
+
+// Compile the expression a variable is bound to.
+std::shared_ptr<const Binding> binding(const Statement& s, Symbol_table& table)
+{
+    auto b = std::make_shared<Binding>();
+    b->expr = clone(*s.expr);
+    collect_reads(*b->expr, b->reads);
+
+    Statement expr;
+    expr.expr = clone(*s.expr);
+    optimise(expr, table);
+    b->code = Expression{emit(*expr.expr)};
+    return b;
+}
+
+// Find the slots an expression reads.
+void collect_reads(const Node& n, std::vector<int>& slots)
+{
+    if (n.op == Op::load) {
+        slots.push_back(n.slot);
+    }
+    else if (n.op == Op::call || n.op == Op::reduce) {
+        slots.insert(slots.end(), n.callee->reads.begin(),
+                     n.callee->reads.end());
+    }
+    for (const Node_ptr& arg : n.args) {
+        collect_reads(*arg, slots);
+    }
+}
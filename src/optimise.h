@@ -0,0 +1,80 @@
+// optimise.h: Expression tree optimiser interface.
+// SPDX-FileCopyrightText: © 2021-2022 Bradley M. Jones <brdjns@gmx.us>
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "ast.h"
+#include "reduce.h"
+#include "result.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+class Binding;
+class Symbol_table;
+
+// @brief Fold a statement's integer subexpressions exactly.
+// @details Operations on integer literals, and on variables declared const
+// that hold integers, are folded in 64-bit integer arithmetic where the
+// result is an integer that does not overflow; nothing else is changed.
+// Optimising a statement does this first, so a statement run as written
+// must have it done to compute what it would optimised.
+// @param s a compiled statement.
+// @param table the symbol table the statement was compiled against.
+void fold_integers(Statement& s, Symbol_table& table);
+
+// @brief Optimise a statement's expression tree.
+// @details Integer subexpressions are folded, as fold_integers folds them.
+// Calls of small functions are then replaced with their bodies.  Constants,
+// including variables declared const, are folded, in floating point, as
+// they would be computed; identities such as a*1, a/1 and a^1 are removed;
+// and subexpressions that occur more than once are computed once, into a
+// temporary.  Otherwise, rewrites that could change a result, or the error
+// it raises, are not made: a function is inlined only if its body uses
+// every argument.
+// @param s a compiled statement.
+// @param table the symbol table the statement was compiled against.
+// @return The number of nodes folding, removing identities and sharing
+// subexpressions removed from the tree; the nodes inlined bodies add are not
+// counted, so it is never negative.
+int optimise(Statement& s, Symbol_table& table);
+
+// @brief Define a function.
+// @details The body is optimised, with calls inlined, and compiled once; a
+// function whose optimised body is small and uses every parameter is marked
+// to be inlined where it is called.
+// @param s a function definition.
+// @param table the symbol table the definition was compiled against.
+// @return Errc::defined if the function's name is declared.
+Error define(const Statement& s, Symbol_table& table);
+
+// @brief Compile the body of a reduction.
+// @details The body is optimised, with calls inlined, and compiled once, as
+// a function's body is, when it is parsed; it is never inlined itself.
+// @param kind the reduction.
+// @param parameters the index, then the parameters of enclosing bodies that
+// the body reads.
+// @param body the body, as written.
+// @param table the symbol table the body was parsed against.
+// @return The body, as a function.
+std::shared_ptr<const Function> reduction_body(
+    Reduction kind, std::vector<std::string> parameters, Node_ptr body,
+    Symbol_table& table);
+
+// @brief Compile the expression a variable is bound to.
+// @details The expression is optimised, with calls inlined, and compiled
+// once, as a function's body is; it is kept as written, too, to be evaluated
+// in other number types.
+// @param s a bind statement, not yet optimised.
+// @param table the symbol table the statement was compiled against.
+// @return The binding.
+std::shared_ptr<const Binding> binding(const Statement& s,
+                                       Symbol_table& table);
+
+// @brief Find the variables an expression reads.
+// @details Variables read by the bodies of the functions it calls, and of the
+// reductions in it, count; slots may be repeated.
+// @param n an expression tree.
+// @param[out] slots the slots read, appended.
+void collect_reads(const Node& n, std::vector<int>& slots);
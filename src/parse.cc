@@ -5,223 +5,631 @@
 #include "parse.h"
 #include "error.h"
 #include "function.h"
+#include "integer.h"
+#include "optimise.h"
+#include "reduce.h"
 #include "symbol_table.h"
 #include "token.h"
+#include <algorithm>
+#include <optional>
 
-Symbol_table names;
-double expression(Token_stream& ts);
-
-// Match a token.
-void match(Token t, char c)
-{
-    if (t.kind != c)
-        error("expected ", c);
-}
+namespace {
+    // The error for an unexpected token t: code, unless t is not a token at
+    // all.
+    Error fail(const Token_stream& ts, Token t, Errc code,
+               std::string_view name = {})
+    {
+        if (t.kind == Symbol::error_tok) {
+            return Error{Errc::unrecognized_token, ts.position()};
+        }
+        return Error{code, ts.position(), name};
+    }
 
-// Construct a factor.
-double factor(Token_stream& ts)
-{
-    Token t{ts.get()};
+    // Match the next token.
+    Error match(Token_stream& ts, char c)
+    {
+        Token t{ts.get()};
+        if (t.kind == c) {
+            return Error{};
+        }
+        Error e{fail(ts, t, Errc::expected)};
+        e.expected = c;
+        return e;
+    }
 
-    switch (t.kind) {
-    case Symbol::lparen_tok:
+    // Construct an expression enclosed in brackets.
+    Result<Node_ptr> enclosed(Token_stream& ts, Symbol_table& table,
+                              char close)
     {
-        double temp{expression(ts)};
-        t = ts.get();
-        match(t, ')');
+        Result<Node_ptr> temp{expression(ts, table)};
+        if (!temp) {
+            return temp;
+        }
+        if (Error e = match(ts, close)) {
+            return e;
+        }
         return temp;
     }
-    case Symbol::lbrace_tok:
+
+    // Parse the arguments of a call after those in n, (..., a, b), up to
+    // the closing bracket.
+    Error more_arguments(Token_stream& ts, Symbol_table& table, Node& n)
     {
-        double temp{expression(ts)};
-        t = ts.get();
-          match(t, '}');
-        return temp;
+        Token t{ts.get()};
+        while (t.kind == Symbol::comma_tok) {
+            Result<Node_ptr> arg{expression(ts, table)};
+            if (!arg) {
+                return arg.error();
+            }
+            n.args.push_back(std::move(*arg));
+            t = ts.get();
+        }
+        if (t.kind != Symbol::rparen_tok) {
+            Error e{fail(ts, t, Errc::expected)};
+            e.expected = ')';
+            return e;
+        }
+        return Error{};
     }
-    case lbrack_tok:
+
+    // Parse the arguments of a call, (a, b, ...), into n.
+    Error arguments(Token_stream& ts, Symbol_table& table, Node& n)
     {
-        double temp{expression(ts)};
-        t = ts.get();
-        match(t, ']');
-        return temp;
+        if (Error e = match(ts, '(')) {
+            return e;
+        }
+        Token t{ts.get()};
+        if (t.kind == Symbol::rparen_tok) {
+            return Error{};
+        }
+        ts.putback(t);
+        Result<Node_ptr> arg{expression(ts, table)};
+        if (!arg) {
+            return arg.error();
+        }
+        n.args.push_back(std::move(*arg));
+        return more_arguments(ts, table, n);
     }
-    case sqrt_tok: // sqrt(a)
+
+    // Construct a call of a user-defined function, f(a, b, ...).
+    Result<Node_ptr> apply(Token_stream& ts, Symbol_table& table,
+                           std::shared_ptr<const Function> f)
     {
-        t = ts.get();
-        match(t, '(');
-        double temp{expression(ts)};
-        if (temp < 0) {
-            error("domain error");
+        auto n = std::make_unique<Node>(std::move(f));
+        if (Error e = arguments(ts, table, *n)) {
+            return e;
+        }
+        if (n->args.size() != n->callee->arity()) {
+            return Error{Errc::arguments, ts.position(), n->callee->name};
         }
-        t = ts.get();
-        match(t, ')');
-        return std::sqrt(temp);
+        return n;
     }
-    case abs_tok: // abs(a)
+
+    // Construct a reference to the parameter or variable a name names, or
+    // null if it names neither.
+    Node_ptr reference(Symbol_table& table, std::string_view name)
     {
-        t = ts.get();
-        match(t, '(');
-        double temp = expression(ts);
-        t = ts.get();
-        match(t, ')');
-        return std::abs(temp);
+        if (table.scope) {
+            int i{table.scope->find(name)};
+            if (i >= 0) {
+                return std::make_unique<Node>(Op::arg, i);
+            }
+        }
+        int slot{table.find(name)};
+        if (slot >= 0) {
+            return std::make_unique<Node>(Op::load, slot);
+        }
+        return nullptr;
     }
-    case minus_tok: // -a
-        return -factor(ts);
-    case plus_tok: // +a
-        return factor(ts);
-    case number_tok: // [.0-9]
-        return t.value;
-    case ident_tok: // [a-zA-Z_]
-        return names.get(t.name);
-    default:
-        error("factor expected");
+
+    // Construct the factor an identifier starts: a parameter, a variable,
+    // or a call of a user-defined function.
+    Result<Node_ptr> identifier(Token_stream& ts, Symbol_table& table,
+                                std::string_view name)
+    {
+        if (Node_ptr n{reference(table, name)}) {
+            return n;
+        }
+        if (std::shared_ptr<const Function> f{table.function(name)}) {
+            return apply(ts, table, std::move(f));
+        }
+        return Error{Errc::undefined, ts.position(), name};
     }
 
-    return 0; // never reached
-}
+    // Combine left with the operand right by op.
+    Error combine(Result<Node_ptr>& left, Op op, Result<Node_ptr> right)
+    {
+        if (!right) {
+            return right.error();
+        }
+        *left = std::make_unique<Node>(op, std::move(*left),
+                                       std::move(*right));
+        return Error{};
+    }
 
-// Construct a power expression.
-double power_expression(Token_stream& ts)
-{
-    double left{factor(ts)};
-    Token t{ts.get()};
+    // Continue a power expression whose base, left, has been parsed.
+    Result<Node_ptr> power_rest(Token_stream& ts, Symbol_table& table,
+                                Result<Node_ptr> left)
+    {
+        if (!left) {
+            return left;
+        }
+        Token t{ts.get()};
 
-    for (;;) {
         switch (t.kind) {
         case Symbol::bang_tok: // a!
-        {
-            int temp = narrow_cast<int>(left);
-            if (temp < 0) {
-                error("domain error");
-            }
-            return left = fn_factorial(temp);
-            break;
-        }
+            return std::make_unique<Node>(Op::fact, std::move(*left));
         case Symbol::caret_tok: // a^b
-        {
-            double temp{factor(ts)};
-            return left = std::pow(left, temp);
-            t = ts.get();
-            break;
-        }
+            if (Error e = combine(left, Op::pow, factor(ts, table))) {
+                return e;
+            }
+            return left;
         default:
             ts.putback(t);
             return left;
         }
     }
-}
 
-// Construct a term.
-double term(Token_stream& ts)
-{
-    double left{power_expression(ts)};
+    // Continue a term whose first operand, left, has been parsed.
+    Result<Node_ptr> term_rest(Token_stream& ts, Symbol_table& table,
+                               Result<Node_ptr> left)
+    {
+        while (left) {
+            Token t{ts.get()};
+            Op op;
+            switch (t.kind) {
+            case Symbol::mul_tok: // a*b
+                op = Op::mul;
+                break;
+            case div_tok: // a/b
+                op = Op::div;
+                break;
+            case Symbol::mod_tok: // a%b is defined for floats
+                op = Op::mod;
+                break;
+            default:
+                ts.putback(t);
+                return left;
+            }
+            if (Error e = combine(left, op, power_expression(ts, table))) {
+                return e;
+            }
+        }
+        return left;
+    }
+
+    // Continue an expression whose first term, left, has been parsed.
+    Result<Node_ptr> expression_rest(Token_stream& ts, Symbol_table& table,
+                                     Result<Node_ptr> left)
+    {
+        while (left) {
+            Token t{ts.get()};
+            Op op;
+            switch (t.kind) {
+            case Symbol::plus_tok: // a+b
+                op = Op::add;
+                break;
+            case Symbol::minus_tok: // a-b
+                op = Op::sub;
+                break;
+            default:
+                ts.putback(t);
+                return left;
+            }
+            if (Error e = combine(left, op, term(ts, table))) {
+                return e;
+            }
+        }
+        return left;
+    }
 
-    for (;;) {
+    // Construct a reduction, f(i, a, b, body), whose index i and first
+    // bound a have been parsed.  The body is parsed with i in scope, and
+    // compiled now; the parameters of enclosing bodies that it reads become
+    // its own, passed as arguments after the bounds.
+    Result<Node_ptr> reduction(Token_stream& ts, Symbol_table& table,
+                               Reduction kind, std::string index,
+                               Node_ptr from)
+    {
+        Result<Node_ptr> to{expression(ts, table)};
+        if (!to) {
+            return to;
+        }
         Token t{ts.get()};
-        switch (t.kind) {
-        case Symbol::mul_tok: // a*b
-            left *= power_expression(ts);
-            break;
-        case div_tok: // a/b
-        {
-            double temp{power_expression(ts)};
-            if (temp == 0) {
-                error("division by zero");
+        if (t.kind == Symbol::rparen_tok) {
+            return Error{Errc::arguments, ts.position(),
+                         reduction_names[static_cast<int>(kind)]};
+        }
+        if (t.kind != Symbol::comma_tok) {
+            Error e{fail(ts, t, Errc::expected)};
+            e.expected = ',';
+            return e;
+        }
+        Scope scope{{std::move(index)}, table.scope};
+        table.scope = &scope;
+        Result<Node_ptr> body{expression(ts, table)};
+        table.scope = scope.outer;
+        if (!body) {
+            return body;
+        }
+        if (Error e = match(ts, ')')) {
+            return e;
+        }
+
+        auto n = std::make_unique<Node>(Op::reduce, static_cast<int>(kind));
+        n->args.push_back(std::move(from));
+        n->args.push_back(std::move(*to));
+        for (std::size_t i = 1; i < scope.names.size(); ++i) {
+            n->args.push_back(std::make_unique<Node>(
+                Op::arg, scope.outer->find(scope.names[i])));
+        }
+        n->callee = reduction_body(kind, std::move(scope.names),
+                                   std::move(*body), table);
+        return n;
+    }
+
+    // Construct a reduction named by a keyword, sum(i, a, b, body),
+    // prod(i, a, b, body) or mean(i, a, b, body).
+    Result<Node_ptr> reduce(Token_stream& ts, Symbol_table& table,
+                            Reduction kind)
+    {
+        if (Error e = match(ts, '(')) {
+            return e;
+        }
+        Token t{ts.get()};
+        if (t.kind != Symbol::ident_tok) {
+            return fail(ts, t, Errc::declaration_name);
+        }
+        std::string index{t.name};
+        if (Error e = match(ts, ',')) {
+            return e;
+        }
+        Result<Node_ptr> from{expression(ts, table)};
+        if (!from) {
+            return from;
+        }
+        if (Error e = match(ts, ',')) {
+            return e;
+        }
+        return reduction(ts, table, kind, std::move(index), std::move(*from));
+    }
+
+    // Find the reduction that shares a built-in function's name, if any.
+    std::optional<Reduction> reduction_named(std::string_view name)
+    {
+        for (std::size_t i = 0; i < reduction_count; ++i) {
+            if (reduction_names[i] == name) {
+                return static_cast<Reduction>(i);
+            }
+        }
+        return std::nullopt;
+    }
+
+    // Construct min(a, b) or max(a, b), or the reduction of the same name,
+    // min(i, a, b, body) or max(i, a, b, body).  Which is meant is known
+    // once an identifier that starts the arguments is followed by a comma,
+    // and the second argument by another comma rather than a bracket.
+    Result<Node_ptr> extremum(Token_stream& ts, Symbol_table& table, int id,
+                              Reduction kind)
+    {
+        const Builtin& f{builtins[id]};
+        if (Error e = match(ts, '(')) {
+            return e;
+        }
+        auto n = std::make_unique<Node>(f.op, id);
+        Token t{ts.get()};
+        Result<Node_ptr> a;
+        if (t.kind == Symbol::ident_tok) {
+            std::string index{t.name};
+            Token t2{ts.get()};
+            if (t2.kind == Symbol::comma_tok) {
+                Result<Node_ptr> b{expression(ts, table)};
+                if (!b) {
+                    return b;
+                }
+                Token t3{ts.get()};
+                if (t3.kind == Symbol::comma_tok) {
+                    return reduction(ts, table, kind, std::move(index),
+                                     std::move(*b));
+                }
+                ts.putback(t3);
+                Node_ptr first{reference(table, index)};
+                if (!first) {
+                    if (table.function(index)) { // a call must follow
+                        Error e{Errc::expected, ts.position()};
+                        e.expected = '(';
+                        return e;
+                    }
+                    return Error{Errc::undefined, ts.position(), index};
+                }
+                n->args.push_back(std::move(first));
+                n->args.push_back(std::move(*b));
             }
-            left /= temp;
-            break;
-        }
-        case Symbol::mod_tok: // a%b is defined for floats
-        {
-            double temp{power_expression(ts)};
-            if (temp == 0) {
-                error("modulo division by zero");
+            else {
+                ts.putback(t2);
+                a = expression_rest(
+                    ts, table,
+                    term_rest(ts, table,
+                              power_rest(ts, table,
+                                         identifier(ts, table, index))));
             }
-            left = std::fmod(left, temp);
-            break;
         }
-        default:
+        else if (t.kind != Symbol::rparen_tok) {
             ts.putback(t);
-            return left;
+            a = expression(ts, table);
+        }
+        if (!a) {
+            return a;
+        }
+        if (*a) {
+            n->args.push_back(std::move(*a));
+        }
+        if (t.kind != Symbol::rparen_tok) {
+            if (Error e = more_arguments(ts, table, *n)) {
+                return e;
+            }
+        }
+        if (n->args.size() != static_cast<std::size_t>(f.arity)) {
+            return Error{Errc::arguments, ts.position(), f.name};
+        }
+        return n;
+    }
+
+    // Construct a call of the built-in function numbered id, f(a) or
+    // f(a, b).
+    Result<Node_ptr> builtin(Token_stream& ts, Symbol_table& table, int id)
+    {
+        const Builtin& f{builtins[id]};
+        if (std::optional<Reduction> kind{reduction_named(f.name)}) {
+            return extremum(ts, table, id, *kind);
+        }
+        auto n = std::make_unique<Node>(f.op, f.op == Op::builtin ? id : -1);
+        if (Error e = arguments(ts, table, *n)) {
+            return e;
+        }
+        if (n->args.size() != static_cast<std::size_t>(f.arity)) {
+            return Error{Errc::arguments, ts.position(), f.name};
         }
+        return n;
     }
 }
 
-// Construct an expression.
-double expression(Token_stream& ts)
+// Construct a factor.
+Result<Node_ptr> factor(Token_stream& ts, Symbol_table& table)
 {
-    double left{term(ts)};
     Token t{ts.get()};
 
-    for (;;) {
-        switch (t.kind) {
-        case Symbol::plus_tok: // a+b
-            left += term(ts);
-            t = ts.get();
-            break;
-        case Symbol::minus_tok: // a-b
-            left -= term(ts);
-            t = ts.get();
-            break;
-        default:
-            ts.putback(t);
-            return left;
+    switch (t.kind) {
+    case Symbol::lparen_tok:
+        return enclosed(ts, table, ')');
+    case Symbol::lbrace_tok:
+        return enclosed(ts, table, '}');
+    case lbrack_tok:
+        return enclosed(ts, table, ']');
+    case builtin_tok: // f(a) or f(a, b)
+        return builtin(ts, table, static_cast<int>(t.value));
+    case reduce_tok: // sum(i, a, b, f)
+        return reduce(ts, table, static_cast<Reduction>(t.value));
+    case minus_tok: // -a
+    {
+        Result<Node_ptr> temp{factor(ts, table)};
+        if (!temp) {
+            return temp;
+        }
+        return std::make_unique<Node>(Op::neg, std::move(*temp));
+    }
+    case plus_tok: // +a
+        return factor(ts, table);
+    case number_tok: // [.0-9]
+    {
+        auto n = std::make_unique<Node>(t.value);
+        if (!is_exact_integer(t.value)) {
+            n->text = std::string{t.name};
         }
+        return n;
+    }
+    case ident_tok: // [a-zA-Z_]
+        return identifier(ts, table, t.name);
+    default:
+        return fail(ts, t, Errc::factor_expected);
     }
 }
 
+// Construct a power expression.
+Result<Node_ptr> power_expression(Token_stream& ts, Symbol_table& table)
+{
+    return power_rest(ts, table, factor(ts, table));
+}
+
+// Construct a term.
+Result<Node_ptr> term(Token_stream& ts, Symbol_table& table)
+{
+    return term_rest(ts, table, power_expression(ts, table));
+}
+
+// Construct an expression.
+Result<Node_ptr> expression(Token_stream& ts, Symbol_table& table)
+{
+    return expression_rest(ts, table, term(ts, table));
+}
+
 // Declare a variable.
-double declaration(Token_stream& ts, bool is_const)
+Result<Statement> declaration(Token_stream& ts, Symbol_table& table,
+                              Stmt kind)
 {
     Token t{ts.get()};
     if (t.kind != Symbol::ident_tok) {
-        error("identifier missing in declaration");
+        return fail(ts, t, Errc::declaration_name);
     }
-    std::string name{t.name};
+    Statement s;
+    s.kind = kind;
+    s.name = std::string{t.name};
 
     Token t2{ts.get()};
     if (t2.kind != Symbol::equals_tok) {
-        error("'=' missing in declaration of ", name);
+        return fail(ts, t2, Errc::declaration_equals, s.name);
     }
 
-    double value{expression(ts)};
-    names.declare(name, value, is_const);
-    return value;
+    Result<Node_ptr> expr{expression(ts, table)};
+    if (!expr) {
+        return expr.error();
+    }
+    s.expr = std::move(*expr);
+    return s;
 }
 
 // Deal with assignments.
-double assignment(Token_stream& ts)
+Result<Statement> assignment(Token_stream& ts, Symbol_table& table)
 {
     Token t{ts.get()};
     if (t.kind != Symbol::ident_tok) {
-        error("identifier missing in assignment");
+        return fail(ts, t, Errc::assignment_name);
     }
-    std::string name{t.name};
+    Statement s;
+    s.kind = Stmt::set;
+    s.name = std::string{t.name};
 
     Token t2{ts.get()};
     if (t2.kind != Symbol::equals_tok) {
-        error("'=' missing in assignment of ", name);
+        return fail(ts, t2, Errc::assignment_equals, s.name);
+    }
+    Result<Node_ptr> expr{expression(ts, table)};
+    if (!expr) {
+        return expr.error();
     }
-    double value{expression(ts)};
-    names.set(name, value);
-    return value;
+    s.expr = std::move(*expr);
+    return s;
+}
+
+// Define a function.
+Result<Statement> definition(Token_stream& ts, Symbol_table& table)
+{
+    Token t{ts.get()};
+    if (t.kind != Symbol::ident_tok) {
+        return fail(ts, t, Errc::declaration_name);
+    }
+    Statement s;
+    s.kind = Stmt::function;
+    s.name = std::string{t.name};
+
+    if (Error e = match(ts, '(')) {
+        return e;
+    }
+    Token p{ts.get()};
+    if (p.kind != Symbol::rparen_tok) {
+        ts.putback(p);
+        do {
+            p = ts.get();
+            if (p.kind != Symbol::ident_tok) {
+                return fail(ts, p, Errc::declaration_name);
+            }
+            if (std::find(s.parameters.begin(), s.parameters.end(),
+                          p.name) != s.parameters.end()) {
+                return Error{Errc::defined, ts.position(), p.name};
+            }
+            s.parameters.push_back(std::string{p.name});
+            p = ts.get();
+        } while (p.kind == Symbol::comma_tok);
+        if (p.kind != Symbol::rparen_tok) {
+            Error e{fail(ts, p, Errc::expected)};
+            e.expected = ')';
+            return e;
+        }
+    }
+
+    Token t2{ts.get()};
+    if (t2.kind != Symbol::equals_tok) {
+        return fail(ts, t2, Errc::declaration_equals, s.name);
+    }
+
+    Scope scope{s.parameters, nullptr};
+    table.scope = &scope;
+    Result<Node_ptr> expr{expression(ts, table)};
+    table.scope = nullptr;
+    if (!expr) {
+        return expr.error();
+    }
+    s.expr = std::move(*expr);
+    return s;
+}
+
+// Name the file a snapshot is saved to or loaded from.
+Result<Statement> snapshot(Token_stream& ts, Stmt kind)
+{
+    Token t{ts.get()};
+    if (t.kind != Symbol::string_tok) {
+        return fail(ts, t, Errc::file_name);
+    }
+    Statement s;
+    s.kind = kind;
+    s.name = std::string{t.name};
+    return s;
 }
 
 // Deal with statements.
-double statement(Token_stream& ts)
+Result<Statement> statement(Token_stream& ts, Symbol_table& table)
 {
     Token t{ts.get()};
+    Result<Statement> s;
 
     switch (t.kind) {
     case Symbol::let_tok:
-        return declaration(ts, false);
+        s = declaration(ts, table, Stmt::let);
+        break;
     case Symbol::const_tok:
-        return declaration(ts, true);
+        s = declaration(ts, table, Stmt::constant);
+        break;
+    case Symbol::bind_tok:
+        s = declaration(ts, table, Stmt::bind);
+        break;
     case Symbol::set_tok:
-        return assignment(ts);
+        s = assignment(ts, table);
+        break;
+    case Symbol::fn_tok:
+        s = definition(ts, table);
+        break;
+    case Symbol::save_tok:
+        s = snapshot(ts, Stmt::save);
+        break;
+    case Symbol::load_tok:
+        s = snapshot(ts, Stmt::load);
+        break;
     default:
+    {
         ts.putback(t);
-        return expression(ts);
+        Result<Node_ptr> expr{expression(ts, table)};
+        if (!expr) {
+            return expr.error();
+        }
+        s->expr = std::move(*expr);
+        break;
+    }
+    }
+    if (!s) {
+        return s;
+    }
+
+    // A statement ends before the first token that cannot continue it, and
+    // that token must at least be a token.
+    t = ts.get();
+    ts.putback(t);
+    if (t.kind == Symbol::error_tok) {
+        return Error{Errc::unrecognized_token, ts.position()};
+    }
+    return s;
+}
+
+// Compile a statement from source text.
+Statement compile(const std::string& src, Symbol_table& table)
+{
+    Token_stream ts{std::string_view{src}};
+    Result<Statement> s{statement(ts, table)};
+    if (!s) {
+        error(s.error());
+    }
+    Token t{ts.get()};
+    if (t.kind != Symbol::print_tok && t.kind != Symbol::quit_tok) {
+        error(fail(ts, t, Errc::semicolon_expected));
     }
+    return std::move(*s);
 }
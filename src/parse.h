@@ -4,68 +4,94 @@
 
 #pragma once
 
+#include "ast.h"
+#include "result.h"
 #include "token.h"
 #include <cmath>
 #include <cstdlib>
 #include <iostream>
-#include <limits>
-#include <stdexcept>
 #include <string>
 #include <vector>
 
-// @brief Cast a wider type to a narrower type.
-// @param a a narrower type
-// @return the value of the narrower type specified
-template<class R, class A>
-R narrow_cast(const A& a)
-{
-    R r = R(a);
-    if (A(r) != a)
-        throw std::runtime_error("information loss");
-    return r;
-}
+class Symbol_table;
 
 // @brief Construct an expression.
 // @pre A term.
 // @param ts a stream of tokens.
-// @return An expression.
-double expression(Token_stream& ts);
+// @param table the symbol table that variables are resolved in.
+// @return An expression tree, or the first syntax error.
+Result<Node_ptr> expression(Token_stream& ts, Symbol_table& table);
 
 // @brief Construct a term.
 // @pre A factor.
 // @param ts a stream of tokens.
-// @return A term.
-// @throws std::runtime_error for division by zero.
-double term(Token_stream& ts);
+// @param table the symbol table that variables are resolved in.
+// @return A term, or the first syntax error.
+Result<Node_ptr> term(Token_stream& ts, Symbol_table& table);
 
 // @brief Construct a factor.
+// @details The body of a reduction, such as sum(i, a, b, f), is compiled as
+// it is parsed; within it, the index hides variables and functions of the
+// same name.  min and max with four arguments are reductions too.
 // @pre A token that is a number or parentheses.
 // @param ts a stream of tokens.
-// @return A factor.
-// @throws std::runtime_error if next token is not an expression.
-double factor(Token_stream& ts);
+// @param table the symbol table that variables are resolved in.
+// @return A factor; Errc::factor_expected if the next token is not an
+// expression, Errc::undefined if a variable or function is undefined, or
+// Errc::arguments if a function is called with the wrong number of
+// arguments.
+Result<Node_ptr> factor(Token_stream& ts, Symbol_table& table);
 
 // @brief Construct a power expression.
 // @pre A factor.
 // @param ts a stream of tokens.
-// @return A power expression.
-double power_expression(Token_stream& ts);
+// @param table the symbol table that variables are resolved in.
+// @return A power expression, or the first syntax error.
+Result<Node_ptr> power_expression(Token_stream& ts, Symbol_table& table);
 
-// @brief Turn a declaration into a statement.
+// @brief Compile a statement.
 // @param ts a stream of tokens.
-// @return Either a declaration or a statement.
-double statement(Token_stream& ts);
+// @param table the symbol table that variables are resolved in.
+// @return Either a declaration, an assignment, a function definition, a save
+// or load, or an expression statement, or the first syntax error.
+Result<Statement> statement(Token_stream& ts, Symbol_table& table);
 
 // @brief Parse declaration statements.
 // @param ts a stream of tokens.
-// @param is_const true if identifier is a constant; false otherwise.
-// @throws std::runtime_error if the variable name is missing in a declaration.
-// @throws std::runtime_error if '=' is missing in a declaration.
-// @return An expression that is the value of the variable.
-double declaration(Token_stream& ts, bool is_const);
+// @param table the symbol table that variables are resolved in.
+// @param kind Stmt::let, Stmt::constant or Stmt::bind.
+// @return A declaration statement; Errc::declaration_name if the variable
+// name is missing, or Errc::declaration_equals if '=' is missing.
+Result<Statement> declaration(Token_stream& ts, Symbol_table& table,
+                              Stmt kind);
 
 // @brief Parse assignment expressions.
 // @param ts a stream of tokens.
-// @throws std::runtime_error if the variable is undefined.
-// @return The variable's value.
-double assignment(Token_stream& ts);
+// @param table the symbol table that variables are resolved in.
+// @return An assignment statement; Errc::assignment_name if the variable
+// name is missing, or Errc::assignment_equals if '=' is missing.
+Result<Statement> assignment(Token_stream& ts, Symbol_table& table);
+
+// @brief Parse function definitions.
+// @details Within the body, the parameters hide variables and functions of
+// the same name.
+// @param ts a stream of tokens.
+// @param table the symbol table that names are resolved in.
+// @return A definition; Errc::declaration_name if the function or a
+// parameter name is missing, Errc::defined if a parameter is repeated, or
+// Errc::declaration_equals if '=' is missing.
+Result<Statement> definition(Token_stream& ts, Symbol_table& table);
+
+// @brief Parse save and load statements.
+// @param ts a stream of tokens.
+// @param kind Stmt::save or Stmt::load.
+// @return The statement, naming the file; Errc::file_name if the quoted file
+// name is missing.
+Result<Statement> snapshot(Token_stream& ts, Stmt kind);
+
+// @brief Compile a statement from source text.
+// @param src a single statement, optionally terminated by ';'.
+// @param table the symbol table that variables are resolved in.
+// @throws std::runtime_error if src is not a single statement.
+// @return The compiled statement.
+Statement compile(const std::string& src, Symbol_table& table);
@@ -0,0 +1,467 @@
+// profile.cc: Subexpression profiler.
+// SPDX-FileCopyrightText: © 2021-2022 Bradley M. Jones <brdjns@gmx.us>
+// SPDX-License-Identifier: MIT
+
+#include "profile.h"
+#include "format.h"
+#include "function.h"
+#include "stats.h"
+#include "symbol_table.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <map>
+
+namespace {
+    // Binding strengths, as in the grammar: a subexpression is parenthesised
+    // where it appears as an operand that binds more tightly.
+    constexpr int expression_level{1}; // a+b, a-b
+    constexpr int term_level{2};       // a*b, a/b, a%b
+    constexpr int power_level{3};      // a^b, a!
+    constexpr int factor_level{4};     // -a
+    constexpr int primary_level{5};    // literals, variables, functions
+
+    // The binding strength of an operation.
+    int level(Op op)
+    {
+        switch (op) {
+        case Op::add:
+        case Op::sub:
+            return expression_level;
+        case Op::mul:
+        case Op::div:
+        case Op::mod:
+            return term_level;
+        case Op::pow:
+        case Op::fact:
+            return power_level;
+        case Op::neg:
+            return factor_level;
+        default:
+            return primary_level;
+        }
+    }
+
+    // The shortest decimal form of v that reads back as v.
+    std::string number(double v)
+    {
+        char buf[max_number_size];
+        return std::string(buf, format_number(buf, buf + sizeof buf, v, {}));
+    }
+
+    std::string render(const Node& n, const Symbol_table& table);
+
+    // Render an operand, parenthesised if it binds less tightly than min.
+    std::string operand(const Node& n, const Symbol_table& table, int min)
+    {
+        std::string text{render(n, table)};
+        return level(n.op) < min ? "(" + text + ")" : text;
+    }
+
+    // Render a binary operation.
+    std::string binary(const Node& n, const Symbol_table& table,
+                       const char* op)
+    {
+        int l{level(n.op)};
+        bool is_power{n.op == Op::pow};
+        return operand(*n.args[0], table, is_power ? factor_level : l) + op +
+               operand(*n.args[1], table, is_power ? factor_level : l + 1);
+    }
+
+    // Render an expression tree as source text.
+    std::string render(const Node& n, const Symbol_table& table)
+    {
+        switch (n.op) {
+        case Op::number:
+            return number(n.value);
+        case Op::load:
+            return table.var_table[n.slot].name;
+        case Op::neg:
+            return "-" + operand(*n.args[0], table, factor_level);
+        case Op::add:
+            return binary(n, table, " + ");
+        case Op::sub:
+            return binary(n, table, " - ");
+        case Op::mul:
+            return binary(n, table, " * ");
+        case Op::div:
+            return binary(n, table, " / ");
+        case Op::mod:
+            return binary(n, table, " % ");
+        case Op::pow:
+            return binary(n, table, "^");
+        case Op::fact:
+            return operand(*n.args[0], table, factor_level) + "!";
+        case Op::sqrt:
+            return "sqrt(" + render(*n.args[0], table) + ")";
+        case Op::abs:
+            return "abs(" + render(*n.args[0], table) + ")";
+        case Op::builtin:
+        case Op::call:
+        {
+            std::string text{n.op == Op::builtin
+                                 ? std::string{builtins[n.slot].name}
+                                 : n.callee->name};
+            text += "(";
+            for (std::size_t i = 0; i < n.args.size(); ++i) {
+                text += (i == 0 ? "" : ", ") + render(*n.args[i], table);
+            }
+            return text + ")";
+        }
+        case Op::reduce: // the index is the body's first parameter, $1
+            return std::string{reduction_names[n.slot]} + "($1, " +
+                   render(*n.args[0], table) + ", " +
+                   render(*n.args[1], table) + ", " +
+                   render(*n.callee->body, table) + ")";
+        case Op::bind:
+            return render(*n.args[0], table);
+        case Op::temp:
+            return "t" + std::to_string(n.slot);
+        case Op::arg:
+            return "$" + std::to_string(n.slot + 1);
+        }
+        return ""; // never reached
+    }
+
+    // The cycles a timed operation would be charged if it took none: the
+    // cost of reading the cycle counter.
+    std::uint64_t timer_overhead()
+    {
+        static const std::uint64_t overhead{[] {
+            std::uint64_t least{~std::uint64_t{0}};
+            for (int i = 0; i < 1000; ++i) {
+                std::uint64_t start{cycle_count()};
+                least = std::min(least, cycle_count() - start);
+            }
+            return least;
+        }()};
+        return overhead;
+    }
+
+    // Add the sites of n and its operands, in the order they are entered,
+    // and record the site of each instruction in the order emitted.
+    void add_sites(const Node& n, const Symbol_table& table, int parent,
+                   int depth, Profiled_statement& p)
+    {
+        int self{static_cast<int>(p.sites.size())};
+        p.sites.push_back(
+            Profiled_statement::Site{render(n, table), parent, depth});
+        for (const Node_ptr& arg : n.args) {
+            add_sites(*arg, table, self, depth + 1, p);
+        }
+        p.site.push_back(self);
+    }
+}
+
+// Prepare to profile a statement.
+Profiled_statement::Profiled_statement(const Statement& s, Program p,
+                                       Symbol_table& table)
+    : program{std::move(p)}
+{
+    std::string expr{render(*s.expr, table)};
+    switch (s.kind) {
+    case Stmt::expression: // the statement is its expression
+        add_sites(*s.expr, table, -1, 0, *this);
+        text = expr;
+        break;
+    case Stmt::let:
+        text = "let " + s.name + " = " + expr;
+        break;
+    case Stmt::constant:
+        text = "const " + s.name + " = " + expr;
+        break;
+    case Stmt::set:
+        text = "set " + s.name + " = " + expr;
+        break;
+    case Stmt::bind:
+        text = "bind " + s.name + " = " + expr;
+        break;
+    case Stmt::function:
+        text = "fn " + s.name + "(";
+        for (std::size_t i = 0; i < s.parameters.size(); ++i) {
+            text += (i == 0 ? "" : ", ") + s.parameters[i];
+        }
+        text += ") = " + expr;
+        break;
+    case Stmt::save: // never profiled: they have no expression
+    case Stmt::load:
+        break;
+    }
+    if (s.kind != Stmt::expression) {
+        sites.push_back(Site{text, -1, 0});
+        add_sites(*s.expr, table, 0, 1, *this);
+    }
+    while (site.size() < program.code.size()) {
+        site.push_back(0); // store and ret
+    }
+    frame.resize(program.depth + program.temps);
+}
+
+// Run the statement, counting cycles.
+Result<double> Profiled_statement::run(double* slots)
+{
+    double* stack{frame.data()};
+    double* temps{stack + program.depth};
+    double* sp{stack - 1};
+    const double* constants{program.constants.data()};
+    const std::uint64_t overhead{timer_overhead()};
+
+    for (std::size_t k = 0;; ++k) {
+        const Instruction& i{program.code[k]};
+        std::uint64_t start{cycle_count()};
+        switch (i.op) {
+        case Opcode::push:
+            *++sp = constants[i.arg];
+            break;
+        case Opcode::load:
+            *++sp = slots[i.arg];
+            break;
+        case Opcode::store:
+            slots[i.arg] = *sp;
+            break;
+        case Opcode::neg:
+            *sp = -*sp;
+            break;
+        case Opcode::add:
+            --sp;
+            *sp += sp[1];
+            break;
+        case Opcode::sub:
+            --sp;
+            *sp -= sp[1];
+            break;
+        case Opcode::mul:
+            --sp;
+            *sp *= sp[1];
+            break;
+        case Opcode::div:
+            --sp;
+            if (sp[1] == 0) {
+                return Error{Errc::division_by_zero};
+            }
+            *sp /= sp[1];
+            break;
+        case Opcode::mod: // a%b is defined for floats
+            --sp;
+            if (sp[1] == 0) {
+                return Error{Errc::modulo_by_zero};
+            }
+            *sp = std::fmod(*sp, sp[1]);
+            break;
+        case Opcode::pow:
+            --sp;
+            *sp = std::pow(*sp, sp[1]);
+            break;
+        case Opcode::fact:
+        {
+            Errc err{factorial_domain(*sp)};
+            if (err != Errc::none) {
+                return Error{err};
+            }
+            *sp = fn_factorial(*sp);
+            break;
+        }
+        case Opcode::sqrt:
+            if (*sp < 0) {
+                return Error{Errc::domain_error};
+            }
+            *sp = std::sqrt(*sp);
+            break;
+        case Opcode::abs:
+            *sp = std::abs(*sp);
+            break;
+        case Opcode::builtin:
+        {
+            const Builtin& f{builtins[i.arg]};
+            sp -= f.arity - 1;
+            Errc err{Errc::none};
+            *sp = call_builtin(f, *sp, sp[f.arity - 1], err);
+            if (err != Errc::none) {
+                return Error{err};
+            }
+            break;
+        }
+        case Opcode::tee:
+            temps[i.arg] = *sp;
+            break;
+        case Opcode::temp:
+            *++sp = temps[i.arg];
+            break;
+        case Opcode::call: // charged with the whole of the call
+        {
+            const Function& f{*program.callees[i.arg]};
+            sp -= static_cast<int>(f.arity()) - 1;
+            Result<double> value{try_call(f, slots, sp)};
+            if (!value) {
+                return value;
+            }
+            *sp = *value;
+            break;
+        }
+        case Opcode::arg: // a statement is not a function body
+            *++sp = 0;
+            break;
+        case Opcode::sum: // charged with the whole of the range
+        case Opcode::prod:
+        case Opcode::min:
+        case Opcode::max:
+        case Opcode::mean:
+        {
+            const Function& f{*program.callees[i.arg]};
+            sp -= static_cast<int>(f.arity());
+            Result<double> value{try_reduce(reduction(i.op), f, slots, sp)};
+            if (!value) {
+                return value;
+            }
+            *sp = *value;
+            break;
+        }
+        case Opcode::ret:
+            return *sp;
+        }
+        std::uint64_t elapsed{cycle_count() - start};
+        Site& s{sites[site[k]]};
+        s.self += elapsed > overhead ? elapsed - overhead : 0;
+        ++s.calls;
+    }
+}
+
+// Add another profile of the same statement to this one.
+void Profiled_statement::merge(const Profiled_statement& other)
+{
+    for (std::size_t i = 0; i < sites.size(); ++i) {
+        sites[i].self += other.sites[i].self;
+        sites[i].calls += other.sites[i].calls;
+    }
+}
+
+// Compute the cycles spent in each site and the sites within it.
+void Profiled_statement::sum_totals()
+{
+    for (Site& s : sites) {
+        s.total = s.self;
+    }
+    for (std::size_t i = sites.size(); i-- > 1;) {
+        sites[sites[i].parent].total += sites[i].total;
+    }
+}
+
+// Find or add a statement.
+Profiled_statement& Profile::statement(const Statement& s, Program p,
+                                       Symbol_table& table)
+{
+    auto ps = std::make_unique<Profiled_statement>(s, std::move(p), table);
+    auto i = index.find(ps->text);
+    if (i != index.end()) {
+        return *statements[i->second];
+    }
+    index.emplace(ps->text, statements.size());
+    statements.push_back(std::move(ps));
+    return *statements.back();
+}
+
+// Execute a statement against a symbol table, counting cycles.
+Result<double> Profile::execute(const Statement& s, Symbol_table& table)
+{
+    Result<Program> p{try_emit(s, table)};
+    if (!p) {
+        return p.error();
+    }
+    Profiled_statement& profiled{statement(s, std::move(*p), table)};
+    Result<double> value{profiled.run(table.bindings())};
+    if (!value) {
+        return value;
+    }
+
+    switch (s.kind) {
+    case Stmt::let:
+    case Stmt::constant:
+    case Stmt::bind:
+        if (!table.add(s.name, *value, s.kind == Stmt::constant)) {
+            return Error{Errc::defined, 0, profiled.program.name};
+        }
+        break;
+    case Stmt::set:
+    case Stmt::expression:
+        break;
+    case Stmt::function: // the session defines functions, saves and loads
+    case Stmt::save:     // without running them, so they never reach here
+    case Stmt::load:
+        break;
+    }
+    return value;
+}
+
+// Add another profile to this one.
+void Profile::merge(const Profile& other)
+{
+    for (const auto& p : other.statements) {
+        auto i = index.find(p->text);
+        if (i != index.end()) {
+            statements[i->second]->merge(*p);
+        }
+        else {
+            index.emplace(p->text, statements.size());
+            statements.push_back(std::make_unique<Profiled_statement>(*p));
+        }
+    }
+}
+
+// Write the profile as folded stacks.
+void Profile::write_folded(std::ostream& os)
+{
+    for (const auto& p : statements) {
+        // Operands with the same text, such as the x's in x * x, share a
+        // stack.
+        std::vector<std::string> stacks(p->sites.size());
+        std::map<std::string, std::uint64_t> cycles;
+        for (std::size_t i = 0; i < p->sites.size(); ++i) {
+            const Profiled_statement::Site& s{p->sites[i]};
+            stacks[i] = s.parent < 0 ? s.label
+                                     : stacks[s.parent] + ';' + s.label;
+            if (s.self != 0) {
+                cycles[stacks[i]] += s.self;
+            }
+        }
+        for (const auto& c : cycles) {
+            os << c.first << ' ' << c.second << '\n';
+        }
+    }
+}
+
+// Print each statement annotated with the share of cycles spent in each of
+// its subexpressions.
+void Profile::report(std::ostream& os)
+{
+    // The number of statements printed.
+    constexpr std::size_t shown{20};
+
+    std::vector<Profiled_statement*> order;
+    std::uint64_t total{0};
+    for (const auto& p : statements) {
+        p->sum_totals();
+        total += p->sites[0].total;
+        order.push_back(p.get());
+    }
+    std::stable_sort(order.begin(), order.end(),
+                     [](Profiled_statement* a, Profiled_statement* b) {
+                         return a->sites[0].total > b->sites[0].total;
+                     });
+
+    char line[64];
+    std::snprintf(line, sizeof line, "%8s %8s %12s  ", "total%", "self%",
+                  "calls");
+    os << line << "subexpression\n";
+    for (std::size_t k = 0; k < order.size() && k < shown; ++k) {
+        for (const Profiled_statement::Site& s : order[k]->sites) {
+            std::snprintf(line, sizeof line, "%8.2f %8.2f %12llu  ",
+                          total == 0 ? 0.0 : 100.0 * s.total / total,
+                          total == 0 ? 0.0 : 100.0 * s.self / total,
+                          static_cast<unsigned long long>(s.calls));
+            os << line << std::string(2 * s.depth, ' ') << s.label << '\n';
+        }
+    }
+    if (order.size() > shown) {
+        os << "... and " << order.size() - shown << " more statements\n";
+    }
+}
@@ -0,0 +1,105 @@
+// profile.h: Subexpression profiler interface.
+// SPDX-FileCopyrightText: © 2021-2022 Bradley M. Jones <brdjns@gmx.us>
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "ast.h"
+#include "bytecode.h"
+#include "result.h"
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class Symbol_table;
+
+// @class Profiled_statement
+// @brief A statement, and the cycles spent computing each of its
+// subexpressions.
+// @details A statement is profiled as written, before it is optimised but
+// once its integer subexpressions are folded (src/optimise.h): each
+// subexpression is labelled with its source text, and charged the cycles its
+// own operation takes, such as a call to std::pow for '^', or a zero check
+// and division for '/'.
+class Profiled_statement {
+public:
+    // @class Site
+    // @brief A subexpression, and its counts.
+    class Site {
+    public:
+        std::string label;     // the subexpression's source text
+        int parent;            // the enclosing site, or -1
+        int depth;             // the number of enclosing sites
+        std::uint64_t self{};  // cycles spent in this site's operation
+        std::uint64_t total{}; // cycles spent in this site and those within
+        std::uint64_t calls{}; // times the operation ran
+    };
+
+    // @brief Prepare to profile a statement.
+    // @param s a compiled statement, not yet optimised.
+    // @param p s, compiled to bytecode.
+    // @param table the symbol table the statement was compiled against.
+    Profiled_statement(const Statement& s, Program p, Symbol_table& table);
+
+    // @brief Run the statement, counting cycles.
+    // @param slots variable values, indexed by slot.
+    // @return The value of the statement's expression, or the error that
+    // stopped it.
+    Result<double> run(double* slots);
+
+    // @brief Add another profile of the same statement to this one.
+    // @param other a profile of the same statement.
+    void merge(const Profiled_statement& other);
+
+    // @brief Compute the cycles spent in each site and the sites within it.
+    void sum_totals();
+
+    Program program;         // the statement, compiled as written
+    std::string text;        // the statement's source text
+    std::vector<Site> sites; // subexpressions, enclosing sites first
+    std::vector<int> site;   // the site of each instruction
+
+private:
+    std::vector<double> frame; // the stack and temporaries, while running
+};
+
+// @class Profile
+// @brief Cycles spent in the subexpressions of the statements run.
+class Profile {
+public:
+    // @brief Find or add a statement.
+    // @details Statements with the same source text share a profile.
+    // @param s a compiled statement, not yet optimised.
+    // @param p s, compiled to bytecode.
+    // @param table the symbol table the statement was compiled against.
+    // @return The statement's profile.
+    Profiled_statement& statement(const Statement& s, Program p,
+                                  Symbol_table& table);
+
+    // @brief Execute a statement against a symbol table, counting cycles.
+    // @param s a compiled statement, not yet optimised.
+    // @param table the symbol table the statement was compiled against.
+    // @return The value of the statement, or the error that stopped it.
+    Result<double> execute(const Statement& s, Symbol_table& table);
+
+    // @brief Add another profile to this one.
+    // @param other a profile.
+    void merge(const Profile& other);
+
+    // @brief Write the profile as folded stacks, one line per subexpression
+    // with the cycles spent in it, for flame graph tools.
+    // @param os the stream to write to.
+    void write_folded(std::ostream& os);
+
+    // @brief Print each statement annotated with the share of cycles spent
+    // in each of its subexpressions, most costly statements first.
+    // @param os the stream to print to.
+    void report(std::ostream& os);
+
+private:
+    std::vector<std::unique_ptr<Profiled_statement>> statements;
+    std::unordered_map<std::string, std::size_t> index; // statements by text
+};
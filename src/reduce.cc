@@ -0,0 +1,237 @@
+// reduce.cc: Range reductions.
+// SPDX-FileCopyrightText: © 2021-2022 Bradley M. Jones <brdjns@gmx.us>
+// SPDX-License-Identifier: MIT
+
+#include "reduce.h"
+#include "batch.h"
+#include "bytecode.h"
+#include "function.h"
+#include "symbol_table.h"
+#include "task_graph.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace {
+    // The most blocks computed before their values are combined, which
+    // bounds the memory a long range takes.
+    constexpr std::int64_t max_round{1024};
+
+    // True on a thread computing a block of a reduction split across
+    // threads: reductions nested in it are not split again.
+    thread_local bool is_split{};
+
+    // A sum, compensated as in Neumaier's variant of Kahan summation: what
+    // each addition rounds away is kept, and added back at the end.
+    class Compensated_sum {
+    public:
+        double sum{};
+        double lost{}; // what the additions have rounded away
+
+        // Add a value.
+        void add(double x)
+        {
+            double t{sum + x};
+            if (std::fabs(sum) >= std::fabs(x)) {
+                lost += (sum - t) + x;
+            }
+            else {
+                lost += (x - t) + sum;
+            }
+            sum = t;
+        }
+
+        // Add another sum.
+        void add(const Compensated_sum& other)
+        {
+            add(other.sum);
+            lost += other.lost;
+        }
+
+        // The sum, corrected; an infinite or undefined sum has nothing to
+        // correct.
+        double value() const { return std::isfinite(sum) ? sum + lost : sum; }
+    };
+
+    // What a block of a range, or the blocks so far, reduced to.
+    class Partial {
+    public:
+        Compensated_sum sum;  // for sum and mean
+        double value;         // for prod, min and max
+        Errc err{Errc::none}; // the error at the lowest index with one
+
+        // @brief Start a reduction.
+        // @param kind a reduction.
+        explicit Partial(Reduction kind)
+            : value{kind == Reduction::prod
+                        ? 1
+                        : std::numeric_limits<double>::quiet_NaN()}
+        {}
+
+        // Reduce n values.
+        void add(Reduction kind, const double* values, std::size_t n)
+        {
+            switch (kind) {
+            case Reduction::sum:
+            case Reduction::mean:
+                for (std::size_t i = 0; i < n; ++i) {
+                    sum.add(values[i]);
+                }
+                break;
+            case Reduction::prod:
+                for (std::size_t i = 0; i < n; ++i) {
+                    value *= values[i];
+                }
+                break;
+            case Reduction::min:
+                for (std::size_t i = 0; i < n; ++i) {
+                    value = fn_min(value, values[i]);
+                }
+                break;
+            case Reduction::max:
+                for (std::size_t i = 0; i < n; ++i) {
+                    value = fn_max(value, values[i]);
+                }
+                break;
+            }
+        }
+
+        // Reduce the values of the block after those reduced so far.
+        void add(Reduction kind, const Partial& block)
+        {
+            switch (kind) {
+            case Reduction::sum:
+            case Reduction::mean:
+                sum.add(block.sum);
+                break;
+            case Reduction::prod:
+                value *= block.value;
+                break;
+            case Reduction::min:
+                value = fn_min(value, block.value);
+                break;
+            case Reduction::max:
+                value = fn_max(value, block.value);
+                break;
+            }
+        }
+    };
+
+    // Reduce body's values at the indices first to last.  The batch
+    // evaluator stops at the first error in a block without saying where it
+    // was, so a block that fails is evaluated again an index at a time.
+    Partial reduce_block(Reduction kind, const Function& body, double* slots,
+                         const double* args, std::int64_t first,
+                         std::int64_t last)
+    {
+        auto n = static_cast<std::size_t>(last - first + 1);
+        std::vector<double> index(n);
+        std::vector<double> values(n);
+        for (std::size_t i = 0; i < n; ++i) {
+            index[i] =
+                static_cast<double>(first + static_cast<std::int64_t>(i));
+        }
+        // The index varies; the rest of the arguments follow the bounds.
+        std::vector<const double*> columns(body.arity());
+        columns[0] = index.data();
+
+        Partial part{kind};
+        try {
+            call_batch(body, columns.data(), args + 1, slots, values.data(),
+                       n);
+        }
+        catch (const std::runtime_error&) {
+            std::vector<double> frame(args + 1, args + 1 + body.arity());
+            for (std::size_t i = 0; i < n; ++i) {
+                frame[0] = index[i];
+                Result<double> value{try_call(body, slots, frame.data())};
+                if (!value) {
+                    part.err = value.error().code;
+                    return part;
+                }
+                values[i] = *value;
+            }
+        }
+        part.add(kind, values.data(), n);
+        return part;
+    }
+}
+
+// Count the indices of a reduction's range.
+Result<std::int64_t> range_size(Reduction kind, double from, double to)
+{
+    constexpr double limit{9007199254740992.0}; // 2^53
+    for (double bound : {from, to}) {
+        if (!(std::fabs(bound) <= limit) || bound != std::trunc(bound)) {
+            return Error{Errc::domain_error};
+        }
+    }
+    if (to < from) {
+        if (kind != Reduction::sum && kind != Reduction::prod) {
+            return Error{Errc::domain_error};
+        }
+        return std::int64_t{0};
+    }
+    return static_cast<std::int64_t>(to) - static_cast<std::int64_t>(from) + 1;
+}
+
+// Reduce a function's values over a range of integers.
+Result<double> try_reduce(Reduction kind, const Function& body,
+                          double* slots, const double* args)
+{
+    Result<std::int64_t> size{range_size(kind, args[0], args[1])};
+    if (!size) {
+        return size.error();
+    }
+    auto first = static_cast<std::int64_t>(args[0]);
+    std::int64_t blocks{(*size + reduction_block - 1) / reduction_block};
+    static const unsigned processors{
+        std::max(1u, std::thread::hardware_concurrency())};
+    unsigned threads{is_split ? 1u : processors};
+
+    Partial total{kind};
+    std::vector<Partial> parts;
+    Task_graph graph;
+    for (std::int64_t start = 0; start < blocks; start += max_round) {
+        std::int64_t count{std::min(max_round, blocks - start)};
+        parts.assign(static_cast<std::size_t>(count), Partial{kind});
+        graph.clear();
+        for (std::int64_t b = 0; b < count; ++b) {
+            graph.add();
+        }
+        bool is_parallel{threads > 1 &&
+                         static_cast<std::size_t>(count) >= min_parallel_tasks};
+        graph.run(threads, [&](std::size_t b) {
+            std::int64_t lo{first +
+                            (start + static_cast<std::int64_t>(b)) *
+                                reduction_block};
+            std::int64_t hi{
+                std::min(lo + reduction_block - 1, first + *size - 1)};
+            bool was_split{is_split};
+            is_split = was_split || is_parallel;
+            parts[b] = reduce_block(kind, body, slots, args, lo, hi);
+            is_split = was_split;
+        });
+        for (const Partial& part : parts) {
+            if (part.err != Errc::none) {
+                return Error{part.err};
+            }
+            total.add(kind, part);
+        }
+    }
+
+    switch (kind) {
+    case Reduction::sum:
+        return total.sum.value();
+    case Reduction::mean:
+        return total.sum.value() / static_cast<double>(*size);
+    case Reduction::prod:
+    case Reduction::min:
+    case Reduction::max:
+        break;
+    }
+    return total.value;
+}
@@ -0,0 +1,62 @@
+// reduce.h: Range reduction interface.
+// SPDX-FileCopyrightText: © 2021-2022 Bradley M. Jones <brdjns@gmx.us>
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "result.h"
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+class Function;
+
+// Reductions of a function's values over a range of integers.  Their
+// opcodes are in the same order.
+enum class Reduction : char {
+    sum,  // sum(i, a, b, f)
+    prod, // prod(i, a, b, f)
+    min,  // min(i, a, b, f)
+    max,  // max(i, a, b, f)
+    mean, // mean(i, a, b, f)
+};
+
+// The names of the reductions, by Reduction.
+constexpr std::string_view reduction_names[]{"sum", "prod", "min", "max",
+                                             "mean"};
+
+// The number of reductions.
+constexpr std::size_t reduction_count{sizeof reduction_names /
+                                      sizeof reduction_names[0]};
+
+// The indices a block of a reduction holds.  A range is reduced a block at a
+// time, and the blocks' values combined in order, however many threads
+// compute them.
+constexpr std::int64_t reduction_block{4096};
+
+// @brief Count the indices of a reduction's range.
+// @param kind a reduction.
+// @param from the first index.
+// @param to the last index.
+// @return The number of indices, which is 0 if to < from; Errc::domain_error
+// if a bound is not an integer that a double holds exactly, or the range is
+// empty and kind has no value for it.
+Result<std::int64_t> range_size(Reduction kind, double from, double to);
+
+// @brief Reduce a function's values over a range of integers.
+// @details The function's first parameter is the index, and the rest are
+// the same for every index.  The range is split into blocks of
+// reduction_block indices, each evaluated in chunks by the batch evaluator;
+// a range of enough blocks is split across threads, unless the reduction is
+// itself part of one that is.  Sums are compensated, within each block and
+// as the blocks are combined in order, so that a result is the same however
+// many threads compute it.  An empty sum is 0, and an empty product 1; min
+// and max ignore values that are not numbers, as the built-in functions do.
+// @param kind a reduction.
+// @param body the function reduced.
+// @param slots variable values, indexed by slot.
+// @param args the first and last index, then the rest of body's arguments.
+// @return The reduction's value, or the error at the lowest index that has
+// one.
+Result<double> try_reduce(Reduction kind, const Function& body,
+                          double* slots, const double* args);
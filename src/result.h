@@ -0,0 +1,108 @@
+// result.h: Error codes and results interface.
+// SPDX-FileCopyrightText: © 2021-2022 Bradley M. Jones <brdjns@gmx.us>
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <cstddef>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <utility>
+
+// Errors the lexer, parser and evaluator report.
+enum class Errc : unsigned char {
+    none,               // no error
+    unrecognized_token, // a character that starts no token
+    expected,           // a particular token was expected
+    factor_expected,    // an operand was expected
+    declaration_name,   // identifier missing in a declaration
+    declaration_equals, // '=' missing in a declaration
+    assignment_name,    // identifier missing in an assignment
+    assignment_equals,  // '=' missing in an assignment
+    semicolon_expected, // ';' expected after a statement
+    undefined,          // a variable is undefined
+    defined,            // a variable is already defined
+    assign_constant,    // assignment to a constant
+    assign_bound,       // assignment to a bound variable
+    division_by_zero,   // a/0
+    modulo_by_zero,     // a%0
+    domain_error,       // an argument outside a function's domain
+    arguments,          // a call with the wrong number of arguments
+    call_depth,         // calls nested too deeply
+    file_name,          // a quoted file name missing in save or load
+    save_failed,        // a snapshot could not be written
+    load_failed,        // a file could not be read as a snapshot
+};
+
+// @class Error
+// @brief A structured error.
+// @details An error is cheap to make and to pass around: its message is only
+// formatted when it is printed.  An error owns a copy of the name it refers
+// to, since the text the name was read from may be overwritten as more of a
+// statement is read.
+class Error {
+public:
+    Errc code;              // what went wrong
+    std::size_t position;   // the offset in the input of the token at
+                            // fault, or of the statement that failed to run
+    std::string name;       // the identifier involved, if any
+    char expected{};        // the token expected, for Errc::expected
+
+    // @brief Construct an error, or no error.
+    // @param[in] code what went wrong, or Errc::none.
+    // @param[in] position the offset of the token or statement at fault.
+    // @param[in] name the identifier involved, if any.
+    explicit Error(Errc code = Errc::none, std::size_t position = 0,
+                   std::string_view name = {})
+        : code{code}, position{position}, name{name}
+    {}
+
+    // @brief Determine if this is an error.
+    explicit operator bool() const { return code != Errc::none; }
+
+    // @brief Format the error message.
+    // @return The message, as std::runtime_error would carry it.
+    std::string message() const;
+};
+
+// @brief Print an error message, without building a string.
+// @param os the stream to print to.
+// @param e an error.
+// @return os.
+std::ostream& operator<<(std::ostream& os, const Error& e);
+
+// @brief Name an error code, as Errc spells it.
+// @param code an error code.
+// @return The code's name, such as "undefined".
+std::string_view errc_name(Errc code);
+
+// @class Result
+// @brief Either a value or an error.
+template<class T>
+class Result {
+public:
+    // @brief Construct a successful result.
+    // @param[in] v a value.
+    Result(T v = T{}) : val{std::move(v)} {}
+
+    // @brief Construct a failed result.
+    // @param[in] e an error.
+    Result(Error e) : err{std::move(e)} {}
+
+    // @brief Determine if the result holds a value.
+    explicit operator bool() const { return err.code == Errc::none; }
+
+    // @brief Retrieve the value.
+    // @pre The result holds a value.
+    T& operator*() { return val; }
+    T* operator->() { return &val; }
+
+    // @brief Retrieve the error.
+    Error& error() { return err; }
+    const Error& error() const { return err; }
+
+private:
+    T val{};   // the value, if there was no error
+    Error err; // the error, if any
+};
@@ -0,0 +1,649 @@
+// serve.cc: Evaluation server.
+// SPDX-FileCopyrightText: © 2021-2022 Bradley M. Jones <brdjns@gmx.us>
+// SPDX-License-Identifier: MIT
+
+#include "serve.h"
+#include "error.h"
+#include "result.h"
+#include "session.h"
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+    // The longest request, in bytes; a client that sends a longer one is
+    // disconnected.
+    constexpr std::size_t max_request{1 << 20};
+
+    // The most requests a connection may have unanswered before no more are
+    // read from it; reading resumes once half have been answered.
+    constexpr std::uint64_t max_pending{1 << 12};
+
+    // The most bytes read from a connection at once.
+    constexpr std::size_t read_bytes{1 << 16};
+
+    // The most events taken from epoll at once.
+    constexpr int max_events{64};
+
+    // @class Connection
+    // @brief A client: the requests it has sent and the replies it is owed.
+    class Connection {
+    public:
+        int in{-1};       // the descriptor requests are read from
+        int out{-1};      // the descriptor replies are written to
+        bool is_socket{}; // true for a socket, false for standard streams
+        bool is_polled{}; // true if epoll can watch in
+        bool is_watched{}; // true while epoll watches in
+
+        // The loop's alone.
+        std::string input;        // the start of a request not yet whole
+        std::string unsent;       // replies not yet written
+        std::uint64_t requests{}; // requests read
+        std::uint64_t answered{}; // replies moved to unsent
+        bool is_eof{};            // true once no more requests will come
+        bool is_reading{true};    // true while requests are read
+        bool is_writing{};        // true while epoll waits to write
+
+        // Shared with the workers, under the server's lock.
+        std::map<std::uint64_t, std::string> early; // replies out of turn
+        std::string replies;      // replies in turn, not yet in unsent
+        std::uint64_t replied{};  // requests whose replies are in turn
+        bool is_flushing{};       // true while listed to be flushed
+        bool is_closed{};         // true once the client has gone
+    };
+
+    // @class Request
+    // @brief Statements to run in a session, for a client.
+    class Request {
+    public:
+        std::shared_ptr<Connection> conn; // the client
+        std::uint64_t seq{};              // its number among conn's requests
+        std::string session;              // the session's name
+        std::string text;                 // the statements
+    };
+
+    // @class Hosted
+    // @brief A named session, and the requests waiting for it.
+    class Hosted {
+    public:
+        std::string name;                 // the session's name
+        std::unique_ptr<Session> session; // made when first needed
+        std::deque<Request> waiting;      // requests not yet run, in order
+        bool is_busy{}; // true while queued for a worker or running
+    };
+
+    // Make a session as the options say.
+    std::unique_ptr<Session> make_session(const Serve_options& options)
+    {
+        std::unique_ptr<Session> s{new Session};
+        s->format(options.format);
+        s->numeric(options.numeric);
+        s->exact_factorials(options.exact);
+        if (!options.snapshot.empty()) {
+            s->load(options.snapshot);
+        }
+        return s;
+    }
+
+    // Determine if a request is just exit.
+    bool is_exit(std::string_view text)
+    {
+        std::size_t first{text.find_first_not_of(" \t")};
+        std::size_t last{text.find_last_not_of(" \t")};
+        return first != std::string_view::npos &&
+               text.substr(first, last + 1 - first) == "exit";
+    }
+
+    // Format an error reply.
+    std::string error_reply(const Error& e)
+    {
+        std::ostringstream os;
+        os << "error " << errc_name(e.code) << ' ' << e.position << ' ' << e;
+        return os.str();
+    }
+
+    // @class Server
+    // @brief An event loop that reads requests and writes replies, and the
+    // workers that run them.
+    class Server {
+    public:
+        explicit Server(const Serve_options& o);
+        ~Server();
+
+        Server(const Server&) = delete;
+        Server& operator=(const Server&) = delete;
+
+        // Serve until the standard input ends, or a signal to stop.
+        void run();
+
+    private:
+        const Serve_options& options;
+        int poll{-1};     // the epoll instance
+        int wake{-1};     // an eventfd the workers signal replies with
+        int signals{-1};  // a signalfd for SIGINT and SIGTERM
+        int listener{-1}; // the listening socket, if any
+        sigset_t old_mask{}; // the signal mask to restore
+
+        // Connections, by the descriptor they are read from.
+        std::unordered_map<int, std::shared_ptr<Connection>> connections;
+
+        std::mutex lock;
+        std::condition_variable work;  // a session is ready, or stopping
+        std::deque<Hosted*> ready;     // sessions with requests to run
+        std::unordered_map<std::string, std::unique_ptr<Hosted>> sessions;
+        std::vector<std::shared_ptr<Connection>> flushing; // new replies
+        bool is_stopping{};
+        std::vector<std::thread> workers;
+
+        void listen_on(const std::string& path);
+        void watch(Connection& c);
+        void accept_all();
+        void receive(const std::shared_ptr<Connection>& c);
+        void dispatch(std::vector<Request>& batch);
+        void flush();
+        void send(const std::shared_ptr<Connection>& c);
+        void finish(const std::shared_ptr<Connection>& c);
+        void close(const std::shared_ptr<Connection>& c);
+        void worker();
+        std::string answer(Hosted& h, const std::string& text,
+                           std::ostringstream& out);
+        void deliver(Connection& c, std::uint64_t seq, std::string reply);
+    };
+
+    // Make the epoll instance, and listen where the options say.
+    Server::Server(const Serve_options& o) : options{o}
+    {
+        if (!options.snapshot.empty()) {
+            make_session(options); // fail now if the snapshot is unreadable
+        }
+        poll = epoll_create1(EPOLL_CLOEXEC);
+        wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (poll < 0 || wake < 0) {
+            error("cannot start the event loop: ", std::strerror(errno));
+        }
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGINT);
+        sigaddset(&mask, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &mask, &old_mask); // workers inherit it
+        signals = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = wake;
+        epoll_ctl(poll, EPOLL_CTL_ADD, wake, &ev);
+        ev.data.fd = signals;
+        epoll_ctl(poll, EPOLL_CTL_ADD, signals, &ev);
+
+        if (!options.socket.empty()) {
+            listen_on(options.socket);
+            return;
+        }
+        std::shared_ptr<Connection> c{new Connection};
+        c->in = STDIN_FILENO;
+        c->out = STDOUT_FILENO;
+        ev.data.fd = c->in;
+        // A regular file cannot be polled: it is always ready.
+        c->is_polled = c->is_watched =
+            epoll_ctl(poll, EPOLL_CTL_ADD, c->in, &ev) == 0;
+        connections.emplace(c->in, c);
+    }
+
+    // Stop the workers, and close everything opened.
+    Server::~Server()
+    {
+        {
+            std::lock_guard<std::mutex> hold{lock};
+            is_stopping = true;
+        }
+        work.notify_all();
+        for (std::thread& t : workers) {
+            t.join();
+        }
+        for (auto& entry : connections) {
+            if (entry.second->is_socket) {
+                ::close(entry.second->in);
+            }
+        }
+        if (listener >= 0) {
+            ::close(listener);
+            unlink(options.socket.c_str());
+        }
+        for (int fd : {signals, wake, poll}) {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+        }
+        pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+    }
+
+    // Listen on a Unix socket, replacing any stale socket at path.
+    void Server::listen_on(const std::string& path)
+    {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof addr.sun_path) {
+            error("socket name too long: ", path);
+        }
+        std::memcpy(addr.sun_path, path.data(), path.size());
+        struct stat st;
+        if (stat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+            unlink(path.c_str());
+        }
+        listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                          0);
+        if (listener < 0 ||
+            bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof addr) <
+                0 ||
+            listen(listener, SOMAXCONN) < 0) {
+            error("cannot listen on " + path + ": ", std::strerror(errno));
+        }
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = listener;
+        epoll_ctl(poll, EPOLL_CTL_ADD, listener, &ev);
+    }
+
+    // Ask epoll to watch a connection for what it is waiting to do, and
+    // only then: a hung-up descriptor would otherwise be reported ready
+    // again and again.
+    void Server::watch(Connection& c)
+    {
+        if (!c.is_polled) {
+            return;
+        }
+        epoll_event ev{};
+        ev.events = (c.is_reading ? EPOLLIN : 0u) |
+                    (c.is_writing ? EPOLLOUT : 0u);
+        ev.data.fd = c.in;
+        if (ev.events == 0) {
+            if (c.is_watched) {
+                epoll_ctl(poll, EPOLL_CTL_DEL, c.in, nullptr);
+            }
+            c.is_watched = false;
+            return;
+        }
+        epoll_ctl(poll, c.is_watched ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, c.in,
+                  &ev);
+        c.is_watched = true;
+    }
+
+    // Accept every client waiting to connect.
+    void Server::accept_all()
+    {
+        for (;;) {
+            int fd{accept4(listener, nullptr, nullptr,
+                           SOCK_NONBLOCK | SOCK_CLOEXEC)};
+            if (fd < 0) {
+                return; // none left, or none to be had
+            }
+            std::shared_ptr<Connection> c{new Connection};
+            c->in = c->out = fd;
+            c->is_socket = true;
+            c->is_polled = true;
+            watch(*c);
+            connections.emplace(fd, std::move(c));
+        }
+    }
+
+    // Read what a client has sent, and queue the whole requests in it.
+    void Server::receive(const std::shared_ptr<Connection>& c)
+    {
+        std::size_t old{c->input.size()};
+        c->input.resize(old + read_bytes);
+        ssize_t n{read(c->in, &c->input[old], read_bytes)};
+        c->input.resize(old + (n > 0 ? static_cast<std::size_t>(n) : 0));
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EINTR) {
+                close(c);
+            }
+            return;
+        }
+        if (n == 0) {
+            c->is_eof = true;
+            c->is_reading = false;
+            watch(*c);
+            if (!c->input.empty()) {
+                c->input += '\n'; // a last request, unterminated
+            }
+        }
+
+        std::vector<Request> batch;
+        std::size_t begin{0};
+        for (std::size_t end;
+             (end = c->input.find('\n', begin)) != std::string::npos;
+             begin = end + 1) {
+            std::string_view line{c->input.data() + begin, end - begin};
+            if (!line.empty() && line.back() == '\r') {
+                line.remove_suffix(1);
+            }
+            if (line.find_first_not_of(" \t") == std::string_view::npos) {
+                continue; // blank lines are not requests
+            }
+            std::size_t name_end{std::min(line.find_first_of(" \t"),
+                                          line.size())};
+            Request r{c, c->requests++, std::string{line.substr(0, name_end)},
+                      std::string{line.substr(std::min(name_end + 1,
+                                                       line.size()))}};
+            batch.push_back(std::move(r));
+        }
+        c->input.erase(0, begin);
+        if (c->input.size() > max_request) {
+            close(c);
+            return;
+        }
+        dispatch(batch);
+        if (c->requests - c->answered >= max_pending) {
+            c->is_reading = false;
+            watch(*c);
+        }
+        finish(c);
+    }
+
+    // Queue requests for their sessions, and wake workers for them.
+    void Server::dispatch(std::vector<Request>& batch)
+    {
+        if (batch.empty()) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> hold{lock};
+            for (Request& r : batch) {
+                std::unique_ptr<Hosted>& h{sessions[r.session]};
+                if (!h) {
+                    h.reset(new Hosted);
+                    h->name = r.session;
+                }
+                h->waiting.push_back(std::move(r));
+                if (!h->is_busy) {
+                    h->is_busy = true;
+                    ready.push_back(h.get());
+                }
+            }
+        }
+        work.notify_all();
+    }
+
+    // Take the replies the workers have finished, and write them.
+    void Server::flush()
+    {
+        std::vector<std::shared_ptr<Connection>> list;
+        {
+            std::lock_guard<std::mutex> hold{lock};
+            list.swap(flushing);
+            for (std::shared_ptr<Connection>& c : list) {
+                c->is_flushing = false;
+                c->unsent += c->replies;
+                c->replies.clear();
+                c->answered = c->replied;
+            }
+        }
+        for (std::shared_ptr<Connection>& c : list) {
+            if (c->is_closed) {
+                continue;
+            }
+            send(c);
+            if (!c->is_reading && !c->is_eof && !c->is_closed &&
+                c->requests - c->answered <= max_pending / 2) {
+                c->is_reading = true;
+                watch(*c);
+            }
+            finish(c);
+        }
+    }
+
+    // Write as many of a client's replies as it will take.
+    void Server::send(const std::shared_ptr<Connection>& c)
+    {
+        std::size_t sent{0};
+        while (sent < c->unsent.size()) {
+            const char* p{c->unsent.data() + sent};
+            std::size_t size{c->unsent.size() - sent};
+            ssize_t n{c->is_socket ? ::send(c->out, p, size, MSG_NOSIGNAL)
+                                   : write(c->out, p, size)};
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0 && errno == EAGAIN) {
+                break;
+            }
+            if (n < 0) {
+                close(c);
+                return;
+            }
+            sent += static_cast<std::size_t>(n);
+        }
+        c->unsent.erase(0, sent);
+        bool is_writing{!c->unsent.empty()};
+        if (is_writing != c->is_writing) {
+            c->is_writing = is_writing;
+            watch(*c);
+        }
+    }
+
+    // Close a connection that will send no more requests once every one it
+    // sent has been answered.
+    void Server::finish(const std::shared_ptr<Connection>& c)
+    {
+        if (c->is_eof && !c->is_closed && c->answered == c->requests &&
+            c->unsent.empty()) {
+            close(c);
+        }
+    }
+
+    // Drop a connection, and any replies it is still owed.
+    void Server::close(const std::shared_ptr<Connection>& c)
+    {
+        {
+            std::lock_guard<std::mutex> hold{lock};
+            c->is_closed = true;
+            c->early.clear();
+            c->replies.clear();
+        }
+        if (c->is_watched) {
+            epoll_ctl(poll, EPOLL_CTL_DEL, c->in, nullptr);
+        }
+        if (c->is_socket) {
+            ::close(c->in);
+        }
+        connections.erase(c->in);
+    }
+
+    // Run the statements of a request in its session, and phrase the reply.
+    std::string Server::answer(Hosted& h, const std::string& text,
+                               std::ostringstream& out)
+    {
+        if (is_exit(text)) {
+            h.session.reset();
+            return "ok";
+        }
+        if (!h.session) {
+            try {
+                h.session = make_session(options);
+            }
+            catch (std::exception& e) {
+                return std::string{"error "} +
+                       std::string{errc_name(Errc::load_failed)} + " 0 " +
+                       e.what();
+            }
+        }
+        out.str(std::string{});
+        std::string reply;
+        h.session->execute_until_error(
+            text, out, [&](const Error& e) { reply = error_reply(e); });
+        if (!reply.empty()) {
+            return reply;
+        }
+        reply = "ok";
+        std::string results{out.str()};
+        for (char& ch : results) {
+            if (ch == '\n') {
+                ch = ' ';
+            }
+        }
+        if (!results.empty()) {
+            results.pop_back(); // the last result's newline
+            reply += ' ';
+            reply += results;
+        }
+        return reply;
+    }
+
+    // Hand a reply to its connection, in turn.  The lock is held.
+    void Server::deliver(Connection& c, std::uint64_t seq, std::string reply)
+    {
+        if (c.is_closed) {
+            return;
+        }
+        if (seq != c.replied) {
+            c.early.emplace(seq, std::move(reply));
+            return;
+        }
+        c.replies += reply;
+        c.replies += '\n';
+        ++c.replied;
+        for (auto i = c.early.begin();
+             i != c.early.end() && i->first == c.replied;
+             i = c.early.erase(i)) {
+            c.replies += i->second;
+            c.replies += '\n';
+            ++c.replied;
+        }
+    }
+
+    // Run requests, a session at a time, until the server stops.
+    void Server::worker()
+    {
+        std::ostringstream out;
+        std::unique_lock<std::mutex> hold{lock};
+        for (;;) {
+            work.wait(hold, [&] { return !ready.empty() || is_stopping; });
+            if (is_stopping) {
+                return;
+            }
+            Hosted* h{ready.front()};
+            ready.pop_front();
+            Request r{std::move(h->waiting.front())};
+            h->waiting.pop_front();
+            hold.unlock();
+
+            std::string reply{answer(*h, r.text, out)};
+
+            hold.lock();
+            deliver(*r.conn, r.seq, std::move(reply));
+            if (!r.conn->is_flushing && !r.conn->is_closed) {
+                r.conn->is_flushing = true;
+                if (flushing.empty()) {
+                    std::uint64_t one{1};
+                    ssize_t n{write(wake, &one, sizeof one)};
+                    static_cast<void>(n); // the loop is woken either way
+                }
+                flushing.push_back(std::move(r.conn));
+            }
+            if (!h->waiting.empty()) {
+                ready.push_back(h); // behind sessions waiting longer
+            }
+            else if (!h->session) {
+                sessions.erase(h->name); // ended, with nothing waiting
+            }
+            else {
+                h->is_busy = false;
+            }
+        }
+    }
+
+    // Serve until the standard input ends, or a signal to stop.
+    void Server::run()
+    {
+        unsigned threads{options.threads ? options.threads
+                                         : std::thread::hardware_concurrency()};
+        for (unsigned i = 0; i < std::max(threads, 1u); ++i) {
+            workers.emplace_back(&Server::worker, this);
+        }
+
+        epoll_event events[max_events];
+        for (;;) {
+            bool is_served{listener < 0 && connections.empty()};
+            if (is_served) {
+                return; // the standard input has ended, and been answered
+            }
+            int timeout{-1};
+            for (auto& entry : connections) {
+                if (!entry.second->is_polled && entry.second->is_reading) {
+                    timeout = 0; // a file is always ready to read
+                }
+            }
+            int n{epoll_wait(poll, events, max_events, timeout)};
+            if (n < 0 && errno != EINTR) {
+                error("event loop failed: ", std::strerror(errno));
+            }
+            for (int i = 0; i < n; ++i) {
+                int fd{events[i].data.fd};
+                if (fd == listener) {
+                    accept_all();
+                    continue;
+                }
+                if (fd == wake) {
+                    std::uint64_t count;
+                    ssize_t got{read(wake, &count, sizeof count)};
+                    static_cast<void>(got); // flushed below either way
+                    continue;
+                }
+                if (fd == signals) {
+                    return;
+                }
+                auto at = connections.find(fd);
+                if (at == connections.end()) {
+                    continue; // closed by an earlier event
+                }
+                std::shared_ptr<Connection> c{at->second};
+                if (events[i].events & EPOLLOUT) {
+                    send(c);
+                }
+                if (!c->is_closed && c->is_reading &&
+                    (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+                    receive(c);
+                }
+            }
+            std::vector<std::shared_ptr<Connection>> files;
+            for (auto& entry : connections) {
+                if (!entry.second->is_polled && entry.second->is_reading) {
+                    files.push_back(entry.second);
+                }
+            }
+            for (std::shared_ptr<Connection>& c : files) {
+                receive(c);
+            }
+            flush();
+        }
+    }
+}
+
+// Serve requests to evaluate statements in named sessions.
+void serve(const Serve_options& options)
+{
+    Server server{options};
+    server.run();
+}
@@ -0,0 +1,39 @@
+// serve.h: Evaluation server interface.
+// SPDX-FileCopyrightText: © 2021-2022 Bradley M. Jones <brdjns@gmx.us>
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "format.h"
+#include "number.h"
+#include <string>
+
+// @class Serve_options
+// @brief Where a server listens, and how it makes its sessions.
+class Serve_options {
+public:
+    std::string socket;   // a Unix socket to listen on, or empty for the
+                          // standard input and output
+    unsigned threads{};   // worker threads, or 0 for one per processor
+    std::string snapshot; // a snapshot each new session loads, if any
+    Number_format format; // how results are printed
+    Numeric numeric{Numeric::binary64}; // the number type sessions use
+    bool exact{};         // true to print factorials exactly
+};
+
+// @brief Serve requests to evaluate statements in named sessions.
+// @details A request is a line: a session's name, a space, and statements.
+// A session is made the first time its name is used, and each has its own
+// variables and functions; a request of just exit ends its session.  Each
+// request is answered with a line, "ok" and the statements' results, or
+// "error", the error code's name (src/result.h), the offset of the error
+// in the statements, and its message, in which case the statements after
+// the one that failed are not run.  Clients may send requests without
+// waiting for replies: each connection's replies come in the order of its
+// requests.  An epoll loop reads requests and writes replies; a pool of
+// workers runs them, each session's one at a time and in order, and
+// different sessions' at once.
+// @param options where to listen, and how to make sessions.
+// @throws std::runtime_error if the socket cannot be made or the snapshot
+// cannot be loaded.
+void serve(const Serve_options& options);
@@ -0,0 +1,824 @@
+// session.cc: Calculator sessions.
+// SPDX-FileCopyrightText: © 2021-2022 Bradley M. Jones <brdjns@gmx.us>
+// SPDX-License-Identifier: MIT
+
+#include "session.h"
+#include "bigint.h"
+#include "bytecode.h"
+#include "error.h"
+#include "evaluate.h"
+#include "optimise.h"
+#include "parse.h"
+#include "profile.h"
+#include "snapshot.h"
+#include "stats.h"
+#include "task_graph.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <iterator>
+#include <optional>
+#include <sstream>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+namespace {
+    // The predefined constants, spelled to the precision of the widest
+    // number type, in the order they are declared.
+    constexpr std::pair<const char*, std::string_view> predefined[]{
+        {"E", "2.718281828459045235360287471352662498"},
+        {"LOG2E", "1.442695040888963407359924681001892137"},
+        {"LOG10E", "0.434294481903251827651128918916605082"},
+        {"LN2", "0.693147180559945309417232121458176568"},
+        {"LN10", "2.302585092994045684017991454684364208"},
+        {"PI", "3.141592653589793238462643383279502884"},
+        {"PI_2", "1.570796326794896619231321691639751442"},
+        {"PI_4", "0.785398163397448309615660845819875721"},
+        {"SQRT2", "1.414213562373095048801688724209698079"},
+    };
+
+    // The most statements parsed ahead of running them.
+    constexpr std::size_t max_segment{1 << 16};
+
+    // Determine if an expression has a reduction in it.
+    bool has_reduction(const Node& n)
+    {
+        return n.op == Op::reduce ||
+               std::any_of(n.args.begin(), n.args.end(),
+                           [](const Node_ptr& a) { return has_reduction(*a); });
+    }
+
+    // Call f with a zero of the number type n, which is not double.
+    template<class F>
+    auto with_numeric(Numeric n, F f)
+    {
+        switch (n) {
+        case Numeric::binary32:
+            return f(float{});
+        case Numeric::extended:
+            return f(static_cast<long double>(0));
+        default:
+            return f(Double_double{});
+        }
+    }
+}
+
+// Construct a session with the predefined constants declared.
+Session::Session()
+{
+    // Load predefined constants: these are constants in the sense that they
+    // cannot be assigned to. These constants are based on the non-standard
+    // 'M_*' macro constants available under <cmath> and <math.h> in many C and
+    // C++ implementations.
+    for (const auto& c : predefined) {
+        table.declare(c.first, Number_traits<double>::parse(c.second), true);
+    }
+}
+
+// Evaluate a single statement.
+double Session::evaluate(const std::string& src)
+{
+    if (stats) {
+        ++stats->statements;
+    }
+    Statement s{compile(src, table)};
+    if (s.kind == Stmt::function) {
+        if (Error e{define_function(s)}) {
+            error(e);
+        }
+        return 0;
+    }
+    if (s.kind == Stmt::save || s.kind == Stmt::load) {
+        if (Error e{snapshot(s)}) {
+            error(e);
+        }
+        return 0;
+    }
+    if (Error e{refresh(s)}) {
+        error(e);
+    }
+    std::shared_ptr<const Binding> b{bind_expression(s)};
+    double v;
+    if (arithmetic != Numeric::binary64) {
+        Phase_timer timer{stats, Phase::evaluate};
+        v = with_numeric(arithmetic, [&](auto zero) {
+            using T = decltype(zero);
+            Result<T> value{run_as<T>(s)};
+            if (!value) {
+                error(value.error());
+            }
+            return Number_traits<T>::to_double(*value);
+        });
+    }
+    else {
+        Result<double> value{run_statement(s)};
+        if (!value) {
+            error(value.error());
+        }
+        v = *value;
+    }
+    assigned(s, std::move(b));
+    return v;
+}
+
+// Save the session's variables and functions to a snapshot file.
+void Session::save(const std::string& path)
+{
+    if (Error e{save_snapshot(table, path)}) {
+        error(e);
+    }
+}
+
+// Replace the session's variables and functions with a snapshot's.
+void Session::load(const std::string& path)
+{
+    if (Error e{load_snapshot(table, path)}) {
+        error(e);
+    }
+    typed = {};
+}
+
+// Save or load a snapshot.
+Error Session::snapshot(const Statement& s)
+{
+    Phase_timer timer{stats, Phase::compile};
+    if (s.kind == Stmt::save) {
+        return save_snapshot(table, s.name);
+    }
+    Error e{load_snapshot(table, s.name)};
+    if (!e) {
+        typed = {}; // every value may have changed
+    }
+    return e;
+}
+
+// Compile the expression a bind statement binds its variable to, before the
+// statement is optimised.
+std::shared_ptr<const Binding> Session::bind_expression(const Statement& s)
+{
+    if (s.kind != Stmt::bind) {
+        return nullptr;
+    }
+    Phase_timer timer{stats, Phase::compile};
+    return binding(s, table);
+}
+
+// Note what a statement that has run assigned to.
+void Session::assigned(const Statement& s, std::shared_ptr<const Binding> b)
+{
+    if (s.kind == Stmt::set) {
+        table.touch(table.find(s.name));
+    }
+    else if (b) {
+        table.bind(table.find(s.name), std::move(b));
+    }
+}
+
+// Bring the bound variables a statement reads up to date.
+Error Session::refresh(const Statement& s)
+{
+    if (!table.has_stale() || !s.expr || s.kind == Stmt::function) {
+        return Error{};
+    }
+    Phase_timer timer{stats, Phase::evaluate};
+    std::vector<int> reads;
+    collect_reads(*s.expr, reads);
+    if (arithmetic == Numeric::binary64) {
+        return table.refresh(reads);
+    }
+    return with_numeric(arithmetic, [&](auto zero) {
+        using T = decltype(zero);
+        std::vector<T>& v{values<T>()};
+        return table.refresh(reads, [&](int i, const Binding& b) {
+            Result<T> value{Evaluator<T>{*b.expr}.run(v.data())};
+            if (!value) {
+                return value.error();
+            }
+            v[i] = *value;
+            table.values[i] = Number_traits<T>::to_double(*value);
+            return Error{};
+        });
+    });
+}
+
+// Retrieve variable values in a number type other than double, adding any
+// variables declared since they were last retrieved.
+template<class T>
+std::vector<T>& Session::values()
+{
+    std::vector<T>& v{std::get<std::vector<T>>(typed)};
+    while (v.size() < table.size()) {
+        std::size_t i{v.size()};
+        v.push_back(i < std::size(predefined)
+                        ? Number_traits<T>::parse(predefined[i].second)
+                        : Number_traits<T>::from_double(table.values[i]));
+    }
+    return v;
+}
+
+// Run a statement in a number type other than double.
+template<class T>
+Result<T> Session::run_as(const Statement& s)
+{
+    int slot{-1};
+    if (s.kind == Stmt::set) {
+        slot = table.find(s.name);
+        if (slot < 0) {
+            return Error{Errc::undefined, 0, s.name};
+        }
+        if (table.is_constant(slot)) {
+            return Error{Errc::assign_constant};
+        }
+        if (table.is_bound(slot)) {
+            return Error{Errc::assign_bound};
+        }
+    }
+
+    std::vector<T>& v{values<T>()};
+    Result<T> value{Evaluator<T>{*s.expr, s.temps}.run(v.data())};
+    if (!value) {
+        return value;
+    }
+    double nearest{Number_traits<T>::to_double(*value)};
+    switch (s.kind) {
+    case Stmt::let:
+    case Stmt::constant:
+    case Stmt::bind:
+        if (!table.add(s.name, nearest, s.kind == Stmt::constant)) {
+            return Error{Errc::defined, 0, s.name};
+        }
+        v.push_back(*value);
+        break;
+    case Stmt::set:
+        table.values[slot] = nearest;
+        v[slot] = *value;
+        break;
+    case Stmt::expression:
+    case Stmt::function:
+    case Stmt::save:
+    case Stmt::load:
+        break;
+    }
+    return value;
+}
+
+// Run a statement in the session's number type, other than double, and
+// print its value.
+Error Session::print_numeric(const Statement& s, std::ostream& out)
+{
+    return with_numeric(arithmetic, [&](auto zero) {
+        using T = decltype(zero);
+        Result<T> value;
+        {
+            Phase_timer timer{stats, Phase::evaluate};
+            value = run_as<T>(s);
+        }
+        if (!value) {
+            return value.error();
+        }
+        Phase_timer timer{stats, Phase::output};
+        char text[max_number_size + 1];
+        char* end{Number_traits<T>::format(text, text + max_number_size,
+                                           *value, numbers)};
+        *end++ = '\n';
+        out.write(text, end - text);
+        return Error{};
+    });
+}
+
+// Evaluate statements in a number type from now on.
+void Session::numeric(Numeric n)
+{
+    arithmetic = n;
+    typed = {};
+}
+
+// Define a function.
+Error Session::define_function(const Statement& s)
+{
+    Phase_timer timer{stats, Phase::compile};
+    return define(s, table);
+}
+
+// Optimise, compile and run a statement, or profile it.
+Result<double> Session::run_statement(Statement& s)
+{
+    if (profile) {
+        fold_integers(s, table); // as optimise would, to compute the same
+        Phase_timer timer{stats, Phase::evaluate};
+        return profile->execute(s, table);
+    }
+    {
+        Phase_timer timer{stats, Phase::optimise};
+        removed += optimise(s, table);
+    }
+    {
+        Phase_timer timer{stats, Phase::compile};
+        Result<Program> p{try_emit(s, table)};
+        if (!p) {
+            return p.error();
+        }
+        program = std::move(*p);
+    }
+    Phase_timer timer{stats, Phase::evaluate};
+    return try_execute(program, table);
+}
+
+// Execute every statement in a stream of tokens.
+std::size_t Session::execute(Token_stream& ts, std::ostream& out,
+                             std::ostream& err, const std::string& prompt)
+{
+    if (!stats && !ts.scans_in_place()) {
+        return execute_statements(ts, out, err, prompt);
+    }
+    std::ostream sink{out.rdbuf()};
+    std::optional<Counting_buffer> counted;
+    if (stats) {
+        counted.emplace(sink.rdbuf(), stats->bytes_written);
+        sink.rdbuf(&*counted);
+        ts.collect(stats);
+    }
+    std::optional<Bulk_buffer> bulk;
+    if (ts.scans_in_place()) {
+        bulk.emplace(sink.rdbuf());
+        sink.rdbuf(&*bulk);
+    }
+    std::size_t count{execute_statements(ts, sink, err, prompt)};
+    sink.flush();
+    ts.collect(nullptr);
+    return count;
+}
+
+// Execute statements until the end of input, printing prompt before each.
+std::size_t Session::execute_statements(Token_stream& ts, std::ostream& out,
+                                        std::ostream& err,
+                                        const std::string& prompt)
+{
+    std::size_t count{0};
+    for (;;) {
+        out << prompt;
+        if (!next_statement(ts)) {
+            return count;
+        }
+        ++count;
+        if (stats) {
+            ++stats->statements;
+        }
+        execute_statement(ts, out, err);
+    }
+}
+
+// Skip empty statements.
+bool Session::next_statement(Token_stream& ts)
+{
+    Token t{ts.get()};
+    for (; t.kind == Symbol::print_tok;) { // discard all 'print' tokens
+        t = ts.get();
+    }
+    if (t.kind == Symbol::quit_tok) {
+        return false;
+    }
+    ts.putback(t);
+    return true;
+}
+
+// Parse, run and print a statement, or pass the error that stopped it to
+// fail.
+template<class F>
+bool Session::try_statement(Token_stream& ts, std::ostream& out,
+                            const F& fail)
+{
+    std::size_t start{ts.position()};
+    Result<Statement> s;
+    {
+        Phase_timer timer{stats, Phase::parse};
+        s = statement(ts, table);
+    }
+    Error e{s ? refresh(*s) : s.error()};
+    if (!e && print_exact(*s, out)) {
+        return true;
+    }
+    if (!e) {
+        std::shared_ptr<const Binding> b{bind_expression(*s)};
+        if (s->kind == Stmt::function) { // prints nothing
+            e = define_function(*s);
+        }
+        else if (s->kind == Stmt::save || s->kind == Stmt::load) {
+            e = snapshot(*s); // prints nothing
+        }
+        else if (arithmetic != Numeric::binary64) {
+            e = print_numeric(*s, out);
+        }
+        else if (Result<double> value{run_statement(*s)}) {
+            print_value(*value, out);
+        }
+        else {
+            e = value.error();
+        }
+        if (!e) {
+            assigned(*s, std::move(b));
+            return true;
+        }
+    }
+
+    // Errors are values, not exceptions: a malformed statement costs little
+    // more than a well-formed one, and its message is only formatted here,
+    // as it is printed.
+    Phase_timer timer{stats, Phase::recover};
+    if (stats) {
+        ++stats->errors;
+    }
+    if (s) {
+        e.position = start;
+    }
+    fail(e);
+    cleanup(ts);
+    return false;
+}
+
+// Parse, run and print a statement, or report why it failed.
+void Session::execute_statement(Token_stream& ts, std::ostream& out,
+                                std::ostream& err)
+{
+    try_statement(ts, out, [&](const Error& e) {
+        out.flush(); // keep results and errors in order
+        err << "error: " << e << '\n';
+    });
+}
+
+// Print the value of a statement that has run.
+void Session::print_value(double value, std::ostream& out)
+{
+    Phase_timer timer{stats, Phase::output};
+    char text[max_number_size + 1]; // a result, and the newline after it
+    char* end{format_number(text, text + max_number_size, value, numbers)};
+    *end++ = '\n';
+    out.write(text, end - text);
+}
+
+// @class Session::Segment
+// @brief Statements parsed ahead, to run together.
+// @details A statement is parsed as if every let and const before it in the
+// segment succeeded, declaring its variable as it is parsed.  One that fails
+// leaves its variable undeclared when it runs, and a later statement that
+// names the variable then fails as it would have when parsed: it waits for
+// the declaration, since it reads or writes the variable.
+class Session::Segment {
+public:
+    // A statement, and what running it came to.
+    class Entry {
+    public:
+        Result<Statement> s;   // the statement, or why it could not be parsed
+        std::size_t start{};   // its offset in the text
+        std::size_t uses{};    // the end of the slots it looked up, in uses
+        int target{-1};        // the slot let, const or set writes, if any
+        bool declares{};       // true if let or const added target
+        bool redeclares{};     // true if let or const names a declared name
+        Error e;               // the error that stopped it, if any
+        double value{};        // its value
+        std::string digits;    // its value, if printed exactly
+    };
+
+    // The statements that read a variable since it was last written, and the
+    // statement that last wrote it.
+    class Access {
+    public:
+        std::vector<std::size_t> readers;
+        std::size_t writer{no_writer};
+    };
+
+    static constexpr std::size_t no_writer{~std::size_t{}};
+
+    std::vector<Entry> entries;     // the statements, in order
+    std::vector<int> uses;          // the slots each looked up, in order
+    std::size_t base{};             // the first slot the segment declared
+    std::vector<char> undeclared;   // 1 if a slot's declaration failed, by
+                                    // slot - base
+    std::unordered_map<int, Access> access; // accesses, by slot
+    Task_graph graph;               // the order statements must run in
+
+    // Order statement i after those it must follow.
+    void order(std::size_t i, const std::vector<int>& read, int written)
+    {
+        for (int slot : read) {
+            Access& a{access[slot]};
+            if (a.writer != no_writer) {
+                graph.depend(a.writer, i);
+            }
+            if (a.readers.empty() || a.readers.back() != i) {
+                a.readers.push_back(i);
+            }
+        }
+        if (written >= 0) {
+            Access& a{access[written]};
+            if (a.writer != no_writer) {
+                graph.depend(a.writer, i);
+            }
+            for (std::size_t r : a.readers) {
+                if (r != i) {
+                    graph.depend(r, i);
+                }
+            }
+            a.readers.clear();
+            a.writer = i;
+        }
+    }
+
+    // Determine if the declaration of a slot failed.
+    bool is_undeclared(int slot) const
+    {
+        return slot >= static_cast<int>(base) &&
+               undeclared[static_cast<std::size_t>(slot) - base] != 0;
+    }
+};
+
+// Parse a statement into a segment, unless it must run alone.
+bool Session::plan(Segment& seg, Token_stream& ts, std::size_t start)
+{
+    if (seg.entries.empty()) {
+        seg.base = table.size();
+    }
+    std::size_t first{seg.uses.size()};
+    table.uses = &seg.uses;
+    Result<Statement> s{statement(ts, table)};
+    table.uses = nullptr;
+    bool is_pending{std::any_of(
+        seg.uses.begin() + static_cast<std::ptrdiff_t>(first), seg.uses.end(),
+        [&](int slot) { return slot >= static_cast<int>(seg.base); })};
+
+    // A statement that ends in neither ';' nor the end of input ends where a
+    // failure would make it end, so it runs alone; so does a malformed
+    // statement that might have been malformed elsewhere, were a variable it
+    // names undeclared.
+    if (s) {
+        Token t{ts.get()};
+        ts.putback(t);
+        if (t.kind != Symbol::print_tok && t.kind != Symbol::quit_tok) {
+            seg.uses.resize(first);
+            return false;
+        }
+    }
+    else if (is_pending) {
+        seg.uses.resize(first);
+        return false;
+    }
+    else {
+        cleanup(ts);
+    }
+
+    Segment::Entry e;
+    e.start = start;
+    e.uses = seg.uses.size();
+    std::vector<int> read;
+    if (s) {
+        read.assign(seg.uses.begin() + static_cast<std::ptrdiff_t>(first),
+                    seg.uses.end());
+        collect_reads(*s->expr, read);
+
+        // Statements that read a bound variable, which may be computed as
+        // it is read, or write one that others are bound to, run alone; so
+        // do reductions, whose bodies are compiled as they are parsed, before
+        // constants the segment declares have their values.
+        int target{s->kind == Stmt::set ? table.find(s->name) : -1};
+        if (std::any_of(read.begin(), read.end(),
+                        [&](int slot) { return table.is_bound(slot); }) ||
+            (target >= 0 && table.has_dependents(target)) ||
+            has_reduction(*s->expr)) {
+            seg.uses.resize(first);
+            return false;
+        }
+        switch (s->kind) {
+        case Stmt::let:
+        case Stmt::constant:
+            e.target = table.find(s->name);
+            if (e.target >= 0) {
+                e.redeclares = true;
+            }
+            else if (table.add(s->name, 0, s->kind == Stmt::constant)) {
+                e.target = static_cast<int>(table.size()) - 1;
+                e.declares = true;
+                seg.undeclared.push_back(0);
+            }
+            else { // a function's name
+                e.redeclares = true;
+            }
+            break;
+        case Stmt::set:
+            e.target = table.find(s->name);
+            break;
+        case Stmt::expression:
+        case Stmt::function:
+        case Stmt::bind:
+        case Stmt::save:
+        case Stmt::load:
+            break;
+        }
+    }
+    e.s = std::move(s);
+
+    // Redeclaring a variable declared before the segment writes nothing.
+    int written{e.target};
+    if (e.redeclares && e.target < static_cast<int>(seg.base)) {
+        written = -1;
+    }
+    seg.order(seg.graph.add(), read, written);
+    seg.entries.push_back(std::move(e));
+    return true;
+}
+
+// Run a statement of a segment, once those it waits for have run.
+int Session::run_entry(Segment& seg, std::size_t i)
+{
+    Segment::Entry& e{seg.entries[i]};
+    std::size_t first{i == 0 ? 0 : seg.entries[i - 1].uses};
+    for (std::size_t u = first; u < e.uses; ++u) {
+        int slot{seg.uses[u]};
+        if (seg.is_undeclared(slot)) {
+            e.e = Error{Errc::undefined, e.start, table.var_table[slot].name};
+            return 0;
+        }
+    }
+    if (!e.s) {
+        e.e = e.s.error();
+        return 0;
+    }
+    Statement& s{*e.s};
+    if (exact) {
+        std::ostringstream digits;
+        if (print_exact(s, digits)) {
+            e.digits = digits.str();
+            return 0;
+        }
+    }
+    // Variables the segment declares after a set are not yet declared.
+    if (s.kind == Stmt::set && (e.target < 0 || seg.is_undeclared(e.target))) {
+        e.e = Error{Errc::undefined, e.start, s.name};
+        return 0;
+    }
+    int removed_nodes{optimise(s, table)};
+    Result<Program> p{try_emit(s, table)};
+    Result<double> value{p ? try_run(*p, table.bindings())
+                           : Result<double>{p.error()}};
+    if (!value) {
+        e.e = value.error();
+        e.e.position = e.start;
+        return removed_nodes;
+    }
+    e.value = *value;
+    if (s.kind != Stmt::let && s.kind != Stmt::constant) {
+        return removed_nodes;
+    }
+    if (e.redeclares && !seg.is_undeclared(e.target)) {
+        e.e = Error{Errc::defined, e.start, s.name};
+        return removed_nodes;
+    }
+    table.values[e.target] = *value;
+    if (e.redeclares) { // the variable's declaration failed before
+        seg.undeclared[static_cast<std::size_t>(e.target) - seg.base] = 0;
+        table.var_table[e.target].is_const = s.kind == Stmt::constant;
+    }
+    return removed_nodes;
+}
+
+// Run the statements of a segment, print their results in order, and empty
+// it.
+void Session::run(Segment& seg, std::ostream& out, std::ostream& err,
+                  unsigned threads)
+{
+    std::atomic<long> removed_here{0};
+    seg.graph.run(threads, [&](std::size_t i) {
+        Segment::Entry& e{seg.entries[i]};
+        removed_here.fetch_add(run_entry(seg, i), std::memory_order_relaxed);
+        if (e.e && e.declares) {
+            seg.undeclared[static_cast<std::size_t>(e.target) - seg.base] = 1;
+        }
+    });
+    removed += removed_here.load();
+
+    for (Segment::Entry& e : seg.entries) {
+        if (e.e) {
+            out.flush(); // keep results and errors in order
+            err << "error: " << e.e << '\n';
+        }
+        else if (!e.digits.empty()) {
+            out.write(e.digits.data(),
+                      static_cast<std::streamsize>(e.digits.size()));
+        }
+        else if (e.s->kind != Stmt::function) {
+            print_value(e.value, out);
+        }
+    }
+    for (std::size_t i = 0; i < seg.undeclared.size(); ++i) {
+        if (seg.undeclared[i] != 0) {
+            table.forget(static_cast<int>(seg.base + i));
+        }
+    }
+    seg.entries.clear();
+    seg.uses.clear();
+    seg.undeclared.clear();
+    seg.access.clear();
+    seg.graph.clear();
+}
+
+// Execute every statement in a text, running statements that do not depend
+// on each other concurrently.
+std::size_t Session::execute_parallel(std::string_view text, std::ostream& out,
+                                      std::ostream& err, unsigned threads)
+{
+    if (stats || profile || arithmetic != Numeric::binary64 || threads <= 1) {
+        return execute(text, out, err);
+    }
+    std::ostream sink{out.rdbuf()};
+    Bulk_buffer bulk{sink.rdbuf()};
+    sink.rdbuf(&bulk);
+
+    Segment seg;
+    Token_stream ts{text};
+    std::size_t origin{0}; // the offset of ts in text
+    std::size_t count{0};
+    while (next_statement(ts)) {
+        ++count;
+        std::size_t start{origin + ts.position()};
+        Token t{ts.get()};
+        ts.putback(t);
+        bool is_alone{t.kind == Symbol::fn_tok || t.kind == Symbol::bind_tok ||
+                      t.kind == Symbol::save_tok || t.kind == Symbol::load_tok};
+        if (!is_alone && plan(seg, ts, start)) {
+            if (seg.entries.size() >= max_segment) {
+                run(seg, sink, err, threads);
+            }
+            continue;
+        }
+
+        // Run what has been parsed, then this statement, parsed again.
+        run(seg, sink, err, threads);
+        origin = start;
+        ts = Token_stream{text.substr(start)};
+        execute_statement(ts, sink, err);
+    }
+    run(seg, sink, err, threads);
+    sink.flush();
+    return count;
+}
+
+// Print the factorial of an integer exactly, if the statement is one and
+// exact factorials are wanted.
+bool Session::print_exact(const Statement& s, std::ostream& out)
+{
+    if (!exact || s.kind != Stmt::expression || s.expr->op != Op::fact) {
+        return false;
+    }
+    Phase_timer timer{stats, Phase::evaluate};
+    Result<double> n{try_run(emit(*s.expr->args[0]), table.bindings())};
+    if (!n || !(*n >= 0 && *n <= max_exact_factorial) ||
+        *n != std::trunc(*n)) {
+        return false; // leave it to be computed, or fail, as a double
+    }
+    std::string digits{
+        exact_factorial(static_cast<unsigned>(*n)).to_string()};
+    digits += '\n';
+    out.write(digits.data(), static_cast<std::streamsize>(digits.size()));
+    return true;
+}
+
+// Execute every statement in a text.
+std::size_t Session::execute(std::string_view text, std::ostream& out,
+                             std::ostream& err)
+{
+    Token_stream ts{text};
+    return execute(ts, out, err);
+}
+
+// Execute the statements in a text until one fails.
+std::size_t Session::execute_until_error(
+    std::string_view text, std::ostream& out,
+    const std::function<void(const Error&)>& fail)
+{
+    Token_stream ts{text};
+    std::size_t count{0};
+    while (next_statement(ts)) {
+        if (stats) {
+            ++stats->statements;
+        }
+        if (!try_statement(ts, out, fail)) {
+            return count;
+        }
+        ++count;
+    }
+    return count;
+}
+
+// Count and time the work the session does from now on.
+void Session::collect(Stats* s)
+{
+    stats = s;
+    table.stats = s;
+}
+
+// Profile the statements the session runs from now on.
+void Session::collect(Profile* p)
+{
+    profile = p;
+}
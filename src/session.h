@@ -0,0 +1,268 @@
+// session.h: Calculator session interface.
+// SPDX-FileCopyrightText: © 2021-2022 Bradley M. Jones <brdjns@gmx.us>
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "bytecode.h"
+#include "format.h"
+#include "number.h"
+#include "result.h"
+#include "symbol_table.h"
+#include "token.h"
+#include <cstddef>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+class Profile;
+class Stats;
+class Statement;
+
+// @brief Constants.
+namespace Constant {
+    constexpr double e = 2.71828182845904523536;       // e
+    constexpr double log2e = 1.44269504088896340736;   // log2(e)
+    constexpr double log10e = 0.434294481903251827651; // log10(e)
+    constexpr double ln2 = 0.693147180559945309417;    // ln(2)
+    constexpr double ln10 = 2.30258509299404568402;    // ln(10)
+    constexpr double pi = 3.14159265358979323846;      // pi
+    constexpr double pi_2 = 1.57079632679489661923;    // pi/2
+    constexpr double pi_4 = 0.785398163397448309616;   // pi/4
+    constexpr double sqrt2 = 1.41421356237309504880;   // sqrt(2)
+}
+
+// @class Session
+// @brief An independent calculator.
+// @details A session owns its variables and shares no mutable state with any
+// other session, so sessions on different threads can evaluate concurrently
+// without locking.  A single session is not safe to share between threads.
+class Session {
+public:
+    // @brief Construct a session with the predefined constants declared.
+    Session();
+
+    Session(const Session&) = delete;
+    Session& operator=(const Session&) = delete;
+
+    // @brief Evaluate a single statement.
+    // @param src a statement, optionally terminated by ';'.
+    // @throws std::runtime_error if the statement is invalid or fails.
+    // @return The value of the statement, or 0 for a function definition.
+    double evaluate(const std::string& src);
+
+    // @brief Execute every statement in a stream of tokens.
+    // @details Results are written to out and errors to err; after an error,
+    // execution resumes at the next statement.  Where ts scans text in
+    // place, results are collected and written to out in bulk.
+    // @param ts a stream of tokens.
+    // @param out the stream to write results to.
+    // @param err the stream to write errors to.
+    // @param prompt text written to out before each statement.
+    // @return The number of statements executed, including any that failed.
+    std::size_t execute(Token_stream& ts, std::ostream& out,
+                        std::ostream& err, const std::string& prompt = "");
+
+    // @brief Execute every statement in a text.
+    // @param text the statements.
+    // @param out the stream to write results to.
+    // @param err the stream to write errors to.
+    // @return The number of statements executed, including any that failed.
+    std::size_t execute(std::string_view text, std::ostream& out,
+                        std::ostream& err);
+
+    // @brief Execute the statements in a text until one fails.
+    // @details Results are written to out as execute writes them.  What the
+    // statements before one that fails did stands, and the statements after
+    // it are not run.
+    // @param text the statements.
+    // @param out the stream to write results to.
+    // @param fail called with the error that stopped the statements, if any;
+    // its position is an offset in text.
+    // @return The number of statements that ran without error.
+    std::size_t execute_until_error(
+        std::string_view text, std::ostream& out,
+        const std::function<void(const Error&)>& fail);
+
+    // @brief Execute every statement in a text, running statements that do
+    // not depend on each other concurrently.
+    // @details The statements are parsed ahead, in runs, and each waits only
+    // for the earlier statements that write a variable it reads or writes, or
+    // read a variable it writes.  Results and errors are written in the order
+    // of the statements, and are the same as execute would write.  Function
+    // definitions, saves and loads, statements whose extent depends on how
+    // earlier ones fare, and statements that bind or read bound variables,
+    // or set variables that bound variables read, are run alone, once the
+    // statements before them have run.  Without counters or a profile, and
+    // in double, statements run on up to threads threads; otherwise they run
+    // one after another.
+    // @param text the statements.
+    // @param out the stream to write results to.
+    // @param err the stream to write errors to.
+    // @param threads the most threads to run statements on.
+    // @return The number of statements executed, including any that failed.
+    std::size_t execute_parallel(std::string_view text, std::ostream& out,
+                                 std::ostream& err, unsigned threads);
+
+    // @brief Save the session's variables, functions and bindings to a
+    // snapshot file.
+    // @param path the file's name.
+    // @throws std::runtime_error if the file cannot be written.
+    void save(const std::string& path);
+
+    // @brief Replace the session's variables, functions and bindings with
+    // those of a snapshot file.
+    // @param path the file's name.
+    // @throws std::runtime_error if the file is not a readable snapshot; the
+    // session is then unchanged.
+    void load(const std::string& path);
+
+    // @brief Retrieve the session's variables.
+    // @return The symbol table.
+    Symbol_table& symbols() { return table; }
+
+    // @brief Count and time the work the session does from now on.
+    // @details While no counters are given, the session does no more than
+    // test for them.
+    // @param s the counters to update, or nullptr to stop counting.
+    void collect(Stats* s);
+
+    // @brief Profile the statements the session runs from now on.
+    // @details Statements are profiled as written, and are not optimised
+    // while a profile is collected, but for their integer subexpressions
+    // being folded, so that they compute what they would optimised.
+    // @param p the profile to add to, or nullptr to stop profiling.
+    void collect(Profile* p);
+
+    // @brief Print results in a number format from now on.
+    // @param f a number format; results are printed in the shortest form
+    // that reads back as the same number until one is given.
+    void format(const Number_format& f) { numbers = f; }
+
+    // @brief Evaluate statements in a number type from now on.
+    // @details Statements are evaluated in double, optimised and compiled to
+    // bytecode, until another number type is given.  In any other type they
+    // are evaluated, unoptimised, by an Evaluator (src/evaluate.h) of that
+    // type, and variables hold values of that type; the symbol table holds
+    // the double nearest each.
+    // @param n a number type.
+    void numeric(Numeric n);
+
+    // @brief Print the factorials of integers exactly from now on.
+    // @details The value of an expression statement n!, where n is an
+    // integer no greater than max_exact_factorial, is printed with all of
+    // its digits rather than as a double.
+    // @param on true to print factorials exactly; false otherwise.
+    void exact_factorials(bool on) { exact = on; }
+
+    // @brief Count the expression tree nodes the optimiser has removed.
+    // @return The number of nodes removed from the statements compiled.
+    long nodes_removed() const { return removed; }
+
+private:
+    class Segment; // statements parsed ahead, to run together
+
+    Symbol_table table;    // the session's variables
+    long removed{};        // nodes removed by the optimiser
+    Stats* stats{};        // counters to update, if any
+    Profile* profile{};    // the profile to add to, if any
+    Program program;       // the statement last compiled
+    Number_format numbers; // how results are printed
+    bool exact{};          // true to print factorials exactly
+
+    // The number type statements are evaluated in.
+    Numeric arithmetic{Numeric::binary64};
+
+    // Variable values in number types other than double, indexed by slot.
+    std::tuple<std::vector<float>, std::vector<long double>,
+               std::vector<Double_double>>
+        typed;
+
+    // @brief Retrieve variable values in a number type other than double,
+    // adding any variables declared since they were last retrieved.
+    template<class T>
+    std::vector<T>& values();
+
+    // @brief Run a statement in a number type other than double.
+    // @return The value of the statement, or the error that stopped it.
+    template<class T>
+    Result<T> run_as(const Statement& s);
+
+    // @brief Run a statement in the session's number type, other than
+    // double, and print its value.
+    // @return The error that stopped the statement, if any.
+    Error print_numeric(const Statement& s, std::ostream& out);
+
+    // @brief Define a function.
+    // @return The error that stopped the definition, if any.
+    Error define_function(const Statement& s);
+
+    // @brief Optimise, compile and run a statement, or profile it.
+    // @return The value of the statement, or the error that stopped it.
+    Result<double> run_statement(Statement& s);
+
+    // @brief Print the factorial of an integer exactly, if the statement is
+    // one and exact factorials are wanted.
+    // @return True if the statement was printed.
+    bool print_exact(const Statement& s, std::ostream& out);
+
+    // @brief Save or load a snapshot, as a statement says.
+    // @return The error that stopped it, if any.
+    Error snapshot(const Statement& s);
+
+    // @brief Compile the expression a bind statement binds its variable to,
+    // before the statement is optimised.
+    // @return The binding, or null if s is not a bind statement.
+    std::shared_ptr<const Binding> bind_expression(const Statement& s);
+
+    // @brief Note what a statement that has run assigned to: the variables
+    // bound to a variable set are out of date, and a bound variable is bound.
+    // @param b the binding of a bind statement.
+    void assigned(const Statement& s, std::shared_ptr<const Binding> b);
+
+    // @brief Bring the bound variables a statement reads up to date, in the
+    // session's number type.
+    // @return The error that stopped a computation, if any.
+    Error refresh(const Statement& s);
+
+    // @brief Print the value of a statement that has run.
+    void print_value(double value, std::ostream& out);
+
+    // @brief Skip empty statements.
+    // @return False at the end of input.
+    bool next_statement(Token_stream& ts);
+
+    // @brief Parse, run and print a statement, or pass the error that
+    // stopped it to fail, and skip the rest of the statement.
+    // @return True if the statement ran.
+    template<class F>
+    bool try_statement(Token_stream& ts, std::ostream& out, const F& fail);
+
+    // @brief Parse, run and print a statement, or report why it failed.
+    void execute_statement(Token_stream& ts, std::ostream& out,
+                           std::ostream& err);
+
+    // @brief Parse a statement into a segment, unless it must run alone.
+    // @param start the offset of the statement in the text.
+    // @return False if the statement must run alone, once the segment has.
+    bool plan(Segment& seg, Token_stream& ts, std::size_t start);
+
+    // @brief Run a statement of a segment, once those it waits for have run.
+    // @return The number of nodes the optimiser removed.
+    int run_entry(Segment& seg, std::size_t i);
+
+    // @brief Run the statements of a segment, print their results in order,
+    // and empty it.
+    void run(Segment& seg, std::ostream& out, std::ostream& err,
+             unsigned threads);
+
+    // @brief Execute statements until the end of input, printing prompt
+    // before each.
+    std::size_t execute_statements(Token_stream& ts, std::ostream& out,
+                                   std::ostream& err,
+                                   const std::string& prompt);
+};
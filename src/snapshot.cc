@@ -0,0 +1,531 @@
+// snapshot.cc: Session snapshots.
+// SPDX-FileCopyrightText: © 2021-2022 Bradley M. Jones <brdjns@gmx.us>
+// SPDX-License-Identifier: MIT
+
+#include "snapshot.h"
+#include "function.h"
+#include "mapped_file.h"
+#include "optimise.h"
+#include "symbol_table.h"
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <limits>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace {
+    constexpr char magic[8]{'c', 'a', 'l', 'c', 's', 'n', 'a', 'p'};
+
+    // Written as it lies in memory, so that a snapshot is read only where
+    // it was written in the same byte order.
+    constexpr std::uint32_t byte_order{0x01020304};
+
+    // The deepest tree read; a deeper one is taken to be malformed.
+    constexpr int max_depth{1 << 14};
+
+    // The start of a snapshot.
+    class Header {
+    public:
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t byte_order;
+        std::uint64_t size; // the size of the file, in bytes
+        std::uint32_t variables;
+        std::uint32_t functions;
+        std::uint32_t bindings;
+        std::uint32_t nodes;
+        std::uint32_t parameters;
+        std::uint32_t text; // the size of the text, in bytes
+    };
+
+    // A name or spelling, in the text.
+    class Text {
+    public:
+        std::uint32_t offset;
+        std::uint32_t size;
+    };
+
+    class Variable_record {
+    public:
+        Text name;
+        std::uint8_t is_const;
+        std::uint8_t is_stale;
+        std::uint8_t unused[2];
+    };
+
+    class Function_record {
+    public:
+        Text name;
+        std::uint32_t first_parameter; // its first, in the parameters
+        std::uint32_t parameters;      // the number of parameters
+        std::uint32_t body;            // the root of its body, in the nodes
+    };
+
+    class Binding_record {
+    public:
+        std::uint32_t slot; // the variable bound
+        std::uint32_t expr; // the root of its expression, in the nodes
+    };
+
+    class Node_record {
+    public:
+        double value;
+        std::int64_t integer;
+        std::int32_t slot;
+        std::int32_t callee; // a function, in the functions, or -1
+        Text text;
+        std::uint8_t op;
+        std::uint8_t type;
+        std::uint16_t unused;
+        std::uint32_t args; // the number of operands, which follow it
+    };
+
+    // The offsets of a snapshot's arrays, each aligned to 8 bytes.
+    class Layout {
+    public:
+        std::size_t values, hashes, variables, functions, bindings, nodes,
+            parameters, text, size;
+
+        explicit Layout(const Header& h)
+        {
+            std::size_t at{sizeof(Header)};
+            auto place = [&](std::size_t count, std::size_t each) {
+                std::size_t start{at};
+                at = (at + count * each + 7) & ~std::size_t{7};
+                return start;
+            };
+            values = place(h.variables, sizeof(double));
+            hashes = place(h.variables, sizeof(std::uint32_t));
+            variables = place(h.variables, sizeof(Variable_record));
+            functions = place(h.functions, sizeof(Function_record));
+            bindings = place(h.bindings, sizeof(Binding_record));
+            nodes = place(h.nodes, sizeof(Node_record));
+            parameters = place(h.parameters, sizeof(Text));
+            text = place(h.text, 1);
+            size = at;
+        }
+    };
+
+    // The records of a snapshot, as they are gathered to be written.
+    class Writer {
+    public:
+        std::vector<Variable_record> variables;
+        std::vector<Function_record> functions;
+        std::vector<Binding_record> bindings;
+        std::vector<Node_record> nodes;
+        std::vector<Text> parameters;
+        std::string text;
+
+        // The functions' numbers, in the order they were defined.
+        std::unordered_map<const Function*, std::int32_t> numbers;
+
+        // Add a name or spelling.
+        Text add(std::string_view s)
+        {
+            Text t{static_cast<std::uint32_t>(text.size()),
+                   static_cast<std::uint32_t>(s.size())};
+            text += s;
+            return t;
+        }
+
+        // Add a tree, in prefix order.  A reduction's body follows its
+        // arguments, and its text is the body's parameters, joined by
+        // commas.
+        // @return The index of its root.
+        std::uint32_t add(const Node& n)
+        {
+            auto root = static_cast<std::uint32_t>(nodes.size());
+            bool is_reduce{n.op == Op::reduce};
+            Node_record r{};
+            r.value = n.value;
+            r.integer = n.integer;
+            r.slot = n.slot;
+            r.callee = n.op == Op::call ? numbers.at(n.callee.get()) : -1;
+            if (is_reduce) {
+                std::string names;
+                for (const std::string& p : n.callee->parameters) {
+                    names += (names.empty() ? "" : ",") + p;
+                }
+                r.text = add(names);
+            }
+            else {
+                r.text = add(n.text);
+            }
+            r.op = static_cast<std::uint8_t>(n.op);
+            r.type = static_cast<std::uint8_t>(n.type);
+            r.args = static_cast<std::uint32_t>(n.args.size() + is_reduce);
+            nodes.push_back(r);
+            for (const Node_ptr& arg : n.args) {
+                add(*arg);
+            }
+            if (is_reduce) {
+                add(*n.callee->body);
+            }
+            return root;
+        }
+    };
+
+    // Copy an array of records into a snapshot.
+    template<class T>
+    void place(std::string& out, std::size_t offset, const std::vector<T>& v)
+    {
+        if (!v.empty()) {
+            std::memcpy(&out[offset], v.data(), v.size() * sizeof(T));
+        }
+    }
+
+    // The records of a snapshot, as they lie in the mapped file.
+    class Reader {
+    public:
+        Reader(const char* start, const Header& header, Symbol_table& into,
+               Error fail)
+            : base{start}, h{header}, at{header}, table{into}, failed{fail},
+              nodes{array<Node_record>(at.nodes)}, text{base + at.text}
+        {}
+
+        const char* base; // the file
+        const Header& h;
+        Layout at;
+        Symbol_table& table; // the table being loaded
+        Error failed;        // the error for a malformed snapshot
+        const Node_record* nodes;
+        const char* text;
+
+        // Find an array: the file is mapped at a page boundary, and each
+        // array is aligned within it.
+        template<class T>
+        const T* array(std::size_t offset) const
+        {
+            return reinterpret_cast<const T*>(base + offset);
+        }
+
+        // Determine if a text lies in the text.
+        bool valid(Text t) const
+        {
+            return t.offset <= h.text && t.size <= h.text - t.offset;
+        }
+
+        // View a text.
+        std::string_view view(Text t) const
+        {
+            return {text + t.offset, t.size};
+        }
+
+        // Build the tree whose root is node next, in a function of params
+        // parameters, and advance next past it.
+        Result<Node_ptr> tree(std::uint32_t& next, std::uint32_t params,
+                              int depth)
+        {
+            if (next >= h.nodes || depth > max_depth) {
+                return failed;
+            }
+            const Node_record& r{nodes[next++]};
+            if (r.op > static_cast<std::uint8_t>(Op::reduce) || r.type > 1 ||
+                !valid(r.text)) {
+                return failed;
+            }
+            auto n = std::make_unique<Node>(r.value);
+            n->op = static_cast<Op>(r.op);
+            n->text = std::string{view(r.text)};
+            n->type = static_cast<Type>(r.type);
+            n->integer = r.integer;
+            n->slot = r.slot;
+            std::size_t arity{0};
+            switch (n->op) {
+            case Op::number:
+                break;
+            case Op::load:
+                if (r.slot < 0 ||
+                    static_cast<std::uint32_t>(r.slot) >= h.variables) {
+                    return failed;
+                }
+                break;
+            case Op::neg:
+            case Op::fact:
+            case Op::sqrt:
+            case Op::abs:
+                arity = 1;
+                break;
+            case Op::add:
+            case Op::sub:
+            case Op::mul:
+            case Op::div:
+            case Op::mod:
+            case Op::pow:
+                arity = 2;
+                break;
+            case Op::builtin:
+                if (r.slot < 0 ||
+                    static_cast<std::size_t>(r.slot) >= builtin_count) {
+                    return failed;
+                }
+                arity = static_cast<std::size_t>(builtins[r.slot].arity);
+                break;
+            case Op::call:
+                if (r.callee < 0 || static_cast<std::size_t>(r.callee) >=
+                                        table.fn_table.size()) {
+                    return failed;
+                }
+                n->callee = table.fn_table[r.callee];
+                arity = n->callee->arity();
+                break;
+            case Op::arg:
+                if (r.slot < 0 ||
+                    static_cast<std::uint32_t>(r.slot) >= params) {
+                    return failed;
+                }
+                break;
+            case Op::reduce: // the bounds, the captures, then the body
+                if (r.slot < 0 ||
+                    static_cast<std::size_t>(r.slot) >= reduction_count ||
+                    r.args < 3) {
+                    return failed;
+                }
+                n->text.clear();
+                arity = r.args - 1;
+                break;
+            case Op::bind: // trees are saved as written, without temporaries
+            case Op::temp:
+                return failed;
+            }
+            if (r.args != arity + (n->op == Op::reduce)) {
+                return failed;
+            }
+            for (std::size_t i = 0; i < arity; ++i) {
+                Result<Node_ptr> arg{tree(next, params, depth + 1)};
+                if (!arg) {
+                    return arg;
+                }
+                n->args.push_back(std::move(*arg));
+            }
+            if (n->op == Op::reduce) {
+                return reduction(std::move(n), view(r.text), next, depth);
+            }
+            return n;
+        }
+
+        // Compile the body of reduction n, which follows its arguments and
+        // takes the parameters named, joined by commas, and advance next
+        // past it.
+        Result<Node_ptr> reduction(Node_ptr n, std::string_view names,
+                                   std::uint32_t& next, int depth)
+        {
+            std::vector<std::string> parameters;
+            for (std::size_t start = 0;;) {
+                std::size_t end{std::min(names.find(',', start), names.size())};
+                if (end == start) {
+                    return failed;
+                }
+                parameters.emplace_back(names.substr(start, end - start));
+                if (end == names.size()) {
+                    break;
+                }
+                start = end + 1;
+            }
+            if (parameters.size() != n->args.size() - 1) {
+                return failed;
+            }
+            Result<Node_ptr> body{tree(
+                next, static_cast<std::uint32_t>(parameters.size()),
+                depth + 1)};
+            if (!body) {
+                return body;
+            }
+            n->callee = reduction_body(static_cast<Reduction>(n->slot),
+                                       std::move(parameters),
+                                       std::move(*body), table);
+            return n;
+        }
+    };
+}
+
+// Save a symbol table's variables, functions and bindings to a file.
+Error save_snapshot(const Symbol_table& table, const std::string& path)
+{
+    Writer w;
+    w.variables.reserve(table.var_table.size());
+    std::vector<std::uint32_t> hashes;
+    hashes.reserve(table.var_table.size());
+    for (std::size_t i = 0; i < table.var_table.size(); ++i) {
+        const Variable& v{table.var_table[i]};
+        Variable_record r{};
+        r.name = w.add(v.name);
+        r.is_const = v.is_const;
+        r.is_stale = v.is_stale;
+        w.variables.push_back(r);
+        hashes.push_back(table.name_hash(static_cast<int>(i)));
+    }
+    for (const auto& f : table.fn_table) {
+        Function_record r{};
+        r.name = w.add(f->name);
+        r.first_parameter = static_cast<std::uint32_t>(w.parameters.size());
+        r.parameters = static_cast<std::uint32_t>(f->arity());
+        for (const std::string& p : f->parameters) {
+            w.parameters.push_back(w.add(p));
+        }
+        r.body = w.add(*f->body);
+        w.numbers.emplace(f.get(),
+                          static_cast<std::int32_t>(w.functions.size()));
+        w.functions.push_back(r);
+    }
+    for (std::size_t i = 0; i < table.var_table.size(); ++i) {
+        if (const auto& b = table.var_table[i].binding) {
+            w.bindings.push_back(Binding_record{static_cast<std::uint32_t>(i),
+                                                w.add(*b->expr)});
+        }
+    }
+    if (w.text.size() > std::numeric_limits<std::uint32_t>::max() ||
+        w.nodes.size() > std::numeric_limits<std::uint32_t>::max()) {
+        return Error{Errc::save_failed, 0, path};
+    }
+
+    Header h{};
+    std::memcpy(h.magic, magic, sizeof magic);
+    h.version = snapshot_version;
+    h.byte_order = byte_order;
+    h.variables = static_cast<std::uint32_t>(w.variables.size());
+    h.functions = static_cast<std::uint32_t>(w.functions.size());
+    h.bindings = static_cast<std::uint32_t>(w.bindings.size());
+    h.nodes = static_cast<std::uint32_t>(w.nodes.size());
+    h.parameters = static_cast<std::uint32_t>(w.parameters.size());
+    h.text = static_cast<std::uint32_t>(w.text.size());
+    Layout at{h};
+    h.size = at.size;
+
+    std::string out(at.size, '\0');
+    std::memcpy(&out[0], &h, sizeof h);
+    place(out, at.values, table.values);
+    place(out, at.hashes, hashes);
+    place(out, at.variables, w.variables);
+    place(out, at.functions, w.functions);
+    place(out, at.bindings, w.bindings);
+    place(out, at.nodes, w.nodes);
+    place(out, at.parameters, w.parameters);
+    std::memcpy(&out[at.text], w.text.data(), w.text.size());
+
+    std::ofstream file{path, std::ios::binary};
+    if (!file.write(out.data(), static_cast<std::streamsize>(out.size())) ||
+        !file.flush()) {
+        return Error{Errc::save_failed, 0, path};
+    }
+    return Error{};
+}
+
+// Replace a symbol table's variables, functions and bindings with those of
+// a snapshot.
+Error load_snapshot(Symbol_table& table, const std::string& path)
+{
+    Error failed{Errc::load_failed, 0, path};
+    std::optional<Mapped_file> file;
+    try {
+        file.emplace(path);
+    }
+    catch (const std::exception&) {
+        return failed;
+    }
+    std::string_view data{file->text()};
+    Header h;
+    if (data.size() < sizeof h) {
+        return failed;
+    }
+    std::memcpy(&h, data.data(), sizeof h);
+    if (std::memcmp(h.magic, magic, sizeof magic) != 0 ||
+        h.version != snapshot_version || h.byte_order != byte_order ||
+        h.size != data.size() || Layout{h}.size != data.size()) {
+        return failed;
+    }
+
+    Symbol_table loaded;
+    loaded.stats = table.stats;
+    Reader r{data.data(), h, loaded, failed};
+
+    // The variables, copied as they lie.
+    const auto* values = r.array<double>(r.at.values);
+    const auto* hashes = r.array<std::uint32_t>(r.at.hashes);
+    const auto* variables = r.array<Variable_record>(r.at.variables);
+    std::vector<Variable> vars;
+    vars.reserve(h.variables);
+    for (std::uint32_t i = 0; i < h.variables; ++i) {
+        if (!r.valid(variables[i].name)) {
+            return failed;
+        }
+        vars.emplace_back(std::string{r.view(variables[i].name)},
+                          variables[i].is_const != 0);
+        vars.back().is_stale = variables[i].is_stale != 0;
+    }
+    loaded.restore(std::move(vars),
+                   std::vector<double>(values, values + h.variables),
+                   std::vector<std::uint32_t>(hashes, hashes + h.variables));
+
+    // The functions, compiled again in the order they were defined.
+    const auto* functions = r.array<Function_record>(r.at.functions);
+    const auto* parameters = r.array<Text>(r.at.parameters);
+    for (std::uint32_t i = 0; i < h.functions; ++i) {
+        const Function_record& f{functions[i]};
+        if (!r.valid(f.name) || f.name.size == 0 ||
+            f.first_parameter > h.parameters ||
+            f.parameters > h.parameters - f.first_parameter) {
+            return failed;
+        }
+        Statement s;
+        s.kind = Stmt::function;
+        s.name = std::string{r.view(f.name)};
+        for (std::uint32_t p = 0; p < f.parameters; ++p) {
+            Text name{parameters[f.first_parameter + p]};
+            if (!r.valid(name)) {
+                return failed;
+            }
+            s.parameters.emplace_back(r.view(name));
+        }
+        std::uint32_t next{f.body};
+        Result<Node_ptr> body{r.tree(next, f.parameters, 0)};
+        if (!body) {
+            return failed;
+        }
+        s.expr = std::move(*body);
+        if (define(s, loaded)) {
+            return failed;
+        }
+    }
+
+    // The bindings, compiled again.
+    const auto* bindings = r.array<Binding_record>(r.at.bindings);
+    for (std::uint32_t i = 0; i < h.bindings; ++i) {
+        const Binding_record& b{bindings[i]};
+        if (b.slot >= h.variables ||
+            loaded.is_bound(static_cast<int>(b.slot))) {
+            return failed;
+        }
+        std::uint32_t next{b.expr};
+        Result<Node_ptr> expr{r.tree(next, 0, 0)};
+        if (!expr) {
+            return failed;
+        }
+        Statement s;
+        s.kind = Stmt::bind;
+        s.expr = std::move(*expr);
+        std::shared_ptr<const Binding> bound{binding(s, loaded)};
+
+        // A variable is bound to variables declared before it, so bindings
+        // never form a cycle.
+        for (int slot : bound->reads) {
+            if (slot >= static_cast<int>(b.slot)) {
+                return failed;
+            }
+        }
+        loaded.bind(static_cast<int>(b.slot), std::move(bound));
+    }
+    for (const Variable& v : loaded.var_table) {
+        if (v.is_stale && !v.binding) {
+            return failed;
+        }
+    }
+
+    table = std::move(loaded);
+    return Error{};
+}
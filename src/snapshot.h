@@ -0,0 +1,41 @@
+// snapshot.h: Session snapshot interface.
+// SPDX-FileCopyrightText: © 2021-2022 Bradley M. Jones <brdjns@gmx.us>
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "result.h"
+#include <cstdint>
+#include <string>
+
+class Symbol_table;
+
+// The version of the snapshot format; snapshots of other versions are not
+// read.
+constexpr std::uint32_t snapshot_version{1};
+
+// @brief Save a symbol table's variables, functions and bindings to a file.
+// @details A snapshot is a header followed by arrays of fixed-size records,
+// each aligned for its type, in the byte order of the machine that wrote it:
+// the variables' values, their names' hashes, the variables, the functions,
+// the bindings, the nodes of the functions' bodies and of the bound
+// expressions, written as they were parsed, in prefix order, with the body of
+// a reduction after its arguments, the functions' parameters, and last the
+// text of the names and literals.
+// @param table a symbol table.
+// @param path the file's name.
+// @return Errc::save_failed if the file cannot be written.
+Error save_snapshot(const Symbol_table& table, const std::string& path);
+
+// @brief Replace a symbol table's variables, functions and bindings with
+// those of a snapshot.
+// @details The file is mapped, and values, hashes and names are copied from
+// it as they lie, so the hash index is built in one pass and nothing is
+// lexed or parsed; functions, bound expressions and the bodies of
+// reductions are compiled again from their trees.  The table is unchanged
+// if the snapshot cannot be read.
+// @param table a symbol table.
+// @param path the file's name.
+// @return Errc::load_failed if the file cannot be read, is not a snapshot
+// of this version and byte order, or is malformed.
+Error load_snapshot(Symbol_table& table, const std::string& path);
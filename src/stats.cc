@@ -0,0 +1,79 @@
+// stats.cc: Instrumentation.
+// SPDX-FileCopyrightText: © 2021-2022 Bradley M. Jones <brdjns@gmx.us>
+// SPDX-License-Identifier: MIT
+
+#include "stats.h"
+#include <cstdio>
+
+namespace {
+    // Phase names, for reports.
+    const char* const phase_names[phases]{
+        "other",   "lex",      "parse",   "lookup", "optimise",
+        "compile", "evaluate", "recover", "output",
+    };
+}
+
+// Construct counters and timers that start now, in Phase::other.
+Stats::Stats()
+    : since{cycle_count()}, start{since},
+      start_time{std::chrono::steady_clock::now()}
+{}
+
+// Print the counters, and the time spent in each phase.
+void Stats::report(std::ostream& os)
+{
+    enter(current); // charge the phase being timed up to now
+    std::chrono::duration<double> elapsed{std::chrono::steady_clock::now() -
+                                          start_time};
+    std::uint64_t total{since - start};
+    double seconds_per_cycle{total == 0 ? 0 : elapsed.count() / total};
+
+    char line[128];
+    auto counter = [&](const char* name, std::uint64_t value) {
+        std::snprintf(line, sizeof line, "%-16s %16llu\n", name,
+                      static_cast<unsigned long long>(value));
+        os << line;
+    };
+    counter("tokens", tokens);
+    counter("statements", statements);
+    counter("errors", errors);
+    counter("symbol probes", probes);
+    counter("bytes read", bytes_read);
+    counter("bytes written", bytes_written);
+
+    std::snprintf(line, sizeof line, "%-16s %16s %12s %7s\n", "phase",
+                  "cycles", "ms", "%");
+    os << line;
+    for (int i = 0; i < phases; ++i) {
+        std::snprintf(line, sizeof line, "%-16s %16llu %12.3f %7.2f\n",
+                      phase_names[i],
+                      static_cast<unsigned long long>(cycles[i]),
+                      cycles[i] * seconds_per_cycle * 1e3,
+                      total == 0 ? 0.0 : 100.0 * cycles[i] / total);
+        os << line;
+    }
+}
+
+// Write a character, and count it.
+int Counting_buffer::overflow(int ch)
+{
+    if (ch == traits_type::eof()) {
+        return traits_type::not_eof(ch);
+    }
+    ++count;
+    return out->sputc(static_cast<char>(ch));
+}
+
+// Write characters, and count them.
+std::streamsize Counting_buffer::xsputn(const char* s, std::streamsize n)
+{
+    std::streamsize written{out->sputn(s, n)};
+    count += static_cast<std::uint64_t>(written);
+    return written;
+}
+
+// Flush the stream buffer written to.
+int Counting_buffer::sync()
+{
+    return out->pubsync();
+}
@@ -0,0 +1,137 @@
+// stats.h: Instrumentation interface.
+// SPDX-FileCopyrightText: © 2021-2022 Bradley M. Jones <brdjns@gmx.us>
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <streambuf>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// The phases of executing a statement.  Each phase's time excludes the time
+// spent in phases nested within it, such as lexing within parsing.
+enum class Phase : unsigned char {
+    other,    // time outside every other phase
+    lex,      // scanning tokens
+    parse,    // building expression trees
+    lookup,   // finding variables in the symbol table
+    optimise, // optimising expression trees
+    compile,  // emitting bytecode
+    evaluate, // running bytecode
+    recover,  // reporting errors and skipping to the next statement
+    output,   // formatting and writing results
+};
+
+constexpr int phases{static_cast<int>(Phase::output) + 1};
+
+// @brief Read a cycle counter: the time-stamp counter where there is one,
+// and otherwise a clock in nanoseconds.
+// @return The count.
+inline std::uint64_t cycle_count()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return static_cast<std::uint64_t>(
+        std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+}
+
+// @class Stats
+// @brief Counters and phase timers.
+// @details Instrumented code takes a pointer to a Stats object, and does
+// no more than test that pointer when it is null.
+class Stats {
+public:
+    std::uint64_t tokens{};        // tokens lexed
+    std::uint64_t statements{};    // statements executed
+    std::uint64_t errors{};        // statements that failed
+    std::uint64_t probes{};        // symbol table slots probed
+    std::uint64_t bytes_read{};    // input scanned
+    std::uint64_t bytes_written{}; // results written
+    std::uint64_t cycles[phases]{}; // cycles spent in each phase
+
+    // @brief Construct counters and timers that start now, in Phase::other.
+    Stats();
+
+    // @brief Enter a phase, charging the cycles since the last change of
+    // phase to the phase being left.
+    // @param p the phase to enter.
+    // @return The phase left.
+    Phase enter(Phase p)
+    {
+        std::uint64_t now{cycle_count()};
+        cycles[static_cast<int>(current)] += now - since;
+        since = now;
+        Phase old{current};
+        current = p;
+        return old;
+    }
+
+    // @brief Print the counters, and the time spent in each phase.
+    // @param os the stream to print to.
+    void report(std::ostream& os);
+
+private:
+    Phase current{Phase::other}; // the phase being timed
+    std::uint64_t since;         // the cycle count when current was entered
+    std::uint64_t start;         // the cycle count at construction
+    std::chrono::steady_clock::time_point start_time; // the time then
+};
+
+// @class Phase_timer
+// @brief Times a phase for as long as it is in scope.
+class Phase_timer {
+public:
+    // @brief Enter a phase.
+    // @param s the counters to update, or nullptr to time nothing.
+    // @param p the phase to enter.
+    Phase_timer(Stats* s, Phase p) : stats{s}
+    {
+        if (stats) {
+            old = stats->enter(p);
+        }
+    }
+
+    Phase_timer(const Phase_timer&) = delete;
+    Phase_timer& operator=(const Phase_timer&) = delete;
+
+    // @brief Return to the phase that was left.
+    ~Phase_timer()
+    {
+        if (stats) {
+            stats->enter(old);
+        }
+    }
+
+private:
+    Stats* stats;            // the counters to update, if any
+    Phase old{Phase::other}; // the phase to return to
+};
+
+// @class Counting_buffer
+// @brief A stream buffer that counts the characters written through it to
+// another.
+class Counting_buffer : public std::streambuf {
+public:
+    // @brief Construct a counting stream buffer.
+    // @param out the stream buffer to write to.
+    // @param count the counter to add to.
+    Counting_buffer(std::streambuf* out, std::uint64_t& count)
+        : out{out}, count{count}
+    {}
+
+protected:
+    int overflow(int ch) override;
+    std::streamsize xsputn(const char* s, std::streamsize n) override;
+    int sync() override;
+
+private:
+    std::streambuf* out;  // the stream buffer to write to
+    std::uint64_t& count; // the characters written
+};
@@ -4,53 +4,332 @@
 
 #include "symbol_table.h"
 #include "error.h"
+#include "stats.h"
+#include <algorithm>
+#include <utility>
 
-static Symbol_table names;
+namespace {
+    // Hash a name (FNV-1a).
+    std::uint32_t hash(std::string_view var)
+    {
+        std::uint32_t h{2166136261u};
+        for (char ch : var) {
+            h = (h ^ static_cast<unsigned char>(ch)) * 16777619u;
+        }
+        return h;
+    }
+
+    // The smallest hash index.
+    constexpr std::size_t min_index{64};
+}
+
+// Find a parameter, capturing it from an outer body if need be.
+int Scope::find(std::string_view name)
+{
+    auto i = std::find(names.begin(), names.end(), name);
+    if (i != names.end()) {
+        return static_cast<int>(i - names.begin());
+    }
+    if (!outer || outer->find(name) < 0) {
+        return -1;
+    }
+    names.emplace_back(name);
+    return static_cast<int>(names.size()) - 1;
+}
 
-// Retrieve a variable's value.
-double Symbol_table::get(std::string var)
+// Retrieve a variable's value, computing it if it is out of date.
+double Symbol_table::get(std::string_view var)
 {
-    for (Variable& i : names.var_table) {
-        if (i.name == var) {
-            return i.value;
+    int i{slot(var)};
+    if (var_table[i].is_stale) {
+        if (Error e{refresh(std::vector<int>{i})}) {
+            error(e);
         }
     }
-    error(var, " is undefined");
-    return 1;
+    return values[i];
 }
 
 // Assign a new value to a variable.
-void Symbol_table::set(std::string var, double val)
+void Symbol_table::set(std::string_view var, double val)
+{
+    int i{slot(var)};
+    if (var_table[i].is_const) {
+        error("cannot assign to a constant");
+    }
+    if (is_bound(i)) {
+        error("cannot assign to a bound variable");
+    }
+    values[i] = val;
+    touch(i);
+}
+
+// Determine if the specified variable is declared.
+bool Symbol_table::is_declared(std::string_view var)
+{
+    return lookup(var) != 0;
+}
+
+// Add a variable to the symbol table.
+double Symbol_table::declare(std::string_view var, double val, bool is_const)
+{
+    if (!add(var, val, is_const)) {
+        error(std::string{var}, " is defined");
+    }
+    return val;
+}
+
+// Add a variable to the symbol table, unless it is declared.
+bool Symbol_table::add(std::string_view var, double val, bool is_const)
+{
+    if (is_declared(var)) {
+        return false;
+    }
+    std::uint32_t h{hash(var)};
+    insert(h, static_cast<int>(var_table.size()) + 1);
+    var_table.push_back(Variable{std::string{var}, is_const});
+    values.push_back(val);
+    hashes.push_back(h);
+    return true;
+}
+
+// Undeclare a variable, leaving its slot, nameless, in place.
+void Symbol_table::forget(int i)
+{
+    // No name is empty, so the slot's entry in the hash index matches none.
+    var_table[i].name.clear();
+}
+
+// Bind a variable to the expression its value is computed from.
+void Symbol_table::bind(int i, std::shared_ptr<const Binding> b)
 {
-    for (Variable& i : names.var_table) {
-        if (i.name == var && i.is_const) {
-            error("cannot assign to a constant");
+    std::vector<int> inputs{b->reads};
+    std::sort(inputs.begin(), inputs.end());
+    inputs.erase(std::unique(inputs.begin(), inputs.end()), inputs.end());
+    for (int input : inputs) {
+        if (!var_table[input].is_const) { // a constant never changes
+            var_table[input].dependents.push_back(i);
         }
-        else if (i.name == var && (!i.is_const)) {
-            i.value = val;
-            return;
+    }
+    var_table[i].binding = std::move(b);
+}
+
+// Note that a variable has been assigned to, marking the bound variables
+// that depend on it out of date.
+void Symbol_table::touch(int i)
+{
+    if (var_table[i].dependents.empty()) {
+        return;
+    }
+    // The dependents of a variable out of date are out of date already, so
+    // each is visited once for each input that changes.
+    std::vector<int> work{var_table[i].dependents};
+    while (!work.empty()) {
+        Variable& v{var_table[work.back()]};
+        work.pop_back();
+        if (!v.is_stale) {
+            v.is_stale = true;
+            ++stale;
+            work.insert(work.end(), v.dependents.begin(), v.dependents.end());
         }
     }
-    error(var, " is undefined");
 }
 
-// Determine if the specified variable is declared.
-bool Symbol_table::is_declared(std::string var)
+// Bring variables up to date, computing those that are out of date after the
+// variables they read.
+Error Symbol_table::refresh(const std::vector<int>& slots,
+                            const Recompute& recompute)
 {
-    for (Variable& i : names.var_table) {
-        if (i.name == var) {
-            return true;
+    if (stale == 0) {
+        return Error{};
+    }
+    // A path of variables, each with the next of its inputs to bring up to
+    // date: a depth-first walk, kept off the call stack, since chains of
+    // bindings can be long.  A variable reads only those declared before it,
+    // so there are no cycles.
+    std::vector<std::pair<int, std::size_t>> path;
+    for (int root : slots) {
+        if (!var_table[root].is_stale) {
+            continue;
+        }
+        path.emplace_back(root, 0);
+        while (!path.empty()) {
+            int i{path.back().first};
+            const Binding& b{*var_table[i].binding};
+            if (path.back().second < b.reads.size()) {
+                int input{b.reads[path.back().second++]};
+                if (var_table[input].is_stale) {
+                    path.emplace_back(input, 0);
+                }
+                continue;
+            }
+            if (Error e{recompute(i, b)}) {
+                return e;
+            }
+            var_table[i].is_stale = false;
+            --stale;
+            path.pop_back();
         }
     }
-    return false;
+    return Error{};
 }
 
-// Add a variable to the symbol table.
-double Symbol_table::declare(std::string var, double val, bool is_const)
+// Bring variables up to date, computing in double.
+Error Symbol_table::refresh(const std::vector<int>& slots)
 {
-    if (names.is_declared(var)) {
-        error(var, " is defined");
+    return refresh(slots, [this](int i, const Binding& b) {
+        Result<double> value{b.code.try_evaluate(values.data())};
+        if (!value) {
+            return value.error();
+        }
+        values[i] = *value;
+        return Error{};
+    });
+}
+
+// Add a function to the symbol table, unless its name is declared.
+bool Symbol_table::define(std::shared_ptr<const Function> f)
+{
+    if (is_declared(f->name)) {
+        return false;
     }
-    names.var_table.push_back(Variable{var, val, is_const});
-    return val;
+    std::uint32_t h{hash(f->name)};
+    insert(h, -static_cast<int>(fn_table.size()) - 1);
+    fn_table.push_back(std::move(f));
+    fn_hashes.push_back(h);
+    return true;
+}
+
+// Look a variable up.
+int Symbol_table::find(std::string_view var)
+{
+    int entry{lookup(var)};
+    if (entry <= 0) {
+        return -1;
+    }
+    if (uses) {
+        uses->push_back(entry - 1);
+    }
+    return entry - 1;
+}
+
+// Look a function up.
+std::shared_ptr<const Function> Symbol_table::function(std::string_view name)
+{
+    int entry{lookup(name)};
+    return entry < 0 ? fn_table[-entry - 1] : nullptr;
+}
+
+// Look a name up.
+int Symbol_table::lookup(std::string_view name)
+{
+    if (index.empty()) {
+        return 0;
+    }
+    Phase_timer timer{stats, Phase::lookup};
+    std::uint32_t h{hash(name)};
+    std::size_t mask{index.size() - 1};
+    std::size_t i{h & mask};
+    int found{0};
+    std::uint64_t probes{1};
+    for (; index[i] != 0; i = (i + 1) & mask, ++probes) {
+        int entry{index[i]};
+        if (entry > 0 ? hashes[entry - 1] == h &&
+                            var_table[entry - 1].name == name
+                      : fn_hashes[-entry - 1] == h &&
+                            fn_table[-entry - 1]->name == name) {
+            found = entry;
+            break;
+        }
+    }
+    if (stats) {
+        stats->probes += probes;
+    }
+    return found;
+}
+
+// Find the slot that holds a variable's value.
+int Symbol_table::slot(std::string_view var)
+{
+    int i{find(var)};
+    if (i < 0) {
+        error(std::string{var}, " is undefined");
+    }
+    return i;
+}
+
+// Add an entry to the hash index, growing it if need be.
+void Symbol_table::insert(std::uint32_t h, int entry)
+{
+    if (2 * (var_table.size() + fn_table.size() + 1) > index.size()) {
+        grow();
+    }
+    std::size_t mask{index.size() - 1};
+    std::size_t i{h & mask};
+    while (index[i] != 0) {
+        i = (i + 1) & mask;
+    }
+    index[i] = entry;
+}
+
+// Rebuild the hash index with room for more names.
+void Symbol_table::grow()
+{
+    rebuild(index.empty() ? min_index : 2 * index.size());
+}
+
+// Rebuild the hash index.
+void Symbol_table::rebuild(std::size_t size)
+{
+    index.assign(size, 0);
+    std::size_t mask{size - 1};
+    auto place = [&](std::uint32_t h, int entry) {
+        std::size_t i{h & mask};
+        while (index[i] != 0) {
+            i = (i + 1) & mask;
+        }
+        index[i] = entry;
+    };
+    for (std::size_t s = 0; s < hashes.size(); ++s) {
+        place(hashes[s], static_cast<int>(s) + 1);
+    }
+    for (std::size_t f = 0; f < fn_hashes.size(); ++f) {
+        place(fn_hashes[f], -static_cast<int>(f) - 1);
+    }
+}
+
+// Replace every variable and function with the given variables.
+void Symbol_table::restore(std::vector<Variable> vars, std::vector<double> vals,
+                           std::vector<std::uint32_t> hs)
+{
+    var_table = std::move(vars);
+    values = std::move(vals);
+    hashes = std::move(hs);
+    fn_table.clear();
+    fn_hashes.clear();
+    stale = static_cast<std::size_t>(
+        std::count_if(var_table.begin(), var_table.end(),
+                      [](const Variable& v) { return v.is_stale; }));
+    std::size_t size{min_index};
+    while (2 * (var_table.size() + 1) > size) {
+        size *= 2;
+    }
+    rebuild(size);
+}
+
+// Determine if the variable in a slot is a constant.
+bool Symbol_table::is_constant(int i)
+{
+    return var_table[i].is_const;
+}
+
+// Count the variables in the symbol table.
+std::size_t Symbol_table::size()
+{
+    return values.size();
+}
+
+// Retrieve the values of all variables.
+double* Symbol_table::bindings()
+{
+    return values.data();
 }
@@ -4,60 +4,265 @@
 
 #pragma once
 
+#include "bytecode.h"
+#include "jit.h"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
 
+class Stats;
+
+// @class Binding
+// @brief The expression a bound variable's value is computed from.
+// @details The expression is compiled once, when the variable is bound, and
+// its value is computed again only when it is read after a variable it reads
+// has been assigned to; once it has been computed often enough, it is
+// computed by native code.
+class Binding {
+public:
+    Node_ptr expr;          // the expression, as written
+    Expression code;        // the expression, optimised, compiled
+    std::vector<int> reads; // the slots it reads, directly or in calls
+};
+
 // @class Variable
 // @brief A variable type.
+// @details A variable's value is kept in its symbol table slot.
 class Variable {
 public:
     std::string name; // a variable identifier
-    double value;     // a variable value
-    bool is_const;    // true if variable is a constant
+    bool is_const{};  // true if variable is a constant
+    bool is_stale{};  // true if bound, and its value is out of date
+    std::shared_ptr<const Binding> binding; // what it is bound to, if any
+    std::vector<int> dependents; // the bound variables that read it
 
-    // @brief Construct a variable with a name and value.
+    // @brief Construct a variable with a name.
     // @param[in] id a variable identifier.
-    // @param[in] v a variable value.
-    Variable(std::string id, double v) : name{id}, value{v} {}
+    Variable(std::string id) : name{id} {}
 
-    // @brief Construct a variable with a name, value and const-ness.
+    // @brief Construct a variable with a name and const-ness.
     // @param[in] id a variable identifier.
-    // @param[in] v a variable value.
     // @param[in] b true if id is a constant; false otherwise
-    Variable(std::string id, double v, bool b) : name{id}, value{v}, is_const{b}
-    {}
+    Variable(std::string id, bool b) : name{id}, is_const{b} {}
+};
+
+// @class Function
+// @brief A user-defined function.
+// @details A function's body is compiled once, when it is defined.  Its
+// parameters are bound by position, so a call copies no names; a function
+// that is small enough, and uses every parameter, is inlined where it is
+// called instead.  A body called often enough runs as native code.  A
+// function can call only functions defined before it.
+class Function {
+public:
+    std::string name;                    // a function identifier
+    std::vector<std::string> parameters; // parameter identifiers
+    Node_ptr body;                       // the body, as written
+    Node_ptr optimised;                  // the body, with calls inlined
+    int temps{};                         // temporaries optimised uses
+    Expression code;                     // optimised, compiled
+    bool is_inline{};                    // true if calls are inlined
+    std::vector<int> reads; // the slots the body reads, directly or in calls
+
+    // @brief Count the function's parameters.
+    // @return The number of arguments a call takes.
+    std::size_t arity() const { return parameters.size(); }
+};
+
+// @class Scope
+// @brief The parameters in scope in a body being parsed.
+// @details A function's body sees its own parameters; a reduction's sees its
+// index, and those of the bodies it is nested in, which it takes as
+// parameters of its own, captured, the first time it reads them.
+class Scope {
+public:
+    std::vector<std::string> names; // the parameters, by position
+    Scope* outer{};                 // the body this one is nested in, if any
+
+    // @brief Find a parameter, capturing it from an outer body if need be.
+    // @param[in] name an identifier.
+    // @return The parameter's position, or -1 if name is not in scope.
+    int find(std::string_view name);
 };
 
 // @class Symbol_table
 // @brief A symbol table type.
+// @details Each name is stored once, in the variable or function that owns
+// it, and is found through an open-addressing hash index; lookups do not
+// allocate.  Variables are numbered by slot in the order they are declared,
+// and functions by the order they are defined.  A name is either a variable
+// or a function.  Assigning to a variable marks the bound variables that
+// depend on it, directly or not, out of date; they are computed again, inputs
+// first, only when they are read.
 class Symbol_table {
 public:
-    std::vector<Variable> var_table; // table of variables
+    std::vector<Variable> var_table; // table of variables, indexed by slot
+    std::vector<double> values;      // variable values, indexed by slot
+    std::vector<std::shared_ptr<const Function>> fn_table; // functions
+    Stats* stats{};                  // counters to update, if any
 
-    // @brief Retrieve a variable's value.
+    // The parameters of the body being parsed, if any.
+    Scope* scope{};
+
+    // The slots find has found, in order, recorded while it is set.
+    std::vector<int>* uses{};
+
+    // The work of computing a bound variable's value, in a slot, and storing
+    // it; it returns the error that stopped it, if any.
+    using Recompute = std::function<Error(int, const Binding&)>;
+
+    // @brief Retrieve a variable's value, computing it if it is out of date.
     // @param[in] var a variable identifier.
-    // @throws std::runtime_error if the variable is undefined.
+    // @throws std::runtime_error if the variable is undefined, or its value
+    // cannot be computed.
     // @return The variable's value.
-    double get(std::string var);
+    double get(std::string_view var);
 
     // @brief Assign a new value to a variable.
     // @param[in] var a variable identifier.
     // @param[in] val a value.
-    // @throws std::runtime_error if the variable is undefined.
-    void set(std::string var, double val);
+    // @throws std::runtime_error if the variable is undefined, a constant or
+    // bound.
+    void set(std::string_view var, double val);
 
     // @brief Determine if the specified variable is declared.
     // @param[in] var the variable identifier to be tested.
     // @returns True if the variable is declared; false otherwise.
-    bool is_declared(std::string var);
+    bool is_declared(std::string_view var);
 
     // @brief Add a variable to the symbol table.
     // @param[in] var a variable identifier.
     // @param[in] val a value.
     // @param[in] is_const true if var is a constant; false otherwise.
     // @return An expression that is the value of the variable.
-    double declare(std::string var, double val, bool is_const);
+    double declare(std::string_view var, double val, bool is_const);
+
+    // @brief Add a variable to the symbol table, unless it is declared.
+    // @param[in] var a variable identifier.
+    // @param[in] val a value.
+    // @param[in] is_const true if var is a constant; false otherwise.
+    // @returns True if the variable was added; false if it was declared.
+    bool add(std::string_view var, double val, bool is_const);
+
+    // @brief Find the slot that holds a variable's value.
+    // @details A slot stays valid for the lifetime of the symbol table.
+    // @param[in] var a variable identifier.
+    // @throws std::runtime_error if the variable is undefined.
+    // @return The variable's slot.
+    int slot(std::string_view var);
+
+    // @brief Look a variable up.
+    // @param[in] var a variable identifier.
+    // @return The variable's slot, or -1 if the variable is undefined.
+    int find(std::string_view var);
+
+    // @brief Undeclare a variable, leaving its slot, nameless, in place.
+    // @param[in] i a slot.
+    void forget(int i);
+
+    // @brief Bind a variable to the expression its value is computed from.
+    // @param[in] i the variable's slot; its value must be the expression's.
+    // @param[in] b the binding.
+    void bind(int i, std::shared_ptr<const Binding> b);
+
+    // @brief Determine if the variable in a slot is bound.
+    // @param[in] i a slot.
+    // @returns True if the variable is bound; false otherwise.
+    bool is_bound(int i) const { return var_table[i].binding != nullptr; }
+
+    // @brief Determine if any bound variable reads the variable in a slot.
+    // @param[in] i a slot.
+    bool has_dependents(int i) const
+    {
+        return !var_table[i].dependents.empty();
+    }
+
+    // @brief Determine if any bound variable is out of date.
+    bool has_stale() const { return stale != 0; }
+
+    // @brief Note that a variable has been assigned to, marking the bound
+    // variables that depend on it out of date.
+    // @param[in] i a slot.
+    void touch(int i);
+
+    // @brief Bring variables up to date, computing those that are out of date
+    // after the variables they read.
+    // @param[in] slots the slots of the variables, and of any others.
+    // @param[in] recompute the work of computing a variable's value.
+    // @return The error that stopped a computation, if any; the variable, and
+    // those that depend on it, are then still out of date.
+    Error refresh(const std::vector<int>& slots, const Recompute& recompute);
+
+    // @brief Bring variables up to date, computing in double.
+    // @param[in] slots the slots of the variables, and of any others.
+    // @return The error that stopped a computation, if any.
+    Error refresh(const std::vector<int>& slots);
+
+    // @brief Add a function to the symbol table, unless its name is declared.
+    // @param[in] f a function.
+    // @returns True if the function was added; false if its name was
+    // declared.
+    bool define(std::shared_ptr<const Function> f);
+
+    // @brief Look a function up.
+    // @param[in] name a function identifier.
+    // @return The function, or null if it is undefined.
+    std::shared_ptr<const Function> function(std::string_view name);
+
+    // @brief Determine if the variable in a slot is a constant.
+    // @param[in] i a slot.
+    // @returns True if the variable is a constant; false otherwise.
+    bool is_constant(int i);
+
+    // @brief Replace every variable and function with the given variables.
+    // @details The names are not hashed again, and the hash index is built
+    // once, at its final size.
+    // @param[in] vars the variables, without bindings or dependents.
+    // @param[in] vals their values.
+    // @param[in] hs the hashes of their names, as name_hash returns them.
+    void restore(std::vector<Variable> vars, std::vector<double> vals,
+                 std::vector<std::uint32_t> hs);
+
+    // @brief Retrieve the hash of the name of the variable in a slot.
+    // @param[in] i a slot.
+    std::uint32_t name_hash(int i) const { return hashes[i]; }
+
+    // @brief Count the variables in the symbol table.
+    // @return The number of slots.
+    std::size_t size();
+
+    // @brief Retrieve the values of all variables.
+    // @return The variable values, indexed by slot.
+    double* bindings();
 
     // @brief Construct a symbol table.
     Symbol_table() {}
+
+private:
+    std::vector<std::uint32_t> hashes;    // name hashes, indexed by slot
+    std::vector<std::uint32_t> fn_hashes; // function name hashes
+    std::vector<int> index; // slot + 1, or -(function + 1), by hash; 0 if
+                            // empty
+    std::size_t stale{};    // the number of variables out of date
+
+    // @brief Look a name up.
+    // @param[in] name a variable or function identifier.
+    // @return Its entry in the hash index, or 0 if it is undefined.
+    int lookup(std::string_view name);
+
+    // @brief Add an entry to the hash index, growing it if need be.
+    // @param[in] h a name hash.
+    // @param[in] entry a slot + 1, or -(function + 1).
+    void insert(std::uint32_t h, int entry);
+
+    // @brief Rebuild the hash index with room for more names.
+    void grow();
+
+    // @brief Rebuild the hash index.
+    // @param[in] size the number of entries, a power of two.
+    void rebuild(std::size_t size);
 };
@@ -0,0 +1,148 @@
+// task_graph.cc: Task dependency graphs, run on a work-stealing pool.
+// SPDX-FileCopyrightText: © 2021-2022 Bradley M. Jones <brdjns@gmx.us>
+// SPDX-License-Identifier: MIT
+
+#include "task_graph.h"
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace {
+    // The tasks one thread has made ready.  The owner pushes and pops at the
+    // back; thieves take from the front, the tasks readied longest ago.
+    class alignas(64) Ready {
+    public:
+        // Add a task.
+        void push(std::uint32_t task)
+        {
+            std::lock_guard<std::mutex> hold{lock};
+            tasks.push_back(task);
+        }
+
+        // Take the newest task, if any, for the owner.
+        bool pop(std::uint32_t& task)
+        {
+            std::lock_guard<std::mutex> hold{lock};
+            if (tasks.empty()) {
+                return false;
+            }
+            task = tasks.back();
+            tasks.pop_back();
+            return true;
+        }
+
+        // Take the oldest task, if any, for another thread.
+        bool steal(std::uint32_t& task)
+        {
+            std::lock_guard<std::mutex> hold{lock};
+            if (tasks.empty()) {
+                return false;
+            }
+            task = tasks.front();
+            tasks.pop_front();
+            return true;
+        }
+
+    private:
+        std::mutex lock;
+        std::deque<std::uint32_t> tasks;
+    };
+}
+
+// Run every task once, each after the tasks it waits for.
+void Task_graph::run(unsigned threads,
+                     const std::function<void(std::size_t)>& task)
+{
+    if (threads <= 1 || count < min_parallel_tasks) {
+        for (std::size_t i = 0; i < count; ++i) {
+            task(i);
+        }
+        return;
+    }
+
+    // List each task's successors, without repeats, and count the tasks
+    // each waits for.
+    std::sort(edges.begin(), edges.end());
+    edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+    std::vector<std::uint32_t> first(count + 1); // where i's successors start
+    std::unique_ptr<std::atomic<std::uint32_t>[]> waiting{
+        new std::atomic<std::uint32_t>[count]};
+    for (std::size_t i = 0; i < count; ++i) {
+        waiting[i].store(0, std::memory_order_relaxed);
+    }
+    std::vector<std::uint32_t> successors(edges.size());
+    for (std::size_t e = 0; e < edges.size(); ++e) {
+        ++first[edges[e].first + 1];
+        waiting[edges[e].second].fetch_add(1, std::memory_order_relaxed);
+        successors[e] = edges[e].second;
+    }
+    for (std::size_t i = 0; i < count; ++i) {
+        first[i + 1] += first[i];
+    }
+
+    // Deal the tasks that wait for nothing round the threads.
+    threads = static_cast<unsigned>(std::min<std::size_t>(threads, count));
+    std::unique_ptr<Ready[]> ready{new Ready[threads]};
+    unsigned dealt{0};
+    for (std::size_t i = 0; i < count; ++i) {
+        if (waiting[i].load(std::memory_order_relaxed) == 0) {
+            ready[dealt++ % threads].push(static_cast<std::uint32_t>(i));
+        }
+    }
+
+    std::atomic<std::size_t> left{count};
+    std::atomic<bool> failed{false};
+    std::exception_ptr failure;
+    std::mutex failure_lock;
+
+    auto work = [&](unsigned self) {
+        while (left.load(std::memory_order_acquire) != 0 &&
+               !failed.load(std::memory_order_relaxed)) {
+            std::uint32_t t;
+            bool found{ready[self].pop(t)};
+            for (unsigned k = 1; !found && k < threads; ++k) {
+                found = ready[(self + k) % threads].steal(t);
+            }
+            if (!found) {
+                std::this_thread::yield();
+                continue;
+            }
+            try {
+                task(t);
+            }
+            catch (...) {
+                std::lock_guard<std::mutex> hold{failure_lock};
+                if (!failure) {
+                    failure = std::current_exception();
+                }
+                failed.store(true, std::memory_order_relaxed);
+                return;
+            }
+            for (std::uint32_t s = first[t]; s < first[t + 1]; ++s) {
+                std::uint32_t next{successors[s]};
+                if (waiting[next].fetch_sub(1, std::memory_order_acq_rel) ==
+                    1) {
+                    ready[self].push(next);
+                }
+            }
+            left.fetch_sub(1, std::memory_order_acq_rel);
+        }
+    };
+
+    std::vector<std::thread> pool;
+    pool.reserve(threads - 1);
+    for (unsigned t = 1; t < threads; ++t) {
+        pool.emplace_back(work, t);
+    }
+    work(0);
+    for (std::thread& t : pool) {
+        t.join();
+    }
+    if (failure) {
+        std::rethrow_exception(failure);
+    }
+}
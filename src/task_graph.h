@@ -0,0 +1,62 @@
+// task_graph.h: Task dependency graph interface.
+// SPDX-FileCopyrightText: © 2021-2022 Bradley M. Jones <brdjns@gmx.us>
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+// Graphs with fewer tasks than this are run in order, on the calling thread:
+// starting threads would cost more than they save.
+constexpr std::size_t min_parallel_tasks{64};
+
+// @class Task_graph
+// @brief A graph of tasks, and the order they must run in.
+// @details Tasks are numbered from 0 in the order they are added, and a task
+// can wait only for tasks added before it, so the graph has no cycles and
+// numbering order is always an order it can run in.  The graph is run on a
+// pool of threads that steal work: each thread keeps a deque of the tasks it
+// has made ready, runs the newest first, and when it has none takes the
+// oldest from another thread's deque.
+class Task_graph {
+public:
+    // @brief Add a task.
+    // @return The task's number.
+    std::size_t add() { return count++; }
+
+    // @brief Make a task wait for another to finish before it starts.
+    // @param before a task.
+    // @param after a task added after before.
+    void depend(std::size_t before, std::size_t after)
+    {
+        edges.emplace_back(static_cast<std::uint32_t>(before),
+                           static_cast<std::uint32_t>(after));
+    }
+
+    // @brief Count the tasks.
+    std::size_t size() const { return count; }
+
+    // @brief Remove every task.
+    void clear()
+    {
+        count = 0;
+        edges.clear();
+    }
+
+    // @brief Run every task once, each after the tasks it waits for.
+    // @param threads the most threads to run tasks on, including the calling
+    // thread; 1 runs them in order on the calling thread.
+    // @param task the work of a task, called with its number.
+    // @throws Whatever task throws; no more tasks are started then.
+    void run(unsigned threads, const std::function<void(std::size_t)>& task);
+
+private:
+    std::size_t count{}; // the number of tasks
+
+    // Pairs of tasks (before, after), where after waits for before.
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> edges;
+};
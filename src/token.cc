@@ -3,24 +3,258 @@
 // SPDX-License-Identifier: MIT
 
 #include "token.h"
-#include "error.h"
-#include <cctype>
+#include "function.h"
+#include "reduce.h"
+#include "stats.h"
+#include <charconv>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 
-// @brief Fetch a token from the standard input.
+namespace {
+    // Character classes.
+    enum Char_class : unsigned char {
+        space = 1,
+        digit = 2,
+        alpha = 4,
+    };
+
+    // Classify the characters of the basic character set.
+    constexpr auto classify()
+    {
+        struct {
+            unsigned char of[256];
+        } table{};
+        for (const char* s = " \t\n\v\f\r"; *s; ++s) {
+            table.of[static_cast<unsigned char>(*s)] = space;
+        }
+        for (int ch = '0'; ch <= '9'; ++ch) {
+            table.of[ch] = digit;
+        }
+        for (int ch = 'a'; ch <= 'z'; ++ch) {
+            table.of[ch] = alpha;
+            table.of[ch - 'a' + 'A'] = alpha;
+        }
+        return table;
+    }
+
+    constexpr auto char_class = classify();
+
+    // Determine if ch is in any of the classes c.
+    bool in_class(char ch, unsigned char c)
+    {
+        return (char_class.of[static_cast<unsigned char>(ch)] & c) != 0;
+    }
+
+    // Determine if ch is white space.
+    bool is_space(char ch) { return in_class(ch, space); }
+
+    // Determine if ch is a decimal digit.
+    bool is_digit(char ch) { return in_class(ch, digit); }
+
+    // Determine if ch can start an identifier.
+    bool is_alpha(char ch) { return in_class(ch, alpha); }
+
+    // Skip the digits at p.
+    const char* skip_digits(const char* p, const char* end)
+    {
+        while (p < end && is_digit(*p)) {
+            ++p;
+        }
+        return p;
+    }
+
+    // A reserved word: a keyword, or the name of a built-in function or a
+    // reduction.
+    class Reserved {
+    public:
+        std::string_view name; // the word
+        char kind{};           // the token kind it is read as
+        int id{};              // a built-in function's ID, or a reduction
+    };
+
+    constexpr Reserved keywords[]{
+        {kw_let, Symbol::let_tok},     {kw_const, Symbol::const_tok},
+        {kw_set, Symbol::set_tok},     {kw_fn, Symbol::fn_tok},
+        {kw_bind, Symbol::bind_tok},   {kw_save, Symbol::save_tok},
+        {kw_load, Symbol::load_tok},   {kw_exit, Symbol::quit_tok},
+        {reduction_names[static_cast<int>(Reduction::sum)],
+         Symbol::reduce_tok, static_cast<int>(Reduction::sum)},
+        {reduction_names[static_cast<int>(Reduction::prod)],
+         Symbol::reduce_tok, static_cast<int>(Reduction::prod)},
+        {reduction_names[static_cast<int>(Reduction::mean)],
+         Symbol::reduce_tok, static_cast<int>(Reduction::mean)},
+    };
+
+    constexpr std::size_t keyword_count{sizeof keywords / sizeof keywords[0]};
+    constexpr std::size_t reserved_count{keyword_count + builtin_count};
+
+    // List the reserved words: the keywords, then the built-in functions.
+    constexpr auto list_reserved()
+    {
+        struct {
+            Reserved of[reserved_count];
+        } words{};
+        for (std::size_t i = 0; i < keyword_count; ++i) {
+            words.of[i] = keywords[i];
+        }
+        for (std::size_t i = 0; i < builtin_count; ++i) {
+            words.of[keyword_count + i] = Reserved{
+                builtins[i].name, Symbol::builtin_tok, static_cast<int>(i)};
+        }
+        return words;
+    }
+
+    constexpr auto reserved_words = list_reserved();
+
+    // The number of entries in the reserved word table, a power of two.
+    constexpr std::size_t table_size{256};
+    static_assert(reserved_count < table_size, "too many reserved words");
+
+    // Hash a word, FNV-1a style, from a seed.
+    constexpr std::size_t hash(std::string_view word, std::uint32_t seed)
+    {
+        std::uint32_t h{2166136261u ^ seed};
+        for (char ch : word) {
+            h = (h ^ static_cast<unsigned char>(ch)) * 16777619u;
+        }
+        return (h ^ h >> 16) & (table_size - 1);
+    }
+
+    // Find a seed for which no two reserved words hash alike, and tabulate
+    // the words by hash.  A table entry is a word's index plus one, or zero
+    // if no word hashes to it.
+    constexpr auto tabulate_reserved()
+    {
+        struct {
+            std::uint32_t seed;
+            unsigned char entry[table_size];
+        } table{};
+        for (std::uint32_t seed = 1; seed < 100000; ++seed) {
+            table = {};
+            table.seed = seed;
+            bool perfect{true};
+            for (std::size_t i = 0; perfect && i < reserved_count; ++i) {
+                unsigned char& e{table.entry[hash(reserved_words.of[i].name,
+                                                  seed)]};
+                perfect = e == 0;
+                e = static_cast<unsigned char>(i + 1);
+            }
+            if (perfect) {
+                return table;
+            }
+        }
+        table.seed = 0;
+        return table;
+    }
+
+    constexpr auto reserved_table = tabulate_reserved();
+    static_assert(reserved_table.seed != 0, "no perfect hash was found");
+
+    // Find the reserved word spelled word, with one hash and one comparison.
+    const Reserved* find_reserved(std::string_view word)
+    {
+        unsigned char e{reserved_table.entry[hash(word, reserved_table.seed)]};
+        if (e == 0 || reserved_words.of[e - 1].name != word) {
+            return nullptr;
+        }
+        return &reserved_words.of[e - 1];
+    }
+
+    // The longest number literal converted without a heap allocation.
+    constexpr std::size_t max_literal{64};
+
+    // Convert the floating-point literal [p, end) to a double.
+    double to_double(const char* p, const char* end)
+    {
+        double value{};
+        if (std::from_chars(p, end, value).ec == std::errc{}) {
+            return value;
+        }
+
+        // Out of range: let std::strtod round to infinity or zero.
+        auto n = static_cast<std::size_t>(end - p);
+        if (n < max_literal) {
+            char buf[max_literal];
+            std::memcpy(buf, p, n);
+            buf[n] = '\0';
+            return std::strtod(buf, nullptr);
+        }
+        return std::strtod(std::string(p, n).c_str(), nullptr);
+    }
+}
+
+// @brief Read the next line from the input stream.
+// @returns False at the end of input.
+bool Token_stream::refill()
+{
+    if (!is) {
+        return false;
+    }
+    if (!std::getline(*is, text)) {
+        return false;
+    }
+    text += '\n';
+    if (stats) {
+        stats->bytes_read += text.size();
+    }
+    base += static_cast<std::size_t>(end - begin);
+    begin = text.data();
+    p = text.data();
+    end = p + text.size();
+    return true;
+}
+
+// @brief Fetch a token.
 // @pre An ASCII character.
-// @returns A token.
-// @throws std::runtime_error if token is not alphanumeric or an operator.
+// @returns A token, or Symbol::error_tok if the token is not alphanumeric or
+// an operator.
 Token Token_stream::get()
 {
     if (full) {
         full = false;
+        at = put_at;
         return buffer;
     }
+    if (!stats) {
+        return scan();
+    }
+    Phase_timer timer{stats, Phase::lex};
+    ++stats->tokens;
+    return scan();
+}
+
+// @brief Count the tokens and bytes scanned from now on.
+// @param s the counters to update, or nullptr to stop counting.
+void Token_stream::collect(Stats* s)
+{
+    stats = s;
+    if (stats && !is) {
+        stats->bytes_read += static_cast<std::size_t>(end - p);
+    }
+}
 
-    char ch{};
-    std::cin >> ch;
+// @brief Scan a token.
+// @returns A token, or Symbol::error_tok if the token is not alphanumeric or
+// an operator.
+Token Token_stream::scan()
+{
+    for (;;) {
+        while (p < end && is_space(*p)) {
+            ++p;
+        }
+        if (p < end) {
+            break;
+        }
+        if (!refill()) {
+            at = base + static_cast<std::size_t>(p - begin);
+            return Token{Symbol::quit_tok}; // end of input
+        }
+    }
+    at = base + static_cast<std::size_t>(p - begin);
 
+    char ch{*p};
     switch (ch) {
     case Symbol::print_tok:
     case Symbol::lparen_tok:
@@ -39,6 +273,7 @@ Token Token_stream::get()
     case Symbol::equals_tok:
     case Symbol::caret_tok:
     case Symbol::comma_tok:
+        ++p;
         return Token{ch};
     case Symbol::dot_tok:
     case '0':
@@ -52,39 +287,64 @@ Token Token_stream::get()
     case '8':
     case '9':
     {
-        std::cin.unget();
-        double value{};
-        std::cin >> value;
-        return Token{Symbol::number_tok, value};
+        // [digits][.digits][(e|E)[+|-]digits]
+        const char* start{p};
+        const char* q{skip_digits(p, end)};
+        if (q < end && *q == '.') {
+            q = skip_digits(q + 1, end);
+        }
+        if (q == start + 1 && *start == '.') {
+            ++p;
+            return Token{Symbol::error_tok};
+        }
+        if (q < end && (*q == 'e' || *q == 'E')) {
+            const char* e{q + 1};
+            if (e < end && (*e == '+' || *e == '-')) {
+                ++e;
+            }
+            if (e < end && is_digit(*e)) {
+                q = skip_digits(e, end);
+            }
+        }
+        p = q;
+        std::string_view text{start, static_cast<std::size_t>(q - start)};
+        return Token{Symbol::number_tok, to_double(start, q), text};
+    }
+    case Symbol::string_tok: // "text", on one line, without escapes
+    {
+        const char* start{p + 1};
+        auto left = static_cast<std::size_t>(end - start);
+        auto close = static_cast<const char*>(std::memchr(start, '"', left));
+        auto newline = static_cast<const char*>(std::memchr(start, '\n', left));
+        if (!close || (newline && newline < close)) {
+            ++p;
+            return Token{Symbol::error_tok};
+        }
+        p = close + 1;
+        auto size = static_cast<std::size_t>(close - start);
+        return Token{Symbol::string_tok, std::string_view{start, size}};
     }
     case eof_tok: // end of file (^Z on MS-Windows, ^D on Unix)
+        ++p;
         return Token{Symbol::quit_tok};
     default: // identifiers
-        if (std::isalpha(ch)) {
-            std::string str;
-            str += ch;
-            while (std::cin.get(ch) &&
-                   (std::isalpha(ch) || ch == '_' || std::isdigit(ch))) {
-                str += ch;
+        if (is_alpha(ch)) {
+            const char* start{p};
+            while (++p < end && (in_class(*p, alpha | digit) || *p == '_')) {
+            }
+            std::string_view str{start, static_cast<std::size_t>(p - start)};
+            if (const Reserved* r{find_reserved(str)}) {
+                if (r->kind == Symbol::builtin_tok ||
+                    r->kind == Symbol::reduce_tok) {
+                    return Token{r->kind, static_cast<double>(r->id), str};
+                }
+                return Token{r->kind};
             }
-            std::cin.putback(ch);
-            if (str == kw_let)
-                return Token{Symbol::let_tok};
-            if (str == kw_const)
-                return Token{Symbol::const_tok};
-            if (str == kw_set)
-                return Token{Symbol::set_tok};
-            if (str == kw_exit)
-                return Token{Symbol::quit_tok};
-            if (str == kw_sqrt)
-                return Token{Symbol::sqrt_tok};
-            if (str == kw_abs)
-                return Token{Symbol::abs_tok};
             return Token{Symbol::ident_tok, str};
         }
-        error("unrecognized token");
+        ++p;
+        return Token{Symbol::error_tok};
     }
-    return Token{'?'}; // never reached
 }
 
 // @brief Discard characters up to and including a c.
@@ -96,9 +356,15 @@ void Token_stream::ignore(char c)
         return;
     }
     full = false;
-    for (char ch{}; std::cin >> ch;) {
-        if (ch == c) {
-            return;
+    do {
+        if (p < end) {
+            auto found = static_cast<const char*>(
+                std::memchr(p, c, static_cast<std::size_t>(end - p)));
+            if (found) {
+                p = found + 1;
+                return;
+            }
+            p = end;
         }
-    }
+    } while (refill());
 }
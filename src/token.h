@@ -4,16 +4,25 @@
 
 #pragma once
 
+#include <cstddef>
+#include <iostream>
 #include <string>
+#include <string_view>
+
+class Stats;
 
 // @class Token
 // @brief A token class.
-// @details Represents a token that has a kind and a value.
+// @details Represents a token that has a kind and a value.  An identifier's
+// name, and a number's spelling, is a view of the text the token was read
+// from.
 class Token {
 public:
-    char kind{};      // a token kind
-    double value{};   // a token value
-    std::string name; // an identifier name
+    char kind{};           // a token kind
+    double value{};        // a number, a built-in function's ID, or a
+                           // reduction
+    std::string_view name; // an identifier name, a number's spelling, or
+                           // what a string quotes
 
     // @brief Construct a token from a character.
     // @param[in] ch a kind.
@@ -24,42 +33,95 @@ public:
     // @param[in] val a value.
     Token(char ch, double val) : kind{ch}, value{val} {}
 
+    // @brief Construct a token from a character, value and spelling.
+    // @param[in] ch a kind.
+    // @param[in] val a value.
+    // @param[in] text the text val was read from.
+    Token(char ch, double val, std::string_view text)
+        : kind{ch}, value{val}, name{text}
+    {}
+
     // @brief Construct a token from a character and name.
     // @param[in] ch a kind.
     // @param[in] n an identifier.
-    Token(char ch, std::string id) : kind{ch}, name{id} {}
+    Token(char ch, std::string_view id) : kind{ch}, name{id} {}
 };
 
 // @class Token_stream
 // @brief A token stream class.
-// @details Converts characters into tokens.
+// @details Converts characters into tokens, scanning a contiguous buffer.
+// A stream of tokens either scans a caller's buffer in place, or reads an
+// input stream a line at a time so that it can be used interactively.  The
+// name of a token read from a stream views the line it was read from, which
+// the next line read overwrites, so it must be copied before the next token
+// is fetched if it is to be kept.
 class Token_stream {
 public:
     // @brief Construct a stream of tokens that reads from the standard input.
-    Token_stream() : full{false}, buffer{0} {}
+    Token_stream() : Token_stream{std::cin} {}
 
-    // @brief Construct a stream of tokens that reads from the standard input.
+    // @brief Construct a stream of tokens that reads from an input stream.
     // @param[in] is an input stream.
-    Token_stream(std::istream& is) : full{false}, buffer{0} {}
-
-    // @brief Fetch a token from the standard input.
+    Token_stream(std::istream& is) : is{&is}, full{false}, buffer{0} {}
+
+    // @brief Construct a stream of tokens that scans text in place.
+    // @param[in] text the text to scan; it must outlive the stream's tokens.
+    Token_stream(std::string_view text)
+        : begin{text.data()}, p{text.data()}, end{text.data() + text.size()},
+          full{false}, buffer{0}
+    {}
+
+    // @brief Fetch a token.
+    // @details A character that starts no token is returned as
+    // Symbol::error_tok, rather than thrown, so that malformed input costs
+    // no more to report than well-formed input costs to accept.
     Token get();
 
+    // @brief Find where the token last fetched started.
+    // @return The offset of the token from the start of the input.
+    std::size_t position() const { return at; }
+
+    // @brief Count the tokens and bytes scanned from now on, and time
+    // scanning them.
+    // @param[in] s the counters to update, or nullptr to stop counting.
+    void collect(Stats* s);
+
     // @brief Put a token back into the token stream.
     // @param[in] t a token.
     void putback(Token t)
     {
         buffer = t;
+        put_at = at;
         full = true;
     }
 
+    // @brief Determine if the stream scans text in place, and so never
+    // waits for input.
+    bool scans_in_place() const { return is == nullptr; }
+
     // @brief Discard characters up to and including a c.
     // @param[in] c character to ignore.
     void ignore(char c);
 
 private:
-    bool full;    // True when the token buffer is full
-    Token buffer; // A buffer of tokens
+    // @brief Read the next line from the input stream.
+    // @return False at the end of input.
+    bool refill();
+
+    // @brief Scan a token.
+    Token scan();
+
+    std::istream* is{};   // The stream to read from, if any
+    std::string text;     // The line last read from is
+    std::size_t base{};   // The offset of the current line in the input
+    const char* begin{};  // The start of the text being scanned
+    const char* p{};      // The next character to scan
+    const char* end{};    // The end of the text to scan
+    bool full;            // True when the token buffer is full
+    Token buffer;         // A buffer of tokens
+    std::size_t at{};     // The offset of the token last fetched
+    std::size_t put_at{}; // The offset of the token in the buffer
+    Stats* stats{};       // Counters to update, if any
 };
 
 // Recognised scanner symbols.
@@ -92,13 +154,18 @@ enum Symbol {
     let_tok = 'L',
     set_tok = 'S',
     const_tok = 'C',
+    bind_tok = 'D',
+    fn_tok = 'F',
+    save_tok = 'W',
+    load_tok = 'R',
     quit_tok = 'E',
     number_tok = '#',
     ident_tok = '@',
+    string_tok = '"', // a quoted file name; its name is what is quoted
 
     // function operators
-    sqrt_tok = 'R',
-    abs_tok = 'A',
+    builtin_tok = 'B', // a built-in function; its value is the function's ID
+    reduce_tok = 'U',  // sum, prod or mean; its value is the Reduction
 
     // non-printing
     eof_tok = '\0',
@@ -106,12 +173,15 @@ enum Symbol {
     // other
     print_tok = ';',
     dot_tok = '.',
+    error_tok = '?', // a character that starts no token
 };
 
 // Keywords.
-const std::string kw_let{"let"};
-const std::string kw_set{"set"};
-const std::string kw_const{"const"};
-const std::string kw_exit{"exit"};
-const std::string kw_sqrt{"sqrt"};
-const std::string kw_abs{"abs"};
+constexpr std::string_view kw_let{"let"};
+constexpr std::string_view kw_set{"set"};
+constexpr std::string_view kw_const{"const"};
+constexpr std::string_view kw_bind{"bind"};
+constexpr std::string_view kw_fn{"fn"};
+constexpr std::string_view kw_save{"save"};
+constexpr std::string_view kw_load{"load"};
+constexpr std::string_view kw_exit{"exit"};
@@ -0,0 +1,175 @@
+// test.cc: calc regression tests.
+// SPDX-FileCopyrightText: © 2021-2022 Bradley M. Jones <brdjns@gmx.us>
+// SPDX-License-Identifier: MIT
+
+#include "format.h"
+#include "number.h"
+#include "profile.h"
+#include "session.h"
+#include "token.h"
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+namespace {
+    int failures{0}; // checks that have failed
+
+    // Check that a test printed what it should have.
+    void check(const std::string& test, const std::string& got,
+               const std::string& want)
+    {
+        if (got != want) {
+            ++failures;
+            std::cerr << test << ": got\n" << got << "wanted\n" << want;
+        }
+    }
+
+    // What a session prints, results and errors together, for input read
+    // from a stream a line at a time, as calc reads its standard input.
+    std::string stream(const std::string& input)
+    {
+        std::istringstream is{input};
+        std::ostringstream out;
+        Token_stream ts{is};
+        Session session;
+        session.execute(ts, out, out);
+        return out.str();
+    }
+
+    // What a session prints for a text, profiled or not.
+    std::string run(const std::string& text, bool is_profiled = false)
+    {
+        std::ostringstream out;
+        Session session;
+        Profile profile;
+        if (is_profiled) {
+            session.collect(&profile);
+        }
+        session.execute(text, out, out);
+        return out.str();
+    }
+
+    // An integer expression prints the same whether it is printed at once,
+    // stored in a variable, passed to a function, or profiled.
+    void test_integer_paths()
+    {
+        const std::string exprs[]{"2^62 + 1", "123456789 * 987654321",
+                                  "(2^62 + 1) - 2^62", "-0",
+                                  "2^62 + 0.5 * 2 - 2^62"};
+        for (const std::string& e : exprs) {
+            std::string want{run(e + ";")};
+            check(e + " stored", run("let x = " + e + "; x;"), want + want);
+            check(e + " passed", run("fn f(x) = x; f(" + e + ");"), want);
+            check(e + " profiled", run(e + ";", true), want);
+        }
+        check("rounded", run("2^62 + 1;"), "4611686018427387904\n");
+        check("exact", run("(2^62 + 1) - 2^62;"), "1\n");
+        check("inlined", run("fn g(x) = x + 1; g(2^62) - 2^62;"),
+              run("fn g(x) = x + 1; g(2^62) - 2^62;", true));
+        check("constant", run("const c = 2^52 + 1; c * c - (2^52 + 1)^2;"),
+              run("const c = 2^52 + 1; c * c - (2^52 + 1)^2;", true));
+    }
+
+    // What a session prints for a text, in a number type.
+    std::string run_in(const std::string& text, Numeric type)
+    {
+        std::ostringstream out;
+        Session session;
+        session.numeric(type);
+        session.execute(text, out, out);
+        return out.str();
+    }
+
+    // A number formatted as a session prints it.
+    template<class T>
+    std::string printed(T v)
+    {
+        char text[max_number_size];
+        return std::string(text, format_number(text, text + max_number_size,
+                                               v, Number_format{})) +
+               "\n";
+    }
+
+    // Built-in functions are computed in float and long double, not in
+    // double.
+    void test_builtin_types()
+    {
+        check("long double sin", run_in("sin(1);", Numeric::extended),
+              printed(std::sin(1.0L)));
+        check("long double atan2", run_in("atan2(1, 3);", Numeric::extended),
+              printed(std::atan2(1.0L, 3.0L)));
+        check("float exp", run_in("exp(1);", Numeric::binary32),
+              printed(std::exp(1.0f)));
+        check("float domain", run_in("acosh(0);", Numeric::binary32),
+              "error: domain error\n");
+    }
+
+    // The nodes the optimiser removes from a text's statements, as a line.
+    std::string removed(const std::string& text)
+    {
+        std::ostringstream out;
+        Session session;
+        session.execute(text, out, out);
+        return std::to_string(session.nodes_removed()) + "\n";
+    }
+
+    // Folding, identities and sharing count as removing nodes, and inlining
+    // a call, which adds them, does not count.
+    void test_nodes_removed()
+    {
+        const std::string f{"fn f(x) = x * 2 + x / 3 + 1; let a = 1; "};
+        check("inlined", removed(f + "f(a) + f(a + 1);"), "0\n");
+        check("folded", removed(f + "2 * 3 + a * 1;"), "4\n");
+        check("shared", removed(f + "(a + 1) * (a + 1);"), "1\n");
+    }
+
+    // Names in errors survive the lines read after them, however many of
+    // those are blank.
+    void test_names_across_lines()
+    {
+        check("assignment", stream("set\nabcdef\n\n\nqq 5;\n"),
+              "error: '=' missing in assignment of abcdef\n");
+        check("long assignment",
+              stream("set\nabcdefghijklmnopqrstuvwxyz\n\n" +
+                     std::string(300, 'x') + " 5;\n"),
+              "error: '=' missing in assignment of "
+              "abcdefghijklmnopqrstuvwxyz\n");
+        check("declaration", stream("let\nqwertyuiopasdfghjkl\n\n\n 4;\n"),
+              "error: '=' missing in declaration of qwertyuiopasdfghjkl\n");
+        check("extremum", stream("max(zzzzzzzzzzzzzzzz\n\n\n, 2);\n"),
+              "error: zzzzzzzzzzzzzzzz is undefined\n");
+        check("extremum operand",
+              stream("max(yyyyyyyyyyyyyyyy\n\n\n+ 2, 3);\n"),
+              "error: yyyyyyyyyyyyyyyy is undefined\n");
+        check("call",
+              stream("fn ffffffffffffffff(x) = x;\n"
+                     "ffffffffffffffff(1,\n\n\n2);\n"),
+              "error: wrong number of arguments to ffffffffffffffff\n");
+    }
+
+    // Statements run the same however their tokens are split over lines.
+    void test_statements_across_lines()
+    {
+        check("split statements",
+              stream("let a = 2;\nlet\nbb\n\n=\n3;\n"
+                     "fn f(x,\ny) = x +\n\ny;\nf(a,\n\nbb);\n"
+                     "max(a,\n\n bb);\nsum(i,\n1,\n\n3, i);\n"),
+              "2\n3\n5\n3\n6\n");
+    }
+}
+
+int main()
+{
+    test_names_across_lines();
+    test_statements_across_lines();
+    test_integer_paths();
+    test_builtin_types();
+    test_nodes_removed();
+    if (failures) {
+        std::cerr << failures << " checks failed\n";
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}